@@ -1,12 +1,30 @@
+// On Windows, GLAD pulls in windows.h. Keep it from defining min/max macros that break std::min/std::max.
+#define NOMINMAX
+
 // Quick note: GLAD needs to be included first before GLFW.
 // Otherwise, GLAD will complain about gl.h being already included.
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
+// BC1 is only named by the S3TC extension, which the loader may not have been generated with
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+
 #define _USE_MATH_DEFINES
 #include <cmath>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <thread>
 #include <vector>
 #include <string>
 #include <vector>
@@ -16,40 +34,312 @@
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
 #include <irrklang/irrKlang.h>
 
+// Platform headers used to memory-map level files
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Frustum culling tests four boxes at once with SSE where available, and falls back to plain C++ otherwise
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define USE_SSE_CULLING
+#include <xmmintrin.h>
+#endif
+
 using namespace irrklang;
 
+/**
+ * An active uniform of a linked shader program, as reported by glGetActiveUniform
+ */
+struct ActiveUniform
+{
+	GLint location;
+	GLenum type;
+	GLint size;		// Number of elements for array uniforms
+};
+
+/**
+ * A linked shader program along with its active uniforms, enumerated once at link time
+ */
+struct ShaderProgram
+{
+	GLuint id = 0;
+	std::map<std::string, ActiveUniform> uniforms;
+};
+
+/**
+ * Shader files to build a shader program from: a vertex and a fragment shader, or a compute shader on its own
+ */
+struct ShaderProgramSource
+{
+	std::string vertexShaderFilePath;
+	std::string fragmentShaderFilePath;
+	std::string defines;		// #define lines to build a permutation of the shaders with, see ShaderDefine
+	std::string computeShaderFilePath;	// If set, the program is this compute shader alone and the other paths are ignored
+
+	ShaderProgramSource() = default;
+
+	ShaderProgramSource(const std::string& vertexPath, const std::string& fragmentPath, const std::string& shaderDefines = std::string())
+		: vertexShaderFilePath(vertexPath), fragmentShaderFilePath(fragmentPath), defines(shaderDefines)
+	{
+	}
+};
+
+/**
+ * Linked program binary, as returned by glGetProgramBinary
+ */
+struct ShaderBinary
+{
+	GLenum format = 0;
+	std::vector<char> data;
+};
+
+/**
+ * Linked shader programs saved between runs, so that later launches can skip compiling them.
+ * Each binary is keyed by a hash of its program's sources and of the driver that made it.
+ */
+struct ShaderCache
+{
+	std::string filePath;
+	bool enabled = false;						// Whether the driver can save and load program binaries
+	uint64_t driverKey = 0;						// Hash of the driver's vendor, renderer and version strings
+	std::map<uint64_t, ShaderBinary> binaries;
+	std::set<uint64_t> used;					// Binaries used this run. Only these are saved, so stale ones are dropped.
+	bool modified = false;						// Whether a binary was added this run
+};
+
+/**
+ * Header of the shader cache file. It is followed by binaryCount binaries, each a ShaderCacheEntry and then its data.
+ */
+struct ShaderCacheHeader
+{
+	char identifier[4];
+	uint32_t version;
+	uint32_t binaryCount;
+};
+
+struct ShaderCacheEntry
+{
+	uint64_t key;
+	uint32_t format;
+	uint32_t size;
+};
+
+const char SHADER_CACHE_IDENTIFIER[4] = { 'G', 'S', 'C', 'B' };
+
+// Bump this whenever the shader cache file format changes
+const uint32_t SHADER_CACHE_VERSION = 1;
+
+// Starting value of a 64-bit FNV-1a hash
+const uint64_t FNV1A_OFFSET_BASIS = 14695981039346656037ull;
+
+/**
+ * Pre-resolved handle to a uniform of type T. A location of -1 is silently ignored by glUniform*.
+ */
+template <typename T>
+struct Uniform
+{
+	GLint location = -1;
+};
+
+/**
+ * Maps a C++ uniform type to the GLSL type reported by glGetActiveUniform
+ */
+template <typename T> struct UniformTraits;
+template <> struct UniformTraits<glm::mat4> { static const GLenum glType = GL_FLOAT_MAT4; };
+template <> struct UniformTraits<glm::vec3> { static const GLenum glType = GL_FLOAT_VEC3; };
+template <> struct UniformTraits<GLfloat> { static const GLenum glType = GL_FLOAT; };
+template <> struct UniformTraits<GLint> { static const GLenum glType = GL_INT; };		// Also used for samplers
+template <> struct UniformTraits<bool> { static const GLenum glType = GL_BOOL; };
+
+// Maximum number of shadow cascades. Must match the lightViewProjection array size in the shaders.
+const int MAX_SHADOW_CASCADES = 4;
+
+/**
+ * Per-frame matrices shared by every shader program through a std140 uniform block.
+ * The shaders get their declaration of the block from GetFrameUniformsDeclaration, which must list the same members.
+ */
+struct FrameUniforms
+{
+	glm::mat4 camera;
+	glm::mat4 perspective;
+	glm::mat4 lightViewProjection[MAX_SHADOW_CASCADES];	// One per shadow cascade
+	glm::vec4 cascadeSplits;							// View-space distance where each cascade ends
+	glm::ivec4 lightBufferOffsets;						// First texel of this frame's light data, cluster ranges and light indices, see LightBufferMode
+};
+
+// Every member is a whole number of vec4s, so std140 adds no padding and the struct can be copied into the buffer as is
+static_assert(sizeof(FrameUniforms) == (2 + MAX_SHADOW_CASCADES) * sizeof(glm::mat4) + 2 * sizeof(glm::vec4), "FrameUniforms must match its std140 layout");
+
+// Uniform buffer binding point of the FrameUniforms block
+const GLuint FRAME_UNIFORMS_BINDING = 0;
+
+// Light clusters: screen tiles across and down, and depth slices. These must match the constants in main.fsh.
+const int LIGHT_CLUSTERS_X = 16;
+const int LIGHT_CLUSTERS_Y = 9;
+const int LIGHT_CLUSTERS_Z = 24;
+
 // ---------------
 // Function declarations
 // ---------------
 
 /**
- * @brief Creates a shader program based on the provided file paths for the vertex and fragment shaders.
- * @param[in] vertexShaderFilePath Vertex shader file path
- * @param[in] fragmentShaderFilePath Fragment shader file path
- * @return OpenGL handle to the created shader program
+ * @brief Creates shader programs from their shader files, loading them from the shader cache where possible.
+ * Every program is compiled and linked before any of them is checked, so the driver can build them in parallel.
+ * Each shader gets its program's defines and the FrameUniforms block inserted after its #version directive.
+ * @param[in,out] cache Shader cache. Programs that had to be compiled are added to it.
+ * @param[in] sources Shader files of each program
+ * @return The created shader programs along with their active uniforms, in the same order as sources
  */
-GLuint CreateShaderProgram(const std::string& vertexShaderFilePath, const std::string& fragmentShaderFilePath);
+std::vector<ShaderProgram> CreateShaderPrograms(ShaderCache& cache, const std::vector<ShaderProgramSource>& sources);
 
 /**
- * @brief Creates a shader based on the provided shader type and the path to the file containing the shader source.
- * @param[in] shaderType Shader type
+ * @brief Enumerates the active uniforms of a linked shader program, so that nothing has to be looked up by name while rendering.
+ * @param[in] program OpenGL handle to the linked program
+ * @return The shader program along with its active uniforms
+ */
+ShaderProgram GetActiveUniforms(GLuint program);
+
+/**
+ * @brief Makes a #define line that selects a shader permutation.
+ * @param[in] name Name of the macro
+ * @param[in] value Value of the macro
+ * @return The #define line
+ */
+std::string ShaderDefine(const std::string& name, int value);
+
+/**
+ * @brief Inserts #define lines into shader source right after its #version directive, which has to stay first.
+ * A #line directive after them keeps the line numbers in compilation errors matching the file.
+ * @param[in,out] shaderSource Shader source string
+ * @param[in] defines #define lines to insert, and any declarations shared between shaders
+ */
+void InsertShaderDefines(std::string& shaderSource, const std::string& defines);
+
+/**
+ * @brief Makes the GLSL declaration of the FrameUniforms block. CreateShaderPrograms inserts it into every shader,
+ * so the layout is only written down here and in the FrameUniforms struct.
+ * @return The block declaration
+ */
+std::string GetFrameUniformsDeclaration();
+
+/**
+ * @brief Reads the shader cache file, if the driver can load program binaries.
+ * @param[in] cacheFilePath Path to the shader cache file
+ * @param[out] cache Shader cache
+ */
+void LoadShaderCache(const std::string& cacheFilePath, ShaderCache& cache);
+
+/**
+ * @brief Writes the shader cache file if it has changed, keeping only the binaries used this run.
+ * @param[in] cache Shader cache
+ * @return True if the file is up to date
+ */
+bool SaveShaderCache(const ShaderCache& cache);
+
+/**
+ * @brief Hashes bytes with 64-bit FNV-1a.
+ * @param[in] data Bytes to hash
+ * @param[in] size Number of bytes
+ * @param[in] hash Hash to continue from, so that several pieces of data can be hashed together
+ * @return Hash of the bytes
+ */
+uint64_t HashFnv1a(const void* data, size_t size, uint64_t hash = FNV1A_OFFSET_BASIS);
+
+/**
+ * @brief Looks up the location of an active uniform and checks that it has the expected type.
+ * @param[in] program Shader program to search
+ * @param[in] name Name of the uniform. Array uniforms are found by their base name.
+ * @param[in] expectedType GLSL type the caller will upload. GL_INT also accepts sampler uniforms.
+ * @return Location of the uniform, or -1 if it is inactive or has a different type
+ */
+GLint FindUniform(const ShaderProgram& program, const std::string& name, GLenum expectedType);
+
+/**
+ * @brief Resolves a typed handle to one of the program's active uniforms.
+ * @param[in] program Shader program to search
+ * @param[in] name Name of the uniform
+ * @return Handle to the uniform
+ */
+template <typename T>
+Uniform<T> GetUniform(const ShaderProgram& program, const std::string& name)
+{
+	Uniform<T> uniform;
+	uniform.location = FindUniform(program, name, UniformTraits<T>::glType);
+	return uniform;
+}
+
+/**
+ * @brief Connects a uniform block of a program to a uniform buffer binding point.
+ * GLSL 3.30 has no layout(binding) qualifier, so this has to be done after linking.
+ * @param[in] program Shader program containing the block
+ * @param[in] blockName Name of the uniform block
+ * @param[in] binding Uniform buffer binding point
+ */
+void BindUniformBlock(const ShaderProgram& program, const std::string& blockName, GLuint binding);
+
+/**
+ * @brief Uploads a value to a uniform of the currently bound program.
+ * @param[in] uniform Handle to the uniform
+ * @param[in] value Value to upload
+ */
+void SetUniform(const Uniform<glm::mat4>& uniform, const glm::mat4& value);
+void SetUniform(const Uniform<glm::vec3>& uniform, const glm::vec3& value);
+void SetUniform(const Uniform<GLfloat>& uniform, GLfloat value);
+void SetUniform(const Uniform<GLint>& uniform, GLint value);
+void SetUniform(const Uniform<bool>& uniform, bool value);
+
+/**
+ * @brief Reads a shader source file.
  * @param[in] shaderFilePath Path to the file containing the shader source
- * @return OpenGL handle to the created shader
+ * @param[out] shaderSource Shader source string
+ * @return True if the file was read
  */
-GLuint CreateShaderFromFile(const GLuint& shaderType, const std::string& shaderFilePath);
+bool ReadShaderFile(const std::string& shaderFilePath, std::string& shaderSource);
 
 /**
  * @brief Creates a shader based on the provided shader type and the string containing the shader source.
+ * The compile status is not checked here, so that several shaders can compile at once. See CheckShaderCompileStatus.
  * @param[in] shaderType Shader type
  * @param[in] shaderSource Shader source string
  * @return OpenGL handle to the created shader
  */
 GLuint CreateShaderFromSource(const GLuint& shaderType, const std::string& shaderSource);
 
+/**
+ * @brief Reports a shader's compilation errors, if it failed to compile.
+ * @param[in] shader OpenGL handle to the shader
+ * @param[in] shaderFilePath Path to the file the shader was compiled from
+ * @return True if the shader compiled
+ */
+bool CheckShaderCompileStatus(GLuint shader, const std::string& shaderFilePath);
+
+/**
+ * @brief Binds a buffer of per-instance transforms to vertex attributes 4 to 10 of a vertex array object.
+ * The model matrix goes to attributes 4 to 7 and the normal matrix to attributes 8 to 10.
+ * @param[in] vao Vertex array object to set up
+ * @param[in] instanceVbo Buffer containing one InstanceData per instance
+ */
+void SetupInstanceAttributes(GLuint vao, GLuint instanceVbo);
+
+/**
+ * @brief Binds the static mesh's index buffer and vertex streams to a vertex array object.
+ * @param[in] vao Vertex array object to set up
+ * @param[in] indexBuffer Index buffer to draw from
+ * @param[in] positionVbo Buffer containing one position per vertex, for attribute 0
+ * @param[in] attributeVbo Buffer containing one PackedVertex per vertex, for attributes 2, 3 and 11. 0 leaves them out, for depth-only passes.
+ */
+void SetupStaticMeshAttributes(GLuint vao, GLuint indexBuffer, GLuint positionVbo, GLuint attributeVbo);
+
 /**
  * @brief Function for handling the event when the size of the framebuffer changed.
  * @param[in] window Reference to the window
@@ -61,1800 +351,5615 @@ void FramebufferSizeChangedCallback(GLFWwindow* window, int width, int height);
 
 
 /**
- * Struct containing data about a vertex
+ * Struct containing data about a vertex, as the static mesh is built. It is split into a position stream
+ * and a PackedVertex stream for the GPU, see PackVertices.
  */
 struct Vertex
 {
 	GLfloat x, y, z;	// Position
-	GLubyte r, g, b;	// Color
 	GLfloat u, v;		// UV coordinates
 	GLfloat nx, ny, nz; // Normal Vertices
+	GLubyte layer;		// Layer of the surface texture array, see SurfaceMaterial
 };
 
-struct Hitbox
+/**
+ * Vertex attributes of the static mesh apart from position, packed into 12 bytes.
+ * Positions are kept in a separate tightly packed stream, so the depth-only passes fetch nothing else.
+ */
+struct PackedVertex
 {
-	glm::vec3 bottomL, bottomR, topL, topR;
-	bool xWall = false;
-	bool zWall = false;
+	GLhalf u, v;		// UV coordinates. The mesh's UVs are whole numbers, which half floats hold exactly.
+	GLuint normal;		// Normal as signed normalized GL_INT_2_10_10_10_REV
+	GLubyte layer;		// Layer of the surface texture array, see SurfaceMaterial
+	GLubyte padding[3];	// Keeps every vertex 4-byte aligned
+};
 
-	void setXWall()
-	{
-		xWall = true;
-		zWall = false;
-	}
-	void setZWall()
-	{
-		zWall = true;
-		xWall = false;
-	}
+/**
+ * Per-instance transforms, read by the vertex shaders as instanced vertex attributes
+ */
+struct InstanceData
+{
+	glm::mat4 modelMatrix;
+	glm::mat3 normalMatrix;	// Inverse transpose of the model matrix's upper 3x3, for transforming normals
+};
+
+/**
+ * @brief Computes the per-instance data for a model matrix, so the shaders don't have to invert it per vertex.
+ * @param[in] modelMatrix Model matrix of the instance
+ * @return Model matrix together with its normal matrix
+ */
+InstanceData MakeInstanceData(const glm::mat4& modelMatrix);
 
-	bool isXWall()
+/**
+ * Direction that the textured side of a wall segment faces
+ */
+enum LevelFacing : uint32_t
+{
+	FACING_POSITIVE_X = 0,
+	FACING_NEGATIVE_X = 1,
+	FACING_POSITIVE_Z = 2,
+	FACING_NEGATIVE_Z = 3
+};
+
+/**
+ * Wall segment as stored in the level file.
+ * The segment spans from (minX, minZ) to (maxX, maxZ) along a single axis and doubles as the wall's hitbox.
+ * Its 1x1 tiles are stored contiguously in the level's tile array, starting at firstTile.
+ */
+struct LevelWall
+{
+	float minX, minZ;
+	float maxX, maxZ;
+	uint32_t facing;
+	uint32_t firstTile;
+	uint32_t tileCount;
+	uint32_t padding;
+
+	bool isXWall() const
 	{
-		return xWall;
+		return facing == FACING_POSITIVE_X || facing == FACING_NEGATIVE_X;
 	}
 
-	bool isZWall()
+	bool isZWall() const
 	{
-		return zWall;
+		return facing == FACING_POSITIVE_Z || facing == FACING_NEGATIVE_Z;
 	}
 };
 
-bool checkCollision(glm::vec3 cameraPosition, std::vector<Hitbox> hitboxes);
-
-Hitbox collidedWall;
-
-glm::mat4 floorTile01 = glm::mat4(1.0f);
-
-glm::mat4 wallTileR01 = glm::mat4(1.0f); glm::mat4 wallTileR02 = glm::mat4(1.0f); glm::mat4 wallTileR03 = glm::mat4(1.0f);
-glm::mat4 wallTileR04 = glm::mat4(1.0f); glm::mat4 wallTileR05 = glm::mat4(1.0f); glm::mat4 wallTileR06 = glm::mat4(1.0f);
-glm::mat4 wallTileR07 = glm::mat4(1.0f); glm::mat4 wallTileR08 = glm::mat4(1.0f); glm::mat4 wallTileR09 = glm::mat4(1.0f);
-glm::mat4 wallTileR10 = glm::mat4(1.0f); glm::mat4 wallTileR11 = glm::mat4(1.0f); glm::mat4 wallTileR12 = glm::mat4(1.0f);
-glm::mat4 wallTileR13 = glm::mat4(1.0f); glm::mat4 wallTileR14 = glm::mat4(1.0f); glm::mat4 wallTileR15 = glm::mat4(1.0f);
-glm::mat4 wallTileR16 = glm::mat4(1.0f); glm::mat4 wallTileR17 = glm::mat4(1.0f); glm::mat4 wallTileR18 = glm::mat4(1.0f);
-glm::mat4 wallTileR19 = glm::mat4(1.0f); glm::mat4 wallTileR20 = glm::mat4(1.0f); glm::mat4 wallTileR21 = glm::mat4(1.0f);
-glm::mat4 wallTileR22 = glm::mat4(1.0f); glm::mat4 wallTileR23 = glm::mat4(1.0f); glm::mat4 wallTileR24 = glm::mat4(1.0f);
-glm::mat4 wallTileR25 = glm::mat4(1.0f); glm::mat4 wallTileR26 = glm::mat4(1.0f); glm::mat4 wallTileR27 = glm::mat4(1.0f);
-glm::mat4 wallTileR28 = glm::mat4(1.0f); glm::mat4 wallTileR29 = glm::mat4(1.0f); glm::mat4 wallTileR30 = glm::mat4(1.0f);
-glm::mat4 wallTileR31 = glm::mat4(1.0f); glm::mat4 wallTileR32 = glm::mat4(1.0f); glm::mat4 wallTileR33 = glm::mat4(1.0f);
-glm::mat4 wallTileR34 = glm::mat4(1.0f); glm::mat4 wallTileR35 = glm::mat4(1.0f); glm::mat4 wallTileR36 = glm::mat4(1.0f);
-glm::mat4 wallTileR37 = glm::mat4(1.0f); glm::mat4 wallTileR38 = glm::mat4(1.0f); glm::mat4 wallTileR39 = glm::mat4(1.0f);
-
-glm::mat4 wallTileL01 = glm::mat4(1.0f); glm::mat4 wallTileL02 = glm::mat4(1.0f); glm::mat4 wallTileL03 = glm::mat4(1.0f); 
-glm::mat4 wallTileL04 = glm::mat4(1.0f); glm::mat4 wallTileL05 = glm::mat4(1.0f); glm::mat4 wallTileL06 = glm::mat4(1.0f); 
-glm::mat4 wallTileL07 = glm::mat4(1.0f); glm::mat4 wallTileL08 = glm::mat4(1.0f); glm::mat4 wallTileL09 = glm::mat4(1.0f); 
-glm::mat4 wallTileL10 = glm::mat4(1.0f); glm::mat4 wallTileL11 = glm::mat4(1.0f); glm::mat4 wallTileL12 = glm::mat4(1.0f); 
-glm::mat4 wallTileL13 = glm::mat4(1.0f); glm::mat4 wallTileL14 = glm::mat4(1.0f); glm::mat4 wallTileL15 = glm::mat4(1.0f); 
-glm::mat4 wallTileL16 = glm::mat4(1.0f); glm::mat4 wallTileL17 = glm::mat4(1.0f); glm::mat4 wallTileL18 = glm::mat4(1.0f); 
-glm::mat4 wallTileL19 = glm::mat4(1.0f); glm::mat4 wallTileL20 = glm::mat4(1.0f); glm::mat4 wallTileL21 = glm::mat4(1.0f); 
-glm::mat4 wallTileL22 = glm::mat4(1.0f); glm::mat4 wallTileL23 = glm::mat4(1.0f); glm::mat4 wallTileL24 = glm::mat4(1.0f); 
-glm::mat4 wallTileL25 = glm::mat4(1.0f); glm::mat4 wallTileL26 = glm::mat4(1.0f); glm::mat4 wallTileL27 = glm::mat4(1.0f); 
-glm::mat4 wallTileL28 = glm::mat4(1.0f); glm::mat4 wallTileL29 = glm::mat4(1.0f); glm::mat4 wallTileL30 = glm::mat4(1.0f); 
-glm::mat4 wallTileL31 = glm::mat4(1.0f); glm::mat4 wallTileL32 = glm::mat4(1.0f); glm::mat4 wallTileL33 = glm::mat4(1.0f); 
-glm::mat4 wallTileL34 = glm::mat4(1.0f); glm::mat4 wallTileL35 = glm::mat4(1.0f); glm::mat4 wallTileL36 = glm::mat4(1.0f); 
-glm::mat4 wallTileL37 = glm::mat4(1.0f); glm::mat4 wallTileL38 = glm::mat4(1.0f); glm::mat4 wallTileL39 = glm::mat4(1.0f); 
-glm::mat4 wallTileL40 = glm::mat4(1.0f); glm::mat4 wallTileL41 = glm::mat4(1.0f); glm::mat4 wallTileL42 = glm::mat4(1.0f);
-glm::mat4 wallTileL43 = glm::mat4(1.0f); glm::mat4 wallTileL44 = glm::mat4(1.0f); glm::mat4 wallTileL45 = glm::mat4(1.0f);
-glm::mat4 wallTileL46 = glm::mat4(1.0f); glm::mat4 wallTileL47 = glm::mat4(1.0f); glm::mat4 wallTileL48 = glm::mat4(1.0f);
-
-glm::mat4 camera;
-glm::mat4 perspective;
+/**
+ * Player spawn point as stored in the level file. The yaw is in degrees.
+ */
+struct LevelSpawn
+{
+	float x, y, z;
+	float yaw;
+};
 
-ISoundEngine* SoundEngine = createIrrKlangDevice();
-ISoundEngine* sfxEngine = createIrrKlangDevice();
-ISound* sfx;
+/**
+ * Local light as stored in the level file. Lights with a spot angle of 0 shine in every direction,
+ * others are spot lights with a cone of that half-angle in degrees around their direction.
+ */
+struct LevelLight
+{
+	float x, y, z;
+	float radius;					// Distance at which the light fades out completely
+	float r, g, b;
+	float flicker;					// 0 for a steady light, up to 1 for one that can dim to nothing
+	float directionX, directionY, directionZ;
+	float spotAngle;
+};
 
-bool lightOn = true;
+/**
+ * Header at the start of a binary level file (.lvl).
+ * Every section offset is in bytes from the start of the file and is 16-byte aligned,
+ * so the sections can be used in place once the file is memory-mapped.
+ */
+struct LevelHeader
+{
+	char magic[4];					// "MAZE"
+	uint32_t version;
+	float floorMinX, floorMinZ;		// Floor extents
+	float floorMaxX, floorMaxZ;
+	float floorHeight;
+	uint32_t spawnCount, spawnOffset;
+	uint32_t wallCount, wallOffset;
+	uint32_t tileCount, tileOffset;	// Tiles are pre-baked glm::mat4 model matrices
+	uint32_t lightCount, lightOffset;
+	uint32_t pvsCellsX, pvsCellsZ;	// Cells of the potentially visible set, or 0 if the level has none. See Pvs.
+	uint32_t pvsCellStartOffset;	// pvsCellsX * pvsCellsZ + 1 entries
+	uint32_t pvsQuadCount, pvsQuadOffset;
+	uint32_t pvsWallQuadCount;		// Number of merged wall quads the set was built for
+	uint32_t padding[3];
+};
 
-void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
+const uint32_t LEVEL_VERSION = 3;
 
 /**
- * @brief Main function
- * @return An integer indicating whether the program ended successfully or not.
- * A value of 0 indicates the program ended succesfully, while a non-zero value indicates
- * something wrong happened during execution.
+ * A level loaded from a memory-mapped level file. The arrays point directly into the mapping.
  */
-int main()
+struct Level
 {
-	// Initialize GLFW
-	int glfwInitStatus = glfwInit();
-	if (glfwInitStatus == GLFW_FALSE)
-	{
-		std::cerr << "Failed to initialize GLFW!" << std::endl;
-		return 1;
-	}
+	const LevelHeader* header = nullptr;
+	const LevelSpawn* spawns = nullptr;
+	const LevelWall* walls = nullptr;
+	const glm::mat4* tileTransforms = nullptr;
+	const LevelLight* lights = nullptr;
+	const uint32_t* pvsCellStarts = nullptr;
+	const uint32_t* pvsQuads = nullptr;
+
+	const void* mappedData = nullptr;
+	size_t mappedSize = 0;
+#ifdef _WIN32
+	HANDLE fileHandle = INVALID_HANDLE_VALUE;
+	HANDLE mappingHandle = nullptr;
+#endif
+};
 
-	// Tell GLFW that we prefer to use OpenGL 3.3
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+/**
+ * @brief Converts a text level description into the binary level format.
+ * The potentially visible set of the wall quads is worked out here too, so the game doesn't have to build it on every launch.
+ * @param[in] sourceFilePath Path to the text level description
+ * @param[in] levelFilePath Path where the binary level file will be written
+ * @return True if the level was baked successfully
+ */
+bool BakeLevel(const std::string& sourceFilePath, const std::string& levelFilePath);
 
-	// Tell GLFW that we prefer to use the modern OpenGL
-	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GLFW_TRUE);
-	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+/**
+ * @brief Memory-maps a binary level file and points the level's arrays into the mapping.
+ * @param[in] levelFilePath Path to the binary level file
+ * @param[out] level Level that will reference the mapped data
+ * @return True if the level was loaded and passed validation
+ */
+bool LoadLevel(const std::string& levelFilePath, Level& level);
 
-	// Tell GLFW to create a window
-	int windowWidth = 800;
-	int windowHeight = 800;
-	int shadowMapHeight = 2048 * 8;
-	int shadowMapWidth = 2048 * 8;
-	GLFWwindow* window = glfwCreateWindow(windowWidth, windowHeight, "Final Project - Horror game", nullptr, nullptr);
-	if (window == nullptr)
-	{
-		std::cerr << "Failed to create GLFW window!" << std::endl;
-		glfwTerminate();
-		return 1;
-	}
+/**
+ * @brief Unmaps a level that was loaded with LoadLevel.
+ * @param[in,out] level Level to unload
+ */
+void UnloadLevel(Level& level);
 
-	// Tell GLFW to use the OpenGL context that was assigned to the window that we just created
-	glfwMakeContextCurrent(window);
+/**
+ * Header of a KTX 1.1 texture file (.ktx), following the 12-byte file identifier.
+ * The key/value data comes next, then each mip level as a 32-bit image size followed by its data.
+ * Uncompressed rows are padded to 4 bytes.
+ */
+struct KtxHeader
+{
+	uint32_t endianness;			// 0x04030201 when the file matches the reader's byte order
+	uint32_t glType;				// 0 for compressed textures
+	uint32_t glTypeSize;
+	uint32_t glFormat;				// 0 for compressed textures
+	uint32_t glInternalFormat;
+	uint32_t glBaseInternalFormat;
+	uint32_t pixelWidth, pixelHeight, pixelDepth;
+	uint32_t numberOfArrayElements;
+	uint32_t numberOfFaces;
+	uint32_t numberOfMipmapLevels;
+	uint32_t bytesOfKeyValueData;
+};
 
-	// Register the callback function that handles when the framebuffer size has changed
-	glfwSetFramebufferSizeCallback(window, FramebufferSizeChangedCallback);
+const unsigned char KTX_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
 
-	// Tell GLAD to load the OpenGL function pointers
-	if (!gladLoadGLLoader(reinterpret_cast<GLADloadproc>(glfwGetProcAddress)))
-	{
-		std::cerr << "Failed to initialize GLAD!" << std::endl;
-		return 1;
-	}
+// Bump this whenever the way cached textures are made changes, so old cache files are rebuilt
+const uint32_t TEXTURE_CACHE_VERSION = 1;
 
-	// --- Vertex specification ---
+/**
+ * Texture image in client memory, with a full mip chain
+ */
+struct TextureImage
+{
+	GLsizei width = 0, height = 0;
+	GLenum format = GL_RGB;				// GL_RGB or GL_RGBA. Rows are padded to 4 bytes, as in a KTX file.
+	GLenum compressedFormat = 0;		// Block-compressed format of the data, or 0 if it is uncompressed
+	std::vector<char> data;
+	std::vector<size_t> levelOffsets;	// Where each mip level starts in data
+	std::vector<size_t> levelSizes;
+};
 
-	Vertex plane[6];
-	//Plane face
-	plane[0] = { -0.5f, 0.f, 0.5f,		255,  255,  255,    0.0f, 1.0f,    0.0f, 1.0f, 0.0f };	// Lower-left
-	plane[1] = { 0.5f, 0.f, 0.5f,		255,  255,  255,    0.0f, 0.0f,    0.0f, 1.0f, 0.0f };	// Lower-right
-	plane[2] = { 0.5f, 0.f, -0.5f,		255,  255,  255,    1.0f, 0.0f,    0.0f, 1.0f, 0.0f };	// Upper-right
+/**
+ * @brief Gets the size in bytes of one mip level of a texture image.
+ * @param[in] image Texture image whose format is used
+ * @param[in] level Mip level
+ * @return Size of the level, with rows padded to 4 bytes if it is uncompressed
+ */
+size_t GetTextureLevelSize(const TextureImage& image, int level);
 
-	plane[3] = { 0.5f, 0.f, -0.5f,		255,  255,  255,    1.0f, 0.0f,    0.0f, 1.0f, 0.0f };	// Upper-right
-	plane[4] = { -0.5f, 0.f, -0.5f,	    255,  255,  255,    1.0f, 1.0f,    0.0f, 1.0f, 0.0f };	// Upper-left
-	plane[5] = { -0.5f, 0.f, 0.5f,		255,  255,  255,    0.0f, 1.0f,    0.0f, 1.0f, 0.0f };	// Lower-left
+/**
+ * @brief Decodes an image and builds its mip chain.
+ * The image is flipped vertically to match OpenGL's texture coordinates, and each mip level is downsampled
+ * from the one above it with a Kaiser-windowed sinc filter in linear light.
+ * @param[in] fileData Contents of the image file
+ * @param[in] repeat True if the texture repeats, so the filter wraps around the edges instead of clamping to them
+ * @param[out] image Uncompressed texture image
+ * @return True if the image was decoded
+ */
+bool DecodeTextureImage(const std::vector<char>& fileData, bool repeat, TextureImage& image);
 
-	Vertex floor[6];
-	floor[0] = { -0.5f, 0.f, 0.5f,		255,  255,  255,    0.0f, 10.0f,    0.0f, 1.0f, 0.0f };	// Lower-left
-	floor[1] = { 0.5f, 0.f, 0.5f,		255,  255,  255,    0.0f, 0.0f,    0.0f, 1.0f, 0.0f };	// Lower-right
-	floor[2] = { 0.5f, 0.f, -0.5f,		255,  255,  255,    10.0f, 0.0f,    0.0f, 1.0f, 0.0f };	// Upper-right
+/**
+ * @brief Compresses an uncompressed RGB texture image to BC1 (DXT1), eight times smaller than RGBA8 in video memory.
+ * Images with an alpha channel are left uncompressed.
+ * @param[in,out] image Texture image to compress
+ */
+void CompressTextureImage(TextureImage& image);
 
-	floor[3] = { 0.5f, 0.f, -0.5f,		255,  255,  255,    10.0f, 0.0f,    0.0f, 1.0f, 0.0f };	// Upper-right
-	floor[4] = { -0.5f, 0.f, -0.5f,	    255,  255,  255,    10.0f, 10.0f,    0.0f, 1.0f, 0.0f };	// Upper-left
-	floor[5] = { -0.5f, 0.f, 0.5f,		255,  255,  255,    0.0f, 10.0f,    0.0f, 1.0f, 0.0f };	// Lower-left
+/**
+ * @brief Writes a texture image to a KTX file.
+ * @param[in] textureFilePath Path where the KTX file will be written
+ * @param[in] image Texture image to write
+ * @param[in] cacheKey Key of the source the image was made from, stored in the file's key/value data
+ * @return True if the file was written
+ */
+bool WriteKtxTexture(const std::string& textureFilePath, const TextureImage& image, uint64_t cacheKey);
 
+/**
+ * @brief Reads a texture image from a KTX file written by WriteKtxTexture.
+ * @param[in] textureFilePath Path to the KTX file
+ * @param[out] image Texture image
+ * @param[out] cacheKey Key of the source the image was made from, or 0 if the file has none
+ * @return True if the file was read and passed validation
+ */
+bool ReadKtxTexture(const std::string& textureFilePath, TextureImage& image, uint64_t& cacheKey);
 
-	Vertex skybox[36];
-	skybox[0] = { -1.0f,  1.0f, -1.0f };
-	skybox[1] = { -1.0f, -1.0f, -1.0f };
-	skybox[2] = { 1.0f, -1.0f, -1.0f };
-	skybox[3] = { 1.0f, -1.0f, -1.0f };
-	skybox[4] = { 1.0f,  1.0f, -1.0f };
-	skybox[5] = { -1.0f,  1.0f, -1.0f };
+/**
+ * @brief Computes the texture cache key of an image file, from its contents and how it is filtered.
+ * @param[in] fileData Contents of the image file
+ * @param[in] repeat Whether the texture repeats
+ * @return 64-bit FNV-1a hash
+ */
+uint64_t GetTextureCacheKey(const std::vector<char>& fileData, bool repeat);
 
-	skybox[6] = { -1.0f, -1.0f,  1.0f };
-	skybox[7] = { -1.0f, -1.0f, -1.0f };
-	skybox[8] = { -1.0f,  1.0f, -1.0f };
-	skybox[9] = { -1.0f,  1.0f, -1.0f };
-	skybox[10] = { -1.0f,  1.0f,  1.0f };
-	skybox[11] = { -1.0f, -1.0f,  1.0f };
+/**
+ * @brief Gets the path of the texture cache file for an image: the image's path with a .ktx extension.
+ * @param[in] imageFilePath Path to the image
+ * @return Path to the cache file
+ */
+std::string GetTextureCachePath(const std::string& imageFilePath);
 
-	skybox[12] = { 1.0f, -1.0f, -1.0f };
-	skybox[13] = { 1.0f, -1.0f,  1.0f };
-	skybox[14] = { 1.0f,  1.0f,  1.0f };
-	skybox[15] = { 1.0f,  1.0f,  1.0f };
-	skybox[16] = { 1.0f,  1.0f, -1.0f };
-	skybox[17] = { 1.0f, -1.0f, -1.0f };
+/**
+ * @brief Loads an image as a mipmapped texture image through the texture cache.
+ * The cache file next to the image is used if it was made from the image as it is now. Otherwise the image is
+ * decoded and mipmapped, compressed if allowed, and written back to the cache for next time.
+ * @param[in] imageFilePath Path to the image
+ * @param[in] repeat Whether the texture repeats, see DecodeTextureImage
+ * @param[in] compress Whether the image may be block-compressed. Pass false if the driver can't sample BC1 textures.
+ * @param[out] image Texture image
+ * @return True if the image or its cache file was loaded
+ */
+bool LoadTextureImage(const std::string& imageFilePath, bool repeat, bool compress, TextureImage& image);
 
-	skybox[18] = { -1.0f, -1.0f,  1.0f };
-	skybox[19] = { -1.0f,  1.0f,  1.0f };
-	skybox[20] = { 1.0f,  1.0f,  1.0f };
-	skybox[21] = { 1.0f,  1.0f,  1.0f };
-	skybox[22] = { 1.0f, -1.0f,  1.0f };
-	skybox[23] = { -1.0f, -1.0f,  1.0f };
+/**
+ * @brief Converts images into texture cache files ahead of time, so the first launch doesn't have to.
+ * @param[in] imageFilePaths Paths to the images
+ * @param[in] repeat Whether the textures repeat, see DecodeTextureImage
+ * @return True if every image was baked
+ */
+bool BakeTextures(const std::vector<std::string>& imageFilePaths, bool repeat);
 
-	skybox[24] = { -1.0f,  1.0f, -1.0f };
-	skybox[25] = { 1.0f,  1.0f, -1.0f };
-	skybox[26] = { 1.0f,  1.0f,  1.0f };
-	skybox[27] = { 1.0f,  1.0f,  1.0f };
-	skybox[28] = { -1.0f,  1.0f,  1.0f };
-	skybox[29] = { -1.0f,  1.0f, -1.0f };
+/**
+ * Image file for the texture loader to load
+ */
+struct TextureLoadRequest
+{
+	std::string imageFilePath;
+	bool repeat = false;				// See DecodeTextureImage
+	TextureImage image;
+	bool loaded = false;				// Whether image holds the loaded image. Only valid once done is set.
+	std::atomic<bool> done{ false };
+};
 
-	skybox[30] = { -1.0f, -1.0f, -1.0f };
-	skybox[31] = { -1.0f, -1.0f,  1.0f };
-	skybox[32] = { 1.0f, -1.0f, -1.0f };
-	skybox[33] = { 1.0f, -1.0f, -1.0f };
-	skybox[34] = { -1.0f, -1.0f,  1.0f };
-	skybox[35] = { 1.0f, -1.0f,  1.0f };
+/**
+ * Loads images on a pool of worker threads, so textures can be created before their images are decoded
+ */
+struct TextureLoader
+{
+	bool compress = false;									// Whether images may be block-compressed, see LoadTextureImage
+	std::vector<std::unique_ptr<TextureLoadRequest>> requests;	// Fixed once the loader is started
+	std::atomic<size_t> nextRequest{ 0 };					// Next request for a worker to take
+	std::vector<std::thread> workers;
+};
 
+/**
+ * Texture that is drawn with a placeholder until all of its images are loaded
+ */
+struct PendingTexture
+{
+	GLuint texture;
+	GLenum target;						// GL_TEXTURE_2D_ARRAY or GL_TEXTURE_CUBE_MAP
+	std::vector<size_t> requests;		// Texture loader request for each layer or face
+	int anisotropy;						// See UploadTexture
+};
 
-	// Create a vertex buffer object (VBO), and upload our vertices data to the VBO
+/**
+ * @brief Adds an image to a texture loader that hasn't been started yet. An image that is requested more than once is only loaded once.
+ * @param[in,out] loader Texture loader
+ * @param[in] imageFilePath Path to the image
+ * @param[in] repeat Whether the texture repeats, see DecodeTextureImage
+ * @return Index of the request
+ */
+size_t RequestTextureImage(TextureLoader& loader, const std::string& imageFilePath, bool repeat);
 
-	GLuint planeVbo;
-	glGenBuffers(1, &planeVbo);
-	glBindBuffer(GL_ARRAY_BUFFER, planeVbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(plane), plane, GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+/**
+ * @brief Starts loading a texture loader's images, with one worker thread per hardware thread up to the number of images.
+ * @param[in,out] loader Texture loader
+ */
+void StartTextureLoader(TextureLoader& loader);
 
-	GLuint floorVbo;
-	glGenBuffers(1, &floorVbo);
-	glBindBuffer(GL_ARRAY_BUFFER, floorVbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(floor), floor, GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	
-	GLuint skyboxVbo;
-	glGenBuffers(1, &skyboxVbo);
-	glBindBuffer(GL_ARRAY_BUFFER, skyboxVbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(skybox), skybox, GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+/**
+ * @brief Waits for a texture loader's workers to finish the images they are loading, abandons the rest, and frees them all.
+ * @param[in,out] loader Texture loader
+ */
+void StopTextureLoader(TextureLoader& loader);
 
-	// Create a vertex array object that contains data on how to map vertex attributes
-	// (e.g., position, color) to vertex shader properties.
+/**
+ * @brief Creates a texture array or cube map whose layers or faces are a single texel of one colour.
+ * @param[in] target GL_TEXTURE_2D_ARRAY or GL_TEXTURE_CUBE_MAP
+ * @param[in] layerCount Number of layers in a texture array. Cube maps always have 6 faces.
+ * @param[in] color RGB colour of the placeholder
+ * @return Name of the texture
+ */
+GLuint CreatePlaceholderTexture(GLenum target, GLsizei layerCount, const GLubyte color[3]);
 
-	// plane
-	GLuint planeVao;
-	glGenVertexArrays(1, &planeVao);
-	glBindVertexArray(planeVao);
-	glBindBuffer(GL_ARRAY_BUFFER, planeVbo);
+/**
+ * @brief Replaces the layers of a texture array or the faces of a cube map with mipmapped images, streamed through a pixel buffer object.
+ * Texture arrays repeat and are filtered anisotropically, and cube maps are clamped at the edges.
+ * @param[in] texture Name of the texture
+ * @param[in] target GL_TEXTURE_2D_ARRAY or GL_TEXTURE_CUBE_MAP
+ * @param[in] images Image for each layer, or for the +X, -X, +Y, -Y, +Z and -Z faces. They must all be the same size and format.
+ * @param[in] anisotropy Maximum anisotropic filtering ratio. It is clamped to what the driver supports, and 1 disables it.
+ * @param[in] pixelBuffer Pixel buffer object to stream the images through. It is reallocated to fit them.
+ * @return True if the images were uploaded
+ */
+bool UploadTexture(GLuint texture, GLenum target, const std::vector<const TextureImage*>& images, int anisotropy, GLuint pixelBuffer);
 
-	// Vertex attribute 0 - Position
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+/**
+ * @brief Uploads a pending texture if all of its images have been loaded.
+ * @param[in] loader Texture loader the images were requested from
+ * @param[in] pending Pending texture
+ * @param[in] pixelBuffer Pixel buffer object to stream the images through
+ * @return True if the texture is no longer pending. If any of its images failed to load, it keeps its placeholder.
+ */
+bool UpdatePendingTexture(const TextureLoader& loader, const PendingTexture& pending, GLuint pixelBuffer);
 
-	// Vertex attribute 1 - Color
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 3, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), (void*)(sizeof(GLfloat) * 3));
+/**
+ * Layers of the surface texture array. Every vertex of the static mesh picks its texture by layer,
+ * so the floor and walls share one texture binding and one draw call.
+ */
+enum SurfaceMaterial : GLubyte
+{
+	MATERIAL_BRICK_WALL = 0,
+	MATERIAL_BROWN_TILE = 1,
+	MATERIAL_COUNT
+};
 
-	// Vertex attribute 2 - UV coordinate
-	glEnableVertexAttribArray(2);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(offsetof(Vertex, u)));
+/**
+ * @brief Merges the level's wall tiles into a single pre-transformed, indexed mesh.
+ * Adjacent tiles that lie on the same plane with the same orientation are greedily combined into larger quads,
+ * with UVs that keep the texture repeating once per tile.
+ * @param[in] level Level whose wall tiles will be merged
+ * @param[out] vertices World-space vertices of the merged quads, four per quad
+ * @param[out] indices Triangle indices into vertices, six per quad
+ */
+void BuildWallMesh(const Level& level, std::vector<Vertex>& vertices, std::vector<GLuint>& indices);
 
-	// Vertex attribute 3 - Normal coordinates
-	glEnableVertexAttribArray(3);
-	glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(offsetof(Vertex, nx)));
-	
-	glBindVertexArray(0);
+/**
+ * @brief Adds the level's floor to a mesh as a single world-space quad, so it can be drawn together with the walls.
+ * @param[in] level Level whose floor will be added
+ * @param[in,out] vertices Vertices of the mesh. Four are added.
+ * @param[in,out] indices Triangle indices into vertices. Six are added.
+ */
+void AppendFloorQuad(const Level& level, std::vector<Vertex>& vertices, std::vector<GLuint>& indices);
 
-	// floor
-	GLuint floorVao;
-	glGenVertexArrays(1, &floorVao);
-	glBindVertexArray(floorVao);
-	glBindBuffer(GL_ARRAY_BUFFER, floorVbo);
+/**
+ * @brief Converts mesh vertices into the streams the GPU reads: positions, and the packed remaining attributes.
+ * @param[in] vertices Vertices of the mesh
+ * @param[out] positions Position of each vertex
+ * @param[out] packedVertices Packed UVs, normal and texture layer of each vertex
+ */
+void PackVertices(const std::vector<Vertex>& vertices, std::vector<glm::vec3>& positions, std::vector<PackedVertex>& packedVertices);
 
-	// Vertex attribute 0 - Position
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+/**
+ * Wall quads that are close together, tested for occlusion as one bounding box
+ */
+struct WallCluster
+{
+	GLuint firstQuad = 0;	// The cluster's quads are contiguous in the wall mesh
+	GLuint quadCount = 0;
+	glm::vec3 min, max;		// World-space bounding box, padded so it is never hidden by the cluster's own walls
+};
 
-	// Vertex attribute 1 - Color
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 3, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), (void*)(sizeof(GLfloat) * 3));
+// Width of a wall cluster along X and Z in world units. BakeLevel and the game must group the quads the same way.
+const float WALL_CLUSTER_SIZE = 3.0f;
 
-	// Vertex attribute 2 - UV coordinate
-	glEnableVertexAttribArray(2);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(offsetof(Vertex, u)));
+/**
+ * @brief Sorts the quads of a mesh built by BuildWallMesh into clusters on a square grid.
+ * Vertices are reordered so each cluster's quads are contiguous, and the indices are rebuilt to match.
+ * @param[in,out] vertices Vertices of the mesh, four per quad
+ * @param[in,out] indices Triangle indices into vertices, six per quad
+ * @param[in] clusterSize Width of a cluster along X and Z in world units
+ * @param[out] clusters Clusters in the order their quads appear in the mesh
+ */
+void BuildWallClusters(std::vector<Vertex>& vertices, std::vector<GLuint>& indices, float clusterSize, std::vector<WallCluster>& clusters);
 
-	// Vertex attribute 3 - Normal coordinates
-	glEnableVertexAttribArray(3);
-	glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(offsetof(Vertex, nx)));
+/**
+ * World-space bounding boxes of the merged wall quads.
+ * Each coordinate is stored in its own array, so four boxes can be loaded into SIMD registers at once.
+ */
+struct WallBounds
+{
+	std::vector<float> minX, minY, minZ;
+	std::vector<float> maxX, maxY, maxZ;
+	size_t count = 0;
+};
 
-	glBindVertexArray(0);
+/**
+ * Ranges of the wall index buffer to draw with glMultiDrawElements
+ */
+struct DrawList
+{
+	std::vector<GLsizei> counts;
+	std::vector<const void*> offsets;
+};
 
-	// Skybox
-	GLuint skyboxVao;
-	glGenVertexArrays(1, &skyboxVao);
-	glBindVertexArray(skyboxVao);
-	glBindBuffer(GL_ARRAY_BUFFER, skyboxVbo);
+/**
+ * @brief Computes the bounding box of every quad in a mesh built by BuildWallMesh.
+ * @param[in] vertices Vertices of the mesh, four per quad
+ * @param[out] bounds Bounding boxes of the quads
+ */
+void BuildWallBounds(const std::vector<Vertex>& vertices, WallBounds& bounds);
 
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-	glBindVertexArray(0);
+/**
+ * @brief Extracts the six clipping planes of a view-projection matrix.
+ * A point p is inside the frustum if dot(plane.xyz, p) + plane.w >= 0 for every plane.
+ * @param[in] viewProjection Combined projection and view matrix
+ * @param[out] planes Left, right, bottom, top, near and far planes
+ */
+void ExtractFrustumPlanes(const glm::mat4& viewProjection, glm::vec4* planes);
 
-	// FRAMEBUFFERS
-	//
-	//
-	GLuint fbo;
-	glGenFramebuffers(1, &fbo);
+/**
+ * @brief Checks whether a box intersects the view frustum. Like CullWallQuads, it may let through boxes near the frustum's corners.
+ * @param[in] boxMin Minimum corner of the box
+ * @param[in] boxMax Maximum corner of the box
+ * @param[in] planes The six frustum planes from ExtractFrustumPlanes
+ * @return True if the box is at least partly inside the frustum
+ */
+bool IsBoxInFrustum(const glm::vec3& boxMin, const glm::vec3& boxMax, const glm::vec4* planes);
 
-	GLuint fboTex;
-	glGenTextures(1, &fboTex);
-	glBindTexture(GL_TEXTURE_2D, fboTex);
+/**
+ * @brief Finds the wall quads whose bounding boxes intersect the view frustum.
+ * @param[in] bounds Bounding boxes of the wall quads
+ * @param[in] planes The six frustum planes from ExtractFrustumPlanes
+ * @param[in] candidates Indices of the quads to test, in increasing order
+ * @param[in] candidateCount Number of quads to test
+ * @param[out] drawList Index ranges of the visible quads, with neighbouring quads merged into one range
+ * @return Number of visible quads
+ */
+size_t CullWallQuads(const WallBounds& bounds, const glm::vec4* planes, const GLuint* candidates, size_t candidateCount, DrawList& drawList);
 
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, shadowMapHeight, shadowMapWidth, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glBindTexture(GL_TEXTURE_2D, 0);
-	
-	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, fboTex, 0);
-	glDrawBuffer(GL_NONE);
-	glReadBuffer(GL_NONE);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+/**
+ * @brief Splits a draw list into one draw list per wall cluster.
+ * @param[in] drawList Index ranges of the quads to draw
+ * @param[in] clusters Clusters from BuildWallClusters
+ * @param[out] clusterDrawLists Index ranges of the quads to draw in each cluster
+ */
+void SplitDrawList(const DrawList& drawList, const std::vector<WallCluster>& clusters, std::vector<DrawList>& clusterDrawLists);
 
-	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)\
-	{
-		std::cout << "Error! Framebuffer not complete!" << std::endl;
-	}
+/**
+ * @brief Draws the static mesh: the ranges outside any cluster, and the given wall ranges of each cluster,
+ * letting the GPU skip clusters that last frame's occlusion queries found hidden.
+ * Clusters without a query go out in the same draw call as the ranges outside any cluster.
+ * The static mesh's vertex array object has to be bound already.
+ * @param[in] unclusteredRanges Index ranges that belong to no cluster and are always drawn, such as the floor
+ * @param[in] clusterDrawLists Index ranges to draw in each cluster
+ * @param[in] queries Occlusion queries issued last frame, one per cluster
+ * @param[in] queryIssued Whether each of those queries was issued. Clusters without one are always drawn.
+ * @param[in,out] batch Scratch draw list for the ranges drawn together, kept between calls so it isn't reallocated
+ */
+void DrawStaticMesh(const DrawList& unclusteredRanges, const std::vector<DrawList>& clusterDrawLists, const GLuint* queries, const char* queryIssued, DrawList& batch);
 
-	// Create a shader program
-	GLuint program = CreateShaderProgram("main.vsh", "main.fsh");
+/**
+ * Potentially visible set of a grid-aligned level.
+ * The floor is divided into 1x1 cells, and each cell lists the wall quads found to be visible from inside it.
+ * The lists are sampled rather than exact, see BuildPvs. BakeLevel builds the set and stores it in the level file.
+ */
+struct Pvs
+{
+	int cellsX = 0, cellsZ = 0;
+	float originX = 0.0f, originZ = 0.0f;	// World-space corner of cell (0, 0)
+	std::vector<GLuint> cellStarts;			// Cell c lists quads[cellStarts[c]] up to quads[cellStarts[c + 1]]
+	std::vector<GLuint> quads;				// Quad indices in increasing order within each cell
+};
 
-	GLuint depthshaders = CreateShaderProgram("depthShader.vsh", "depthShader.fsh");
+/**
+ * @brief Builds the potentially visible set of a level by casting rays across the grid from sample points in each cell.
+ * Walls are assumed to be taller than the camera, so visibility is worked out from above.
+ * Rays only go to the corners of cells that earlier rays reached, so the cost grows with how much can be seen rather than with the whole grid.
+ * The result is approximate: each cell only sees from a 9x9 grid of spots, widened by what its open neighbours see,
+ * so a quad that is only visible through a sliver between the spots can be missing and pop in as the camera moves.
+ * @param[in] level Level whose floor defines the grid
+ * @param[in] bounds Bounding boxes of the merged wall quads
+ * @param[out] pvs Potentially visible set
+ * @return True if the level is aligned to the grid and the set was built
+ */
+bool BuildPvs(const Level& level, const WallBounds& bounds, Pvs& pvs);
 
-	GLuint skyboxshaders = CreateShaderProgram("skyboxShader.vsh", "skyboxShader.fsh");
+/**
+ * @brief Copies the potentially visible set out of a level file.
+ * @param[in] level Level that was loaded with LoadLevel
+ * @param[in] wallQuadCount Number of merged wall quads in the game's wall mesh
+ * @param[out] pvs Potentially visible set
+ * @return True if the level has a set, and it was built for the same wall quads
+ */
+bool LoadPvs(const Level& level, size_t wallQuadCount, Pvs& pvs);
 
-	// Tell OpenGL the dimensions of the region where stuff will be drawn.
-	// For now, tell OpenGL to use the whole screen
-	glViewport(0, 0, windowWidth, windowHeight);
+/**
+ * @brief Walks a ray through the grid and finds the first wall it runs into.
+ * @param[in] edgeQuadsX Wall quad on each cell edge crossed when moving along X, or -1, indexed by line * cellsZ + row
+ * @param[in] edgeQuadsZ Wall quad on each cell edge crossed when moving along Z, or -1, indexed by line * cellsX + column
+ * @param[in] cellsX Number of cells along X
+ * @param[in] cellsZ Number of cells along Z
+ * @param[in] from Start of the ray in grid coordinates, inside the grid
+ * @param[in] direction Direction of the ray
+ * @param[out] crossedCells Receives the index of every cell the ray enters after the one it starts in
+ * @return Index of the wall quad the ray hits, or -1 if it leaves the grid first
+ */
+int TraceWallRay(const std::vector<int>& edgeQuadsX, const std::vector<int>& edgeQuadsZ, int cellsX, int cellsZ, glm::vec2 from, glm::vec2 direction,
+	std::vector<int>& crossedCells);
 
+/**
+ * Bounding box of a wall quad as cullingShader.csh reads it. The vec3s are padded to 16 bytes in std430,
+ * so the cluster and the padding fill the gaps.
+ */
+struct GpuWallQuad
+{
+	glm::vec3 boundsMin;
+	GLuint cluster;			// Wall cluster the quad belongs to
+	glm::vec3 boundsMax;
+	GLuint padding;
+};
 
-	// Create a variable that will contain the ID for our texture,
-	// and use glGenTextures() to generate the texture itself
-	GLuint wallTex;
-	glGenTextures(1, &wallTex);
+/**
+ * Parameters of an indirect indexed draw, as glDrawElementsIndirect reads them
+ */
+struct DrawElementsIndirectCommand
+{
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
 
-	// --- Load our image using stb_image ---
+/**
+ * Buffers and program for culling the wall quads in a compute shader, on OpenGL 4.3 and up.
+ * Each visible quad's indices are appended to its cluster's part of indexBuffer, and counted in the cluster's draw command,
+ * so the CPU never looks at individual quads. The floor's indices follow the walls' in indexBuffer, as in the static index buffer.
+ */
+struct GpuWallCulling
+{
+	bool enabled = false;
+	ShaderProgram program;
+	Uniform<GLint> firstCandidateUniform;
+	Uniform<GLint> candidateCountUniform;
+	GLuint quadBuffer = 0;			// One GpuWallQuad per wall quad
+	GLuint candidateBuffer = 0;		// Each PVS cell's quads, followed by every quad for when the camera isn't in a cell
+	GLint allQuadsOffset = 0;		// Position of the list of every quad in candidateBuffer
+	GLuint commandBuffer = 0;		// One DrawElementsIndirectCommand per cluster
+	GLuint commandResetBuffer = 0;	// Commands with no quads, copied over commandBuffer before each culling pass
+	GLuint indexBuffer = 0;			// Indices of the visible wall quads, then the floor's
+	GLuint vao = 0;					// The static mesh's vertex array objects, drawing from indexBuffer
+	GLuint depthVao = 0;
+	size_t clusterCount = 0;
+};
 
-	// Im image-space (pixels), (0, 0) is the upper-left corner of the image
-	// However, in u-v coordinates, (0, 0) is the lower-left corner of the image
-	// This means that the image will appear upside-down when we use the image data as is
-	// This function tells stbi to flip the image vertically so that it is not upside-down when we use it
-	stbi_set_flip_vertically_on_load(true);
+/**
+ * @brief Uploads the wall quads' bounds, the candidate lists and the initial draw commands for culling on the GPU.
+ * The compute program is created along with the others, and has to be set in culling.program afterwards.
+ * @param[in] bounds Bounding boxes of the wall quads
+ * @param[in] clusters Clusters from BuildWallClusters
+ * @param[in] pvs Potentially visible set, or an empty one if the level has none
+ * @param[in] staticIndices Indices of the static mesh, which the visible wall indices replace and the floor's are kept from
+ * @param[out] culling Buffers for culling on the GPU
+ */
+void CreateGpuWallCulling(const WallBounds& bounds, const std::vector<WallCluster>& clusters, const Pvs& pvs, const std::vector<GLuint>& staticIndices, GpuWallCulling& culling);
 
-	// 'imageWidth' and imageHeight will contain the width and height of the loaded image respectively
-	int imageWidth, imageHeight, numChannels;
+/**
+ * @brief Culls wall quads against the view frustum in FrameUniforms, filling in culling.commandBuffer and culling.indexBuffer.
+ * The frame uniforms have to be bound already.
+ * @param[in] culling Buffers and program for culling on the GPU
+ * @param[in] firstCandidate Position of the first quad to test in culling.candidateBuffer
+ * @param[in] candidateCount Number of quads to test
+ */
+void DispatchGpuWallCulling(const GpuWallCulling& culling, GLint firstCandidate, GLint candidateCount);
 
-	// Read the image data and store it in an unsigned char array
-	unsigned char* imageData = stbi_load("BrickWallTex.jpg", &imageWidth, &imageHeight, &numChannels, 0);
+/**
+ * @brief Draws the static mesh with the wall quads that DispatchGpuWallCulling found visible, letting the GPU skip
+ * clusters that last frame's occlusion queries found hidden. Runs of clusters without a query go out in one draw call.
+ * A vertex array object that reads culling.indexBuffer has to be bound already.
+ * @param[in] culling Buffers for culling on the GPU
+ * @param[in] unclusteredRanges Index ranges that belong to no cluster and are always drawn, such as the floor
+ * @param[in] queries Occlusion queries issued last frame, one per cluster
+ * @param[in] queryIssued Whether each of those queries was issued. Clusters without one are always drawn.
+ */
+void DrawGpuCulledStaticMesh(const GpuWallCulling& culling, const DrawList& unclusteredRanges, const GLuint* queries, const char* queryIssued);
 
-	// Make sure that we actually loaded the image before uploading the data to the GPU
-	if (imageData != nullptr)
-	{
-		// Our texture is 2D, so we bind our texture to the GL_TEXTURE_2D target
-		glBindTexture(GL_TEXTURE_2D, wallTex);
+/**
+ * @brief Deletes the program, buffers and vertex array objects used for culling on the GPU.
+ * @param[in,out] culling Buffers for culling on the GPU
+ */
+void DeleteGpuWallCulling(GpuWallCulling& culling);
 
-		// Set the filtering methods for magnification and minification
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+/**
+ * View-space bounding boxes of the light clusters. The view is split into LIGHT_CLUSTERS_X by LIGHT_CLUSTERS_Y
+ * screen tiles, and LIGHT_CLUSTERS_Z depth slices that get exponentially thicker away from the camera.
+ */
+struct LightClusterGrid
+{
+	glm::mat4 perspective = glm::mat4(0.0f);	// Projection the grid was built for
+	float nearPlane = 0.0f, farPlane = 0.0f;
+	std::vector<glm::vec3> min, max;			// Indexed by (slice * LIGHT_CLUSTERS_Y + tileY) * LIGHT_CLUSTERS_X + tileX
+};
 
-		// Set the wrapping method for the s-axis (x-axis) and t-axis (y-axis)
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+/**
+ * Lights of one frame, laid out for the buffer textures that main.fsh reads
+ */
+struct LightClusters
+{
+	std::vector<glm::vec4> lightData;		// Three texels per light: position and radius, colour and outer spot cosine, direction and inner spot cosine
+	std::vector<GLuint> clusterRanges;		// Two per cluster: first entry in lightIndices, and number of lights
+	std::vector<GLuint> lightIndices;		// Lights touching each cluster, one cluster after another
+};
 
-		// Upload the image data to GPU memory
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, imageWidth, imageHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, imageData);
+/**
+ * @brief Computes the view-space bounding box of every light cluster.
+ * @param[in] perspective Symmetric perspective projection of the camera
+ * @param[in] nearPlane Distance where the first depth slice starts
+ * @param[in] farPlane Distance where the last depth slice ends
+ * @param[out] grid Cluster bounding boxes
+ */
+void BuildLightClusterGrid(const glm::mat4& perspective, float nearPlane, float farPlane, LightClusterGrid& grid);
 
-		// If we set minification to use mipmaps, we can tell OpenGL to generate the mipmaps for us
-		//glGenerateMipmap(GL_TEXTURE_2D);
+/**
+ * @brief Works out how bright a flickering light is at a point in time.
+ * @param[in] light Light to evaluate
+ * @param[in] lightIndex Index of the light in the level, so that lights flicker out of step with each other
+ * @param[in] time Time in seconds
+ * @return Brightness from 0 to 1
+ */
+float GetLightFlicker(const LevelLight& light, uint32_t lightIndex, float time);
 
-		// Once we have copied the data over to the GPU, we can delete
-		// the data on the CPU side, since we won't be using it anymore
-		stbi_image_free(imageData);
-		imageData = nullptr;
-	}
-	else
-	{
-		std::cerr << "Failed to load image" << std::endl;
-	}
+/**
+ * @brief Bins the level's lights into the clusters their radius reaches.
+ * @param[in] level Level whose lights are binned
+ * @param[in] time Time in seconds, for flickering
+ * @param[in] camera View matrix of the camera
+ * @param[in] grid Cluster bounding boxes from BuildLightClusterGrid
+ * @param[out] clusters Light data and per-cluster light lists
+ * @return Total number of lights across all clusters
+ */
+size_t AssignLightsToClusters(const Level& level, float time, const glm::mat4& camera, const LightClusterGrid& grid, LightClusters& clusters);
 
-	// Create a variable that will contain the ID for our texture,
-	// and use glGenTextures() to generate the texture itself
-	GLuint floorTex;
-	glGenTextures(1, &floorTex);
+// Number of regions in a stream buffer. The CPU fills one while the GPU may still be reading the other two.
+const int STREAM_BUFFER_FRAMES = 3;
 
-	// --- Load our image using stb_image ---
+/**
+ * Buffer that per-frame data is streamed through, split into one region per frame in flight.
+ * A region is only written again once its fence shows the GPU is done with the frame that read it,
+ * so writes never wait for the GPU or make the driver copy the buffer.
+ */
+struct StreamBuffer
+{
+	GLuint buffer = 0;
+	GLsizeiptr regionSize = 0;					// Size of each region in bytes
+	GLsizeiptr alignment = 1;					// Every write starts at a multiple of this many bytes
+	char* mapped = nullptr;						// Persistently mapped contents, or null if writes go through glBufferSubData
+	GLsync fences[STREAM_BUFFER_FRAMES] = {};	// Signalled once the GPU is done with each region
+	int frame = 0;								// Region being written
+	GLsizeiptr offset = 0;						// Bytes written to the current region so far
+};
 
-	// Im image-space (pixels), (0, 0) is the upper-left corner of the image
-	// However, in u-v coordinates, (0, 0) is the lower-left corner of the image
-	// This means that the image will appear upside-down when we use the image data as is
-	// This function tells stbi to flip the image vertically so that it is not upside-down when we use it
-	stbi_set_flip_vertically_on_load(true);
+/**
+ * @brief Sets up a stream buffer with one region per frame in flight.
+ * @param[out] stream Stream buffer to set up
+ * @param[in] regionSize Most bytes written in a single frame, including alignment padding
+ * @param[in] alignment Every write starts at a multiple of this many bytes
+ */
+void CreateStreamBuffer(StreamBuffer& stream, GLsizeiptr regionSize, GLsizeiptr alignment);
 
+/**
+ * @brief Moves on to the next region of a stream buffer, waiting for the GPU to finish reading it if it still is.
+ * @param[in,out] stream Stream buffer
+ */
+void BeginStreamFrame(StreamBuffer& stream);
 
-	// Read the image data and store it in an unsigned char array
-	imageData = stbi_load("BrownTileTex.jpg", &imageWidth, &imageHeight, &numChannels, 0);
+/**
+ * @brief Copies data into the current region of a stream buffer.
+ * @param[in,out] stream Stream buffer
+ * @param[in] data Data to copy
+ * @param[in] size Size of the data in bytes
+ * @return Offset of the data from the start of the buffer, or -1 if the region is full
+ */
+GLintptr WriteStreamBuffer(StreamBuffer& stream, const void* data, GLsizeiptr size);
 
-	// Make sure that we actually loaded the image before uploading the data to the GPU
-	if (imageData != nullptr)
-	{
-		// Our texture is 2D, so we bind our texture to the GL_TEXTURE_2D target
-		glBindTexture(GL_TEXTURE_2D, floorTex);
+/**
+ * @brief Fences the current region of a stream buffer. Call this after the last command that reads from it.
+ * @param[in,out] stream Stream buffer
+ */
+void EndStreamFrame(StreamBuffer& stream);
 
-		// Set the filtering methods for magnification and minification
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+/**
+ * @brief Unmaps and deletes a stream buffer.
+ * @param[in,out] stream Stream buffer
+ */
+void DeleteStreamBuffer(StreamBuffer& stream);
 
-		// Set the wrapping method for the s-axis (x-axis) and t-axis (y-axis)
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+// Buffer textures that main.fsh reads the local lights through: light data, cluster ranges and light indices
+const int LIGHT_BUFFER_COUNT = 3;
 
-		// Upload the image data to GPU memory
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, imageWidth, imageHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, imageData);
+/**
+ * How the light buffer textures are pointed at each frame's light data.
+ * A buffer texture can only span GL_MAX_TEXTURE_BUFFER_SIZE texels, which can be as few as 65536.
+ */
+enum LightBufferMode
+{
+	LIGHT_BUFFERS_WHOLE_STREAM,	// The textures span all of frameStream and each frame's data is found through FrameUniforms::lightBufferOffsets
+	LIGHT_BUFFERS_RANGES,		// The textures are re-pointed at each frame's writes to frameStream with glTexBufferRange
+	LIGHT_BUFFERS_PER_FRAME		// The lights are written to separate buffers, one set per frame in flight, instead of to frameStream
+};
 
-		// If we set minification to use mipmaps, we can tell OpenGL to generate the mipmaps for us
-		//glGenerateMipmap(GL_TEXTURE_2D);
+/**
+ * @brief Computes the world-space box that encloses the floor and every wall tile of a level.
+ * @param[in] level Level to measure
+ * @param[out] boundsMin Minimum corner of the box
+ * @param[out] boundsMax Maximum corner of the box
+ */
+void GetLevelBounds(const Level& level, glm::vec3& boundsMin, glm::vec3& boundsMax);
 
-		// Once we have copied the data over to the GPU, we can delete
-		// the data on the CPU side, since we won't be using it anymore
-		stbi_image_free(imageData);
-		imageData = nullptr;
-	}
-	else
-	{
-		std::cerr << "Failed to load image" << std::endl;
-	}
+/**
+ * @brief Transforms a box and computes the axis-aligned box that encloses the result.
+ * @param[in] transform Transform to apply
+ * @param[in] boundsMin Minimum corner of the box
+ * @param[in] boundsMax Maximum corner of the box
+ * @param[out] transformedMin Minimum corner of the transformed box
+ * @param[out] transformedMax Maximum corner of the transformed box
+ */
+void TransformBounds(const glm::mat4& transform, const glm::vec3& boundsMin, const glm::vec3& boundsMax, glm::vec3& transformedMin, glm::vec3& transformedMax);
 
-	
-	// Skybox textures code
-	std::vector<std::string> skyboxFaces{
-		"night2.jpg",
-		"night2.jpg",
-		"nightmoon.jpg",
-		"night2.jpg",
-		"night4.jpg",
-		"night4.jpg"
-	};
+/**
+ * @brief Splits a view-space depth range into shadow cascades, blending logarithmic and uniform split schemes.
+ * @param[in] nearPlane Start of the depth range
+ * @param[in] farPlane End of the depth range
+ * @param[in] cascadeCount Number of cascades
+ * @param[out] splitDistances Receives cascadeCount + 1 distances. Cascade i covers splitDistances[i] to splitDistances[i + 1].
+ */
+void ComputeCascadeSplits(float nearPlane, float farPlane, int cascadeCount, float* splitDistances);
 
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+/**
+ * @brief Creates the orthographic light projection of one shadow cascade.
+ * The projection encloses a sphere around the camera position that reaches the slice's far corners.
+ * It ignores which way the camera faces, so it stays the same while the camera turns,
+ * and it is snapped to whole texels, so it only moves in texel steps while the camera moves.
+ * @param[in] lightView View matrix of the light
+ * @param[in] camera View matrix of the camera
+ * @param[in] fieldOfView Vertical field of view of the camera in radians
+ * @param[in] aspectRatio Aspect ratio of the camera
+ * @param[in] splitFar View-space distance where the cascade ends
+ * @param[in] levelLightMin Minimum corner of the level's bounds in the light's view space
+ * @param[in] levelLightMax Maximum corner of the level's bounds in the light's view space
+ * @param[in] shadowMapSize Width and height of the cascade's shadow map in texels
+ * @return Orthographic projection matrix for the cascade
+ */
+glm::mat4 FitCascadeProjection(const glm::mat4& lightView, const glm::mat4& camera, float fieldOfView, float aspectRatio,
+	float splitFar, const glm::vec3& levelLightMin, const glm::vec3& levelLightMax, int shadowMapSize);
 
-	int width, height, nrChannels;
-	
-	for (unsigned int i = 0; i < skyboxFaces.size(); i++)
-	{
-		//
-		unsigned char* data = stbi_load(skyboxFaces[i].c_str(), &width, &height, &nrChannels, 0);
-		if (data)
-		{
-			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
-				0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data
-			);
-			stbi_image_free(data);
-		}
-		else
-		{
-			std::cout << "Cubemap tex failed to load at path: " << skyboxFaces[i] << std::endl;
-			stbi_image_free(data);
-		}
-	}
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+/**
+ * Renderer options that can be changed from the command line
+ */
+struct RenderSettings
+{
+	int shadowMapSize = 2048;	// Width and height of each shadow cascade in texels
+	int shadowDepthBits = 24;	// Shadow map depth precision: 16, 24 or 32 (floating point)
+	int shadowCascades = 3;		// Number of shadow cascades, 1 to MAX_SHADOW_CASCADES
+	int shadowFilterTaps = 8;	// Shadow map taps per fragment, 0 to 16. Each tap is a hardware-filtered 2x2 comparison, and 0 turns shadows off.
+	int anisotropy = 8;			// Maximum anisotropic filtering ratio for the wall and floor textures, 1 to 16. 1 disables it.
+	bool gpuCulling = true;		// Cull the wall quads in a compute shader where OpenGL 4.3 is available, instead of on the CPU
+	bool stats = false;			// Print culling, light clustering and GPU timings to the console every second
+};
 
-	unsigned int skyboxTexture = textureID;
+/**
+ * @brief Reads renderer options from the command line.
+ * Supported options are "--shadow-size <texels>", "--shadow-depth <16|24|32>", "--shadow-cascades <1-4>",
+ * "--shadow-filter-taps <0-16>", "--anisotropy <1-16>", "--gpu-culling <0|1>" and "--stats <0|1>".
+ * @param[in] argc Number of command-line arguments
+ * @param[in] argv Command-line arguments
+ * @param[out] settings Settings to fill in. Options that are not given keep their defaults.
+ * @return True if every option was recognized and valid
+ */
+bool ParseRenderSettings(int argc, char* argv[], RenderSettings& settings);
 
-	//
-	// Skybox code - end
+/**
+ * Records what was last rendered into a shadow map layer, so its depth pass can be skipped while none of it changed
+ */
+struct ShadowCache
+{
+	glm::mat4 lightProjection;
+	glm::mat4 lightView;
+	uint32_t casterVersion = 0;
+	bool valid = false;
+};
 
-	glEnable(GL_DEPTH_TEST);
+/**
+ * @brief Checks whether the shadow map still matches the current light and shadow casters.
+ * @param[in] cache Shadow cache to check
+ * @param[in] lightProjection Current light projection matrix
+ * @param[in] lightView Current light view matrix
+ * @param[in] casterVersion Current shadow caster version
+ * @return True if the shadow map can be reused as is
+ */
+bool IsShadowCacheCurrent(const ShadowCache& cache, const glm::mat4& lightProjection, const glm::mat4& lightView, uint32_t casterVersion);
 
-	std::vector<Hitbox> hitboxArray;
-
-	floorTile01 = glm::scale(floorTile01, glm::vec3(9.0f, 1.0f, 9.0f));
-
-	wallTileL01 = glm::translate(wallTileL01, glm::vec3(-0.5f, 0.5f, 0.0f));
-	wallTileL01 = glm::rotate(wallTileL01, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileL02 = glm::translate(wallTileL02, glm::vec3(-0.5f, 0.5f, -1.0f));
-	wallTileL02 = glm::rotate(wallTileL02, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileL03 = glm::translate(wallTileL03, glm::vec3(-0.5f, 0.5f, -2.0f));
-	wallTileL03 = glm::rotate(wallTileL03, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileL04 = glm::translate(wallTileL04, glm::vec3(-0.5f, 0.5f, -3.0f));
-	wallTileL04 = glm::rotate(wallTileL04, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-
-	Hitbox wall01;
-	wall01.bottomL = glm::vec3(-0.5f, 0.0f, 0.5f);
-	wall01.bottomR = glm::vec3(-0.5f, 0.0f, -3.5f);
-	wall01.topL = glm::vec3(-0.5f, 1.0f, 0.5f);
-	wall01.topR = glm::vec3(-0.5, 1.0f, -3.5f);
-	wall01.setXWall();
-	hitboxArray.push_back(wall01);
-
-	wallTileL05 = glm::translate(wallTileL05, glm::vec3(-1.0f, 0.5f, -3.5f));
-	wallTileL05 = glm::rotate(wallTileL05, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileL05 = glm::rotate(wallTileL05, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-	wallTileL10 = glm::translate(wallTileL10, glm::vec3(-2.0f, 0.5f, -3.5f));
-	wallTileL10 = glm::rotate(wallTileL10, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileL10 = glm::rotate(wallTileL10, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-
-	Hitbox wall02;
-	wall02.bottomL = glm::vec3(-0.5f, 0.0f, -3.5f);
-	wall02.bottomR = glm::vec3(-2.5f, 0.0f, -3.5f);
-	wall02.topL = glm::vec3(-0.5f, 1.0f, -3.5f);
-	wall02.topR = glm::vec3(-2.5f, 1.0f, -3.5f);
-	wall02.setZWall();
-	hitboxArray.push_back(wall02);
-
-	wallTileL06 = glm::translate(wallTileL06, glm::vec3(-0.5f, 0.5f, 2.0f));
-	wallTileL06 = glm::rotate(wallTileL06, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileL07 = glm::translate(wallTileL07, glm::vec3(-0.5f, 0.5f, 3.0f));
-	wallTileL07 = glm::rotate(wallTileL07, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileL08 = glm::translate(wallTileL08, glm::vec3(-0.5f, 0.5f, 4.0f));
-	wallTileL08 = glm::rotate(wallTileL08, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileL09 = glm::translate(wallTileL09, glm::vec3(-0.5f, 0.5f, 5.0f));
-	wallTileL09 = glm::rotate(wallTileL09, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-
-	Hitbox wall03;
-	wall03.bottomL = glm::vec3(-0.5f, 0.0f, 5.5f);
-	wall03.bottomR = glm::vec3(-0.5f, 0.0f, 1.5f);
-	wall03.topL = glm::vec3(-0.5f, 1.0f, 5.5f);
-	wall03.topR = glm::vec3(-0.5f, 1.0f, 1.5f);
-	wall03.setXWall();
-	hitboxArray.push_back(wall03);
-
-    // North West Quadrant
-	
-	wallTileL11 = glm::translate(wallTileL11, glm::vec3(-2.5f, 0.5f, -3.0f));
-	wallTileL11 = glm::rotate(wallTileL11, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileL12 = glm::translate(wallTileL12, glm::vec3(-2.5f, 0.5f, -2.0f));
-	wallTileL12 = glm::rotate(wallTileL12, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-
-	Hitbox wall04;
-	wall04.bottomL = glm::vec3(-2.5f, 0.0f, -1.5f);
-	wall04.bottomR = glm::vec3(-2.5f, 0.0f, -3.5f);
-	wall04.topL = glm::vec3(-2.5f, 1.0f, -1.5f);
-	wall04.topR = glm::vec3(-2.5f, 1.0f, -3.5f);
-	wall04.setXWall();
-	hitboxArray.push_back(wall04);
-
-	wallTileL13 = glm::translate(wallTileL13, glm::vec3(-2.0f, 0.5f, -1.5f));
-	wallTileL13 = glm::rotate(wallTileL13, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileL13 = glm::rotate(wallTileL13, glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-
-	Hitbox wall05;
-	wall05.bottomL = glm::vec3(-1.5f, 0.0f, -1.5f);
-	wall05.bottomR = glm::vec3(-2.5f, 0.0f, -1.5f);
-	wall05.topL = glm::vec3(-1.5f, 1.0f, -1.5f);
-	wall05.topR = glm::vec3(-2.5f, 1.0f, -1.5f);
-	wall05.setZWall();
-	hitboxArray.push_back(wall05);
-	
-	wallTileL15 = glm::translate(wallTileL15, glm::vec3(-1.5f, 0.5f, -1.0f));
-	wallTileL15 = glm::rotate(wallTileL15, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-
-	Hitbox wall06;
-	wall06.bottomL = glm::vec3(-1.5f, 0.0f, -0.5f);
-	wall06.bottomR = glm::vec3(-1.5f, 0.0f, -1.5f);
-	wall06.topL = glm::vec3(-1.5f, 1.0f, -0.5f);
-	wall06.topR = glm::vec3(-1.5f, 1.0f, -1.5f);
-	wall06.setXWall();
-	hitboxArray.push_back(wall06);
-
-	wallTileL14 = glm::translate(wallTileL14, glm::vec3(-2.0f, 0.5f, -0.5f));
-	wallTileL14 = glm::rotate(wallTileL14, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileL14 = glm::rotate(wallTileL14, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-	wallTileL16 = glm::translate(wallTileL16, glm::vec3(-3.0f, 0.5f, -0.5f));
-	wallTileL16 = glm::rotate(wallTileL16, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileL16 = glm::rotate(wallTileL16, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-	wallTileL17 = glm::translate(wallTileL17, glm::vec3(-4.0f, 0.5f, -0.5f));
-	wallTileL17 = glm::rotate(wallTileL17, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileL17 = glm::rotate(wallTileL17, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-
-	Hitbox wall07;
-	wall07.bottomL = glm::vec3(-1.5f, 0.0f, -0.5f);
-	wall07.bottomR = glm::vec3(-4.5f, 0.0f, -0.5f);
-	wall07.topL = glm::vec3(-1.5f, 1.0f, -0.5f);
-	wall07.topR = glm::vec3(-4.5f, 1.0f, -0.5f);
-	wall07.setZWall();
-	hitboxArray.push_back(wall07);
-
-	wallTileL18 = glm::translate(wallTileL18, glm::vec3(-4.5f, 0.5f, -1.0f));
-	wallTileL18 = glm::rotate(wallTileL18, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-
-	Hitbox wall08;
-	wall08.bottomL = glm::vec3(-4.5f, 0.0f, -0.5f);
-	wall08.bottomR = glm::vec3(-4.5f, 0.0f, -1.5f);
-	wall08.topL = glm::vec3(-4.5f, 1.0f, -0.5f);
-	wall08.topR = glm::vec3(-4.5f, 1.0f, -1.5f);
-	wall08.setXWall();
-	hitboxArray.push_back(wall08);
-
-	wallTileL19 = glm::translate(wallTileL19, glm::vec3(-4.0f, 0.5f, -1.5f));
-	wallTileL19 = glm::rotate(wallTileL19, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileL19 = glm::rotate(wallTileL19, glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-
-	Hitbox wall09;
-	wall09.bottomL = glm::vec3(-3.5f, 0.0f, -1.5f);
-	wall09.bottomR = glm::vec3(-4.5f, 0.0f, -1.5f);
-	wall09.topL = glm::vec3(-3.5f, 1.0f, -1.5f);
-	wall09.topR = glm::vec3(-4.5f, 1.0f, -1.5f);
-	wall09.setZWall();
-	hitboxArray.push_back(wall09);
-
-	wallTileL20 = glm::translate(wallTileL20, glm::vec3(-3.5f, 0.5f, -2.0f));
-	wallTileL20 = glm::rotate(wallTileL20, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileL21 = glm::translate(wallTileL21, glm::vec3(-3.5f, 0.5f, -3.0f));
-	wallTileL21 = glm::rotate(wallTileL21, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileL22 = glm::translate(wallTileL22, glm::vec3(-3.5f, 0.5f, -4.0f));
-	wallTileL22 = glm::rotate(wallTileL22, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-
-	Hitbox wall10;
-	wall10.bottomL = glm::vec3(-3.5f, 0.0f, -1.5f);
-	wall10.bottomR = glm::vec3(-3.5f, 0.0f, -4.5f);
-	wall10.topL = glm::vec3(-3.5f, 1.0f, -1.5f);
-	wall10.topR = glm::vec3(-3.5f, 1.0f, -4.5f);
-	wall10.setXWall();
-	hitboxArray.push_back(wall10);
-
-	wallTileL23 = glm::translate(wallTileL23, glm::vec3(-3.0f, 0.5f, -4.5f));
-	wallTileL23 = glm::rotate(wallTileL23, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileL23 = glm::rotate(wallTileL23, glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-	wallTileL24 = glm::translate(wallTileL24, glm::vec3(-2.0f, 0.5f, -4.5f));
-	wallTileL24 = glm::rotate(wallTileL24, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileL24 = glm::rotate(wallTileL24, glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-	wallTileL25 = glm::translate(wallTileL25, glm::vec3(-1.0f, 0.5f, -4.5f));
-	wallTileL25 = glm::rotate(wallTileL25, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileL25 = glm::rotate(wallTileL25, glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-	wallTileL26 = glm::translate(wallTileL26, glm::vec3(0.0f, 0.5f, -4.5f));
-	wallTileL26 = glm::rotate(wallTileL26, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileL26 = glm::rotate(wallTileL26, glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-
-	Hitbox wall11;
-	wall11.bottomL = glm::vec3(0.5f, 0.0f, -4.5f);
-	wall11.bottomR = glm::vec3(-3.5f, 0.0f, -4.5f);
-	wall11.topL = glm::vec3(0.5f, 1.0f, -4.5f);
-	wall11.topR = glm::vec3(-3.5f, 1.0f, -4.5f);
-	wall11.setZWall();
-	hitboxArray.push_back(wall11);
-	// END of North West Quadrant
-
-	// South West Quadrant
-	wallTileL27 = glm::translate(wallTileL27, glm::vec3(-1.0f, 0.5f, 0.5f));
-	wallTileL27 = glm::rotate(wallTileL27, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileL27 = glm::rotate(wallTileL27, glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-	wallTileL28 = glm::translate(wallTileL28, glm::vec3(-2.0f, 0.5f, 0.5f));
-	wallTileL28 = glm::rotate(wallTileL28, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileL28 = glm::rotate(wallTileL28, glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-
-	Hitbox wall12;
-	wall12.bottomL = glm::vec3(-0.5f, 0.0f, 0.5f);
-	wall12.bottomR = glm::vec3(-2.5f, 0.0f, 0.5f);
-	wall12.topL = glm::vec3(-0.5f, 1.0f, 0.5f);
-	wall12.topR = glm::vec3(-2.5f, 1.0f, 0.5f);
-	wall12.setZWall();
-	hitboxArray.push_back(wall12);
-
-	wallTileL29 = glm::translate(wallTileL29, glm::vec3(-2.5f, 0.5f, 1.0f));
-	wallTileL29 = glm::rotate(wallTileL29, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileL30 = glm::translate(wallTileL30, glm::vec3(-2.5f, 0.5f, 2.0f));
-	wallTileL30 = glm::rotate(wallTileL30, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileL31 = glm::translate(wallTileL31, glm::vec3(-2.5f, 0.5f, 3.0f));
-	wallTileL31 = glm::rotate(wallTileL31, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-
-	Hitbox wall13;
-	wall13.bottomL = glm::vec3(-2.5f, 0.0f, 3.5f);
-	wall13.bottomR = glm::vec3(-2.5f, 0.0f, 0.5f);
-	wall13.topL = glm::vec3(-2.5f, 1.0f, 3.5f);
-	wall13.topR = glm::vec3(-2.5f, 1.0f, 0.5f);
-	wall13.setXWall();
-	hitboxArray.push_back(wall13);
-
-	wallTileL32 = glm::translate(wallTileL32, glm::vec3(-3.0f, 0.5f, 3.5f));
-	wallTileL32 = glm::rotate(wallTileL32, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileL32 = glm::rotate(wallTileL32, glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-
-	Hitbox wall14;
-	wall14.bottomL = glm::vec3(-2.5f, 0.0f, 3.5f);
-	wall14.bottomR = glm::vec3(-3.5f, 0.0f, 3.5f);
-	wall14.topL = glm::vec3(-2.5f, 1.0f, 3.5f);
-	wall14.topR = glm::vec3(-3.5f, 1.0f, 3.5f);
-	wall14.setZWall();
-	hitboxArray.push_back(wall14);
-
-	wallTileL33 = glm::translate(wallTileL33, glm::vec3(-3.5f, 0.5f, 3.0f));
-	wallTileL33 = glm::rotate(wallTileL33, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileL34 = glm::translate(wallTileL34, glm::vec3(-3.5f, 0.5f, 2.0f));
-	wallTileL34 = glm::rotate(wallTileL34, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileL35 = glm::translate(wallTileL35, glm::vec3(-3.5f, 0.5f, 1.0f));
-	wallTileL35 = glm::rotate(wallTileL35, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-
-	Hitbox wall15;
-	wall15.bottomL = glm::vec3(-3.5f, 0.0f, 3.5f);
-	wall15.bottomR = glm::vec3(-3.5f, 0.0f, 0.5f);
-	wall15.topL = glm::vec3(-3.5f, 1.0f, 3.5f);
-	wall15.topR = glm::vec3(-3.5f, 1.0f, 0.5f);
-	wall15.setXWall();
-	hitboxArray.push_back(wall15);
-
-	wallTileL36 = glm::translate(wallTileL36, glm::vec3(-4.0f, 0.5f, 0.5f));
-	wallTileL36 = glm::rotate(wallTileL36, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileL36 = glm::rotate(wallTileL36, glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-
-	Hitbox wall16;
-	wall16.bottomL = glm::vec3(-3.5, 0.0f, 0.5f);
-	wall16.bottomR = glm::vec3(-4.5, 0.0f, 0.5f);
-	wall16.topL = glm::vec3(-3.5, 1.0f, 0.5f);
-	wall16.topR = glm::vec3(-4.5, 1.0f, 0.5f);
-	wall16.setZWall();
-	hitboxArray.push_back(wall16);
-
-	wallTileL37 = glm::translate(wallTileL37, glm::vec3(-4.5f, 0.5f, 1.0f));
-	wallTileL37 = glm::rotate(wallTileL37, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileL38 = glm::translate(wallTileL38, glm::vec3(-4.5f, 0.5f, 2.0f));
-	wallTileL38 = glm::rotate(wallTileL38, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileL39 = glm::translate(wallTileL39, glm::vec3(-4.5f, 0.5f, 3.0f));
-	wallTileL39 = glm::rotate(wallTileL39, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileL40 = glm::translate(wallTileL40, glm::vec3(-4.5f, 0.5f, 4.0f));
-	wallTileL40 = glm::rotate(wallTileL40, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-
-	Hitbox wall17;
-	wall17.bottomL = glm::vec3(-4.5f, 0.0f, 4.5f);
-	wall17.bottomR = glm::vec3(-4.5f, 0.0f, 0.5f);
-	wall17.topL = glm::vec3(-4.5f, 1.0f, 4.5f);
-	wall17.topR = glm::vec3(-4.5f, 1.0f, 0.5f);
-	wall17.setXWall();
-	hitboxArray.push_back(wall17);
-
-	wallTileL41 = glm::translate(wallTileL41, glm::vec3(-4.0f, 0.5f, 4.5f));
-	wallTileL41 = glm::rotate(wallTileL41, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileL41 = glm::rotate(wallTileL41, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-	wallTileL42 = glm::translate(wallTileL42, glm::vec3(-3.0f, 0.5f, 4.5f));
-	wallTileL42 = glm::rotate(wallTileL42, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileL42 = glm::rotate(wallTileL42, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-	wallTileL43 = glm::translate(wallTileL43, glm::vec3(-2.0f, 0.5f, 4.5f));
-	wallTileL43 = glm::rotate(wallTileL43, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileL43 = glm::rotate(wallTileL43, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-
-	Hitbox wall18;
-	wall18.bottomL = glm::vec3(-1.5f, 0.0f, 4.5f);
-	wall18.bottomR = glm::vec3(-4.5f, 0.0f, 4.5f);
-	wall18.topL = glm::vec3(-1.5f, 1.0f, 4.5f);
-	wall18.topR = glm::vec3(-4.5f, 1.0f, 4.5f);
-	wall18.setZWall();
-	hitboxArray.push_back(wall18);
-
-	wallTileL44 = glm::translate(wallTileL44, glm::vec3(-1.5f, 0.5f, 4.0f));
-	wallTileL44 = glm::rotate(wallTileL44, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileL45 = glm::translate(wallTileL45, glm::vec3(-1.5f, 0.5f, 3.0f));
-	wallTileL45 = glm::rotate(wallTileL45, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileL46 = glm::translate(wallTileL46, glm::vec3(-1.5f, 0.5f, 2.0f));
-	wallTileL46 = glm::rotate(wallTileL46, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-
-	Hitbox wall19;
-	wall19.bottomL = glm::vec3(-1.5f, 0.0f, 4.5f);
-	wall19.bottomR = glm::vec3(-1.5f, 0.0f, 1.5f);
-	wall19.topL = glm::vec3(-1.5f, 1.0f, 4.5f);
-	wall19.topR = glm::vec3(-1.5f, 1.0f, 1.5f);
-	wall19.setXWall();
-	hitboxArray.push_back(wall19);
-
-	wallTileL47 = glm::translate(wallTileL47, glm::vec3(-1.0f, 0.5f, 1.5f)); 
-	wallTileL47 = glm::rotate(wallTileL47, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileL47 = glm::rotate(wallTileL47, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-
-	Hitbox wall20;
-	wall20.bottomL = glm::vec3(-0.5f, 0.0f, 1.5f);
-	wall20.bottomR = glm::vec3(-1.5f, 0.0f, 1.5f);
-	wall20.topL = glm::vec3(-0.5f, 1.0f, 1.5f);
-	wall20.topR = glm::vec3(-1.5f, 1.0f, 1.5f);
-	wall20.setZWall();
-	hitboxArray.push_back(wall20);
-
-
-    // End of South west quadrant and left side
-
-	// Right side
-	wallTileR01 = glm::translate(wallTileR01, glm::vec3(0.5f, 0.5f, 0.0f));
-	wallTileR01 = glm::rotate(wallTileR01, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileR02 = glm::translate(wallTileR02, glm::vec3(0.5f, 0.5f, -1.0f));
-	wallTileR02 = glm::rotate(wallTileR02, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileR03 = glm::translate(wallTileR03, glm::vec3(0.5f, 0.5f, -2.0f));
-	wallTileR03 = glm::rotate(wallTileR03, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileR04 = glm::translate(wallTileR04, glm::vec3(0.5f, 0.5f, -3.0f));
-	wallTileR04 = glm::rotate(wallTileR04, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileR05 = glm::translate(wallTileR05, glm::vec3(0.5f, 0.5f, -4.0f));
-	wallTileR05 = glm::rotate(wallTileR05, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileR06 = glm::translate(wallTileR06, glm::vec3(0.5f, 0.5f, 1.0f));
-	wallTileR06 = glm::rotate(wallTileR06, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileR07 = glm::translate(wallTileR07, glm::vec3(0.5f, 0.5f, 2.0f));
-	wallTileR07 = glm::rotate(wallTileR07, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-
-	Hitbox wall21;
-	wall21.bottomL = glm::vec3(0.5f, 0.0f, 2.5f);
-	wall21.bottomR = glm::vec3(0.5f, 0.0f, -4.5f);
-	wall21.topL = glm::vec3(0.5f, 1.0f, 2.5f);
-	wall21.topR = glm::vec3(0.5f, 1.0f, -4.5f);
-	wall21.setXWall();
-	hitboxArray.push_back(wall21);
-
-	wallTileR08 = glm::translate(wallTileR08, glm::vec3(0.5f, 0.5f, 4.0f));
-	wallTileR08 = glm::rotate(wallTileR08, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileR09 = glm::translate(wallTileR09, glm::vec3(0.5f, 0.5f, 5.0f));
-	wallTileR09 = glm::rotate(wallTileR09, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-
-	Hitbox wall22;
-	wall22.bottomL = glm::vec3(0.5f, 0.0f, 5.5f);
-	wall22.bottomR = glm::vec3(0.5f, 0.0f, 3.5f);
-	wall22.topL = glm::vec3(0.5f, 1.0f, 5.5f);
-	wall22.topR = glm::vec3(0.5f, 1.0f, 3.5f);
-	wall22.setXWall();
-	hitboxArray.push_back(wall22);
-
-	wallTileR10 = glm::translate(wallTileR10, glm::vec3(0.0f, 0.5f, 4.5f));
-	wallTileR10 = glm::rotate(wallTileR10, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileR10 = glm::rotate(wallTileR10, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-
-	Hitbox wall23;
-	wall23.bottomL = glm::vec3(0.5f, 0.0f, 4.5f);
-	wall23.bottomR = glm::vec3(-0.5f, 0.0f, 4.5f);
-	wall23.topL = glm::vec3(0.5f, 1.0f, 4.5f);
-	wall23.topR = glm::vec3(-0.5f, 1.0f, 4.5f);
-	wall23.setZWall();
-	hitboxArray.push_back(wall23);
-
-	wallTileR11 = glm::translate(wallTileR11, glm::vec3(1.0f, 0.5f, 2.5f));
-	wallTileR11 = glm::rotate(wallTileR11, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileR11 = glm::rotate(wallTileR11, glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-	wallTileR12 = glm::translate(wallTileR12, glm::vec3(2.0f, 0.5f, 2.5f));
-	wallTileR12 = glm::rotate(wallTileR12, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileR12 = glm::rotate(wallTileR12, glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-	wallTileR13 = glm::translate(wallTileR13, glm::vec3(3.0f, 0.5f, 2.5f));
-	wallTileR13 = glm::rotate(wallTileR13, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileR13 = glm::rotate(wallTileR13, glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-
-	Hitbox wall24;
-	wall24.bottomL = glm::vec3(3.5f, 0.0f, 2.5f);
-	wall24.bottomR = glm::vec3(0.5f, 0.0f, 2.5f);
-	wall24.topL = glm::vec3(3.5f, 1.0f, 2.5f);
-	wall24.topR = glm::vec3(0.5f, 1.0f, 2.5f);
-	wall24.setZWall();
-	hitboxArray.push_back(wall24);
-
-	wallTileR14 = glm::translate(wallTileR14, glm::vec3(3.5f, 0.5f, 2.0f));
-	wallTileR14 = glm::rotate(wallTileR14, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileR15 = glm::translate(wallTileR15, glm::vec3(3.5f, 0.5f, 1.0f));
-	wallTileR15 = glm::rotate(wallTileR15, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileR16 = glm::translate(wallTileR16, glm::vec3(3.5f, 0.5f, 0.0f));
-	wallTileR16 = glm::rotate(wallTileR16, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-
-	Hitbox wall25;
-	wall25.bottomL = glm::vec3(3.5f, 0.0f, 2.5f);
-	wall25.bottomR = glm::vec3(3.5f, 0.0f, -0.5f);
-	wall25.topL = glm::vec3(3.5f, 1.0f, 2.5f);
-	wall25.topR = glm::vec3(3.5f, 1.0f, -0.5f);
-	wall25.setXWall();
-	hitboxArray.push_back(wall25);
-
-	wallTileR17 = glm::translate(wallTileR17, glm::vec3(3.0f, 0.5f, -0.5f));
-	wallTileR17 = glm::rotate(wallTileR17, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileR17 = glm::rotate(wallTileR17, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-	wallTileR18 = glm::translate(wallTileR18, glm::vec3(2.0f, 0.5f, -0.5f));
-	wallTileR18 = glm::rotate(wallTileR18, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileR18 = glm::rotate(wallTileR18, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-
-	Hitbox wall26;
-	wall26.bottomL = glm::vec3(3.5f, 0.0f, -0.5f);
-	wall26.bottomR = glm::vec3(1.5f, 0.0f, -0.5f);
-	wall26.topL = glm::vec3(3.5f, 1.0f, -0.5f);
-	wall26.topR = glm::vec3(1.5f, 1.0f, -0.5f);
-	wall26.setZWall();
-	hitboxArray.push_back(wall26);
-
-	wallTileR19 = glm::translate(wallTileR19, glm::vec3(1.5f, 0.5f, -1.0f));
-	wallTileR19 = glm::rotate(wallTileR19, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileR20 = glm::translate(wallTileR20, glm::vec3(1.5f, 0.5f, -2.0f));
-	wallTileR20 = glm::rotate(wallTileR20, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileR21 = glm::translate(wallTileR21, glm::vec3(1.5f, 0.5f, -3.0f));
-	wallTileR21 = glm::rotate(wallTileR21, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileR22 = glm::translate(wallTileR22, glm::vec3(1.5f, 0.5f, -4.0f));
-	wallTileR22 = glm::rotate(wallTileR22, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-
-	Hitbox wall27;
-	wall27.bottomL = glm::vec3(1.5f, 0.0f, -0.5f);
-	wall27.bottomR = glm::vec3(1.5f, 0.0f, -4.5f);
-	wall27.topL = glm::vec3(1.5f, 1.0f, -0.5f);
-	wall27.topR = glm::vec3(1.5f, 1.0f, -4.5f);
-	wall27.setXWall();
-	hitboxArray.push_back(wall27);
-
-	wallTileR23 = glm::translate(wallTileR23, glm::vec3(2.0f, 0.5f, -4.5f));
-	wallTileR23 = glm::rotate(wallTileR23, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileR23 = glm::rotate(wallTileR23, glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-	wallTileR24 = glm::translate(wallTileR24, glm::vec3(3.0f, 0.5f, -4.5f));
-	wallTileR24 = glm::rotate(wallTileR24, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileR24 = glm::rotate(wallTileR24, glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-
-	Hitbox wall28;
-	wall28.bottomL = glm::vec3(3.5f, 0.0f, -4.5f);
-	wall28.bottomR = glm::vec3(1.5f, 0.0f, -4.5f);
-	wall28.topL = glm::vec3(3.5f, 1.0f, -4.5f);
-	wall28.topR = glm::vec3(1.5f, 1.0f, -4.5f);
-	wall28.setZWall();
-	hitboxArray.push_back(wall28);
-
-	wallTileR25 = glm::translate(wallTileR25, glm::vec3(3.5f, 0.5f, -4.0f));
-	wallTileR25 = glm::rotate(wallTileR25, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileR26 = glm::translate(wallTileR26, glm::vec3(3.5f, 0.5f, -3.0f));
-	wallTileR26 = glm::rotate(wallTileR26, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileR27 = glm::translate(wallTileR27, glm::vec3(3.5f, 0.5f, -2.0f));
-	wallTileR27 = glm::rotate(wallTileR27, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-
-	Hitbox wall29;
-	wall29.bottomL = glm::vec3(3.5f, 0.0f, -1.5f);
-	wall29.bottomR = glm::vec3(3.5f, 0.0f, -4.5f);
-	wall29.topL = glm::vec3(3.5f, 1.0f, -1.5f);
-	wall29.topR = glm::vec3(3.5f, 1.0f, -4.5f);
-	wall29.setXWall();
-	hitboxArray.push_back(wall29);
-
-	wallTileR28 = glm::translate(wallTileR28, glm::vec3(4.0f, 0.5f, -1.5f));
-	wallTileR28 = glm::rotate(wallTileR28, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileR28 = glm::rotate(wallTileR28, glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-
-	Hitbox wall30;
-	wall30.bottomL = glm::vec3(4.5f, 0.0f, -1.5f);
-	wall30.bottomR = glm::vec3(3.5f, 0.0f, -1.5f);
-	wall30.topL = glm::vec3(4.5f, 1.0f, -1.5f);
-	wall30.topR = glm::vec3(3.5f, 1.0f, -1.5f);
-	wall30.setZWall();
-	hitboxArray.push_back(wall30);
-
-	wallTileR29 = glm::translate(wallTileR29, glm::vec3(4.5f, 0.5f, -1.0f));
-	wallTileR29 = glm::rotate(wallTileR29, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileR30 = glm::translate(wallTileR30, glm::vec3(4.5f, 0.5f, -0.0f));
-	wallTileR30 = glm::rotate(wallTileR30, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileR31 = glm::translate(wallTileR31, glm::vec3(4.5f, 0.5f, 1.0f));
-	wallTileR31 = glm::rotate(wallTileR31, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileR32 = glm::translate(wallTileR32, glm::vec3(4.5f, 0.5f, 2.0f));
-	wallTileR32 = glm::rotate(wallTileR32, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileR33 = glm::translate(wallTileR33, glm::vec3(4.5f, 0.5f, 3.0f));
-	wallTileR33 = glm::rotate(wallTileR33, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-
-	Hitbox wall31;
-	wall31.bottomL = glm::vec3(4.5f, 0.0f, 3.5f);
-	wall31.bottomR = glm::vec3(4.5f, 0.0f, -1.5f);
-	wall31.topL = glm::vec3(4.5f, 1.0f, 3.5f);
-	wall31.topR = glm::vec3(4.5f, 1.0f, -1.5f);
-	wall31.setXWall();
-	hitboxArray.push_back(wall31);
-
-	wallTileR34 = glm::translate(wallTileR34, glm::vec3(4.0f, 0.5f, 3.5f));
-	wallTileR34 = glm::rotate(wallTileR34, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileR34 = glm::rotate(wallTileR34, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-	wallTileR35 = glm::translate(wallTileR35, glm::vec3(3.0f, 0.5f, 3.5f));
-	wallTileR35 = glm::rotate(wallTileR35, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileR35 = glm::rotate(wallTileR35, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-	wallTileR36 = glm::translate(wallTileR36, glm::vec3(2.0f, 0.5f, 3.5f));
-	wallTileR36 = glm::rotate(wallTileR36, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileR36 = glm::rotate(wallTileR36, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-	wallTileR37 = glm::translate(wallTileR37, glm::vec3(1.0f, 0.5f, 3.5f));
-	wallTileR37 = glm::rotate(wallTileR37, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	wallTileR37 = glm::rotate(wallTileR37, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-
-	Hitbox wall32;
-	wall32.bottomL = glm::vec3(4.5f, 0.0f, 3.5f);
-	wall32.bottomR = glm::vec3(0.5f, 0.0f, 3.5f);
-	wall32.topL = glm::vec3(4.5f, 1.0f, 3.5f);
-	wall32.topR = glm::vec3(0.5f, 1.0f, 3.5f);
-	wall32.setZWall();
-	hitboxArray.push_back(wall32);
-
-	std::vector<glm::mat4> wallArray;
+/**
+ * @brief Records the light and shadow caster version that the shadow map was just rendered with.
+ * @param[out] cache Shadow cache to update
+ * @param[in] lightProjection Light projection matrix used for the depth pass
+ * @param[in] lightView Light view matrix used for the depth pass
+ * @param[in] casterVersion Shadow caster version used for the depth pass
+ */
+void UpdateShadowCache(ShadowCache& cache, const glm::mat4& lightProjection, const glm::mat4& lightView, uint32_t casterVersion);
 
-	
+/**
+ * @brief Marks the shadow casters as changed, so the shadow map is re-rendered on the next frame.
+ * Call this whenever a shadow-casting object is added, removed or moved.
+ */
+void InvalidateShadowCasters();
 
-	glm::vec3 cameraPosition = glm::vec3(0.0f, 0.5f, 0.0f);
-	glm::vec3 cameraTarget = glm::vec3(0.0f, 0.5f, -3.0f);
-	glm::vec3 cameraUp = glm::vec3(0.0f, 1.0f, 0.0f);
+bool checkCollision(glm::vec3 cameraPosition, const Level& level);
 
-	GLfloat angleX = M_PI;
-	GLfloat angleY = 0.0f;
-	GLfloat camSpeed = 0.5f;
-	GLfloat mouseSpeed = 0.25f;
+LevelWall collidedWall;
 
-	GLfloat prevTime = glfwGetTime();
+// Incremented by InvalidateShadowCasters. The static maze is version 0.
+uint32_t shadowCasterVersion = 0;
 
-	GLdouble xpos, ypos;
+glm::mat4 camera;
+glm::mat4 perspective;
 
-	int forwardInput = glfwGetKey(window, GLFW_KEY_W);
-	int backwardInput = glfwGetKey(window, GLFW_KEY_S);
-	int leftInput = glfwGetKey(window, GLFW_KEY_A);
-	int rightInput = glfwGetKey(window, GLFW_KEY_D);
+ISoundEngine* SoundEngine = createIrrKlangDevice();
+ISoundEngine* sfxEngine = createIrrKlangDevice();
+ISound* sfx;
 
-	SoundEngine->play2D("Thesis Game.mp3", true);
-	SoundEngine->setSoundVolume(0.05f);
-	sfx = sfxEngine->play2D("FootStep.mp3", false, false, true);
-	sfxEngine->setSoundVolume(0.25f);
+bool lightOn = true;
+bool depthPrePass = false;	// Toggled with P
 
-	
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
 
-	glfwSetKeyCallback(window, key_callback);
+/**
+ * @brief Main function
+ * @param[in] argc Number of command-line arguments
+ * @param[in] argv Command-line arguments. "--bake-level <source> <output>" bakes a level file and exits,
+ * and "--bake-texture <repeat|clamp> <image>..." fills the texture cache for the images and exits.
+ * Otherwise, the arguments are renderer options read by ParseRenderSettings.
+ * @return An integer indicating whether the program ended successfully or not.
+ * A value of 0 indicates the program ended succesfully, while a non-zero value indicates
+ * something wrong happened during execution.
+ */
+int main(int argc, char* argv[])
+{
+	// Bake a text level description into the binary level format without starting the game
+	if (argc == 4 && std::string(argv[1]) == "--bake-level")
+	{
+		return BakeLevel(argv[2], argv[3]) ? 0 : 1;
+	}
+
+	// Bake images into compressed textures with pre-filtered mip chains
+	if (argc >= 4 && std::string(argv[1]) == "--bake-texture" && (std::string(argv[2]) == "repeat" || std::string(argv[2]) == "clamp"))
+	{
+		return BakeTextures(std::vector<std::string>(argv + 3, argv + argc), std::string(argv[2]) == "repeat") ? 0 : 1;
+	}
+
+	RenderSettings settings;
+	if (!ParseRenderSettings(argc, argv, settings))
+	{
+		std::cerr << "Usage: " << argv[0] << " [--shadow-size <texels>] [--shadow-depth <16|24|32>] [--shadow-cascades <1-4>] [--shadow-filter-taps <0-16>] [--anisotropy <1-16>] [--gpu-culling <0|1>] [--stats <0|1>]" << std::endl;
+		return 1;
+	}
+
+	// Initialize GLFW
+	int glfwInitStatus = glfwInit();
+	if (glfwInitStatus == GLFW_FALSE)
+	{
+		std::cerr << "Failed to initialize GLFW!" << std::endl;
+		return 1;
+	}
+
+	// Tell GLFW that we prefer to use OpenGL 3.3
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+
+	// Tell GLFW that we prefer to use the modern OpenGL
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GLFW_TRUE);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+	// Tell GLFW to create a window
+	int windowWidth = 800;
+	int windowHeight = 800;
+	GLFWwindow* window = glfwCreateWindow(windowWidth, windowHeight, "Final Project - Horror game", nullptr, nullptr);
+	if (window == nullptr)
+	{
+		std::cerr << "Failed to create GLFW window!" << std::endl;
+		glfwTerminate();
+		return 1;
+	}
+
+	// Tell GLFW to use the OpenGL context that was assigned to the window that we just created
+	glfwMakeContextCurrent(window);
+
+	// Register the callback function that handles when the framebuffer size has changed
+	glfwSetFramebufferSizeCallback(window, FramebufferSizeChangedCallback);
+
+	// Tell GLAD to load the OpenGL function pointers
+	if (!gladLoadGLLoader(reinterpret_cast<GLADloadproc>(glfwGetProcAddress)))
+	{
+		std::cerr << "Failed to initialize GLAD!" << std::endl;
+		return 1;
+	}
+
+	// Load the maze. Wall tile transforms and hitboxes come straight from the mapped level file.
+	Level level;
+	if (!LoadLevel("maze.lvl", level))
+	{
+		std::cerr << "Failed to load level!" << std::endl;
+		glfwTerminate();
+		return 1;
+	}
+
+	const LevelHeader& levelHeader = *level.header;
+
+	// --- Vertex specification ---
+
+	// Static mesh: adjacent coplanar wall tiles are merged into long quads, pre-transformed into world space
+	std::vector<Vertex> staticVertices;
+	std::vector<GLuint> staticIndices;
+	BuildWallMesh(level, staticVertices, staticIndices);
+
+	// Nearby quads are grouped so that whole groups hidden behind other walls can be skipped
+	std::vector<WallCluster> wallClusters;
+	std::vector<DrawList> visibleClusterWalls;
+	BuildWallClusters(staticVertices, staticIndices, WALL_CLUSTER_SIZE, wallClusters);
+
+	// Bounding boxes for culling the wall quads against the camera
+	WallBounds wallBounds;
+	BuildWallBounds(staticVertices, wallBounds);
+	DrawList visibleWalls;
+
+	// Every quad, for when the camera isn't in a cell of the potentially visible set
+	std::vector<GLuint> allWallQuads(wallBounds.count);
+	for (size_t i = 0; i < allWallQuads.size(); ++i)
+	{
+		allWallQuads[i] = static_cast<GLuint>(i);
+	}
+
+	// Potentially visible set baked into the level, so only walls that can be seen from the camera's cell are considered
+	Pvs pvs;
+	bool hasPvs = LoadPvs(level, wallBounds.count, pvs);
+
+	// The floor goes after the wall clusters, in the same buffers and texture array, so it is drawn along with the walls.
+	// It is never culled, so it is always in the first draw.
+	DrawList floorRange;
+	floorRange.counts.push_back(6);
+	floorRange.offsets.push_back(reinterpret_cast<const void*>(staticIndices.size() * sizeof(GLuint)));
+	AppendFloorQuad(level, staticVertices, staticIndices);
+	GLsizei staticIndexCount = static_cast<GLsizei>(staticIndices.size());
+	DrawList staticBatch;
+
+	glm::vec3 skybox[36];
+	skybox[0] = { -1.0f,  1.0f, -1.0f };
+	skybox[1] = { -1.0f, -1.0f, -1.0f };
+	skybox[2] = { 1.0f, -1.0f, -1.0f };
+	skybox[3] = { 1.0f, -1.0f, -1.0f };
+	skybox[4] = { 1.0f,  1.0f, -1.0f };
+	skybox[5] = { -1.0f,  1.0f, -1.0f };
+
+	skybox[6] = { -1.0f, -1.0f,  1.0f };
+	skybox[7] = { -1.0f, -1.0f, -1.0f };
+	skybox[8] = { -1.0f,  1.0f, -1.0f };
+	skybox[9] = { -1.0f,  1.0f, -1.0f };
+	skybox[10] = { -1.0f,  1.0f,  1.0f };
+	skybox[11] = { -1.0f, -1.0f,  1.0f };
+
+	skybox[12] = { 1.0f, -1.0f, -1.0f };
+	skybox[13] = { 1.0f, -1.0f,  1.0f };
+	skybox[14] = { 1.0f,  1.0f,  1.0f };
+	skybox[15] = { 1.0f,  1.0f,  1.0f };
+	skybox[16] = { 1.0f,  1.0f, -1.0f };
+	skybox[17] = { 1.0f, -1.0f, -1.0f };
+
+	skybox[18] = { -1.0f, -1.0f,  1.0f };
+	skybox[19] = { -1.0f,  1.0f,  1.0f };
+	skybox[20] = { 1.0f,  1.0f,  1.0f };
+	skybox[21] = { 1.0f,  1.0f,  1.0f };
+	skybox[22] = { 1.0f, -1.0f,  1.0f };
+	skybox[23] = { -1.0f, -1.0f,  1.0f };
+
+	skybox[24] = { -1.0f,  1.0f, -1.0f };
+	skybox[25] = { 1.0f,  1.0f, -1.0f };
+	skybox[26] = { 1.0f,  1.0f,  1.0f };
+	skybox[27] = { 1.0f,  1.0f,  1.0f };
+	skybox[28] = { -1.0f,  1.0f,  1.0f };
+	skybox[29] = { -1.0f,  1.0f, -1.0f };
+
+	skybox[30] = { -1.0f, -1.0f, -1.0f };
+	skybox[31] = { -1.0f, -1.0f,  1.0f };
+	skybox[32] = { 1.0f, -1.0f, -1.0f };
+	skybox[33] = { 1.0f, -1.0f, -1.0f };
+	skybox[34] = { -1.0f, -1.0f,  1.0f };
+	skybox[35] = { 1.0f, -1.0f,  1.0f };
+
+	// Unit cube that is stretched over a wall cluster's bounding box for occlusion queries
+	glm::vec3 occlusionBox[8] = {
+		{ 0.0f, 0.0f, 0.0f }, { 1.0f, 0.0f, 0.0f }, { 1.0f, 1.0f, 0.0f }, { 0.0f, 1.0f, 0.0f },
+		{ 0.0f, 0.0f, 1.0f }, { 1.0f, 0.0f, 1.0f }, { 1.0f, 1.0f, 1.0f }, { 0.0f, 1.0f, 1.0f }
+	};
+	GLubyte occlusionBoxIndices[36] = {
+		0, 1, 2, 2, 3, 0,	// -Z
+		5, 4, 7, 7, 6, 5,	// +Z
+		4, 0, 3, 3, 7, 4,	// -X
+		1, 5, 6, 6, 2, 1,	// +X
+		4, 5, 1, 1, 0, 4,	// -Y
+		3, 2, 6, 6, 7, 3	// +Y
+	};
+
+	// Create a vertex buffer object (VBO), and upload our vertices data to the VBO
+
+	// The static mesh is split into two streams: positions, which every pass reads, and the other attributes,
+	// which only the colour pass reads
+	std::vector<glm::vec3> staticPositions;
+	std::vector<PackedVertex> staticPackedVertices;
+	PackVertices(staticVertices, staticPositions, staticPackedVertices);
+
+	GLuint staticPositionVbo;
+	glGenBuffers(1, &staticPositionVbo);
+	glBindBuffer(GL_ARRAY_BUFFER, staticPositionVbo);
+	glBufferData(GL_ARRAY_BUFFER, staticPositions.size() * sizeof(glm::vec3), staticPositions.data(), GL_STATIC_DRAW);
+
+	GLuint staticAttributeVbo;
+	glGenBuffers(1, &staticAttributeVbo);
+	glBindBuffer(GL_ARRAY_BUFFER, staticAttributeVbo);
+	glBufferData(GL_ARRAY_BUFFER, staticPackedVertices.size() * sizeof(PackedVertex), staticPackedVertices.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	GLuint staticEbo;
+	glGenBuffers(1, &staticEbo);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, staticEbo);
+	glBufferData(GL_COPY_WRITE_BUFFER, staticIndices.size() * sizeof(GLuint), staticIndices.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	
+	GLuint skyboxVbo;
+	glGenBuffers(1, &skyboxVbo);
+	glBindBuffer(GL_ARRAY_BUFFER, skyboxVbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(skybox), skybox, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	// Create a vertex array object that contains data on how to map vertex attributes
+	// (e.g., position, color) to vertex shader properties.
+
+	// walls and floor
+	GLuint staticVao;
+	glGenVertexArrays(1, &staticVao);
+	SetupStaticMeshAttributes(staticVao, staticEbo, staticPositionVbo, staticAttributeVbo);
+
+	// Skybox
+	GLuint skyboxVao;
+	glGenVertexArrays(1, &skyboxVao);
+	glBindVertexArray(skyboxVao);
+	glBindBuffer(GL_ARRAY_BUFFER, skyboxVbo);
+
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+	glBindVertexArray(0);
+
+	// Occlusion query box
+	GLuint occlusionBoxVbo;
+	glGenBuffers(1, &occlusionBoxVbo);
+	glBindBuffer(GL_ARRAY_BUFFER, occlusionBoxVbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(occlusionBox), occlusionBox, GL_STATIC_DRAW);
+
+	GLuint occlusionBoxEbo;
+	glGenBuffers(1, &occlusionBoxEbo);
+
+	GLuint occlusionBoxVao;
+	glGenVertexArrays(1, &occlusionBoxVao);
+	glBindVertexArray(occlusionBoxVao);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, occlusionBoxEbo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(occlusionBoxIndices), occlusionBoxIndices, GL_STATIC_DRAW);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	// Per-instance transforms, with the normal matrices worked out here once instead of per vertex.
+	// The static mesh is already in world space, so it is drawn as a single identity instance.
+	InstanceData staticInstance = MakeInstanceData(glm::mat4(1.0f));
+	GLuint staticInstanceVbo;
+	glGenBuffers(1, &staticInstanceVbo);
+	glBindBuffer(GL_ARRAY_BUFFER, staticInstanceVbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(InstanceData), &staticInstance, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	SetupInstanceAttributes(staticVao, staticInstanceVbo);
+
+	// Position-only version of the static mesh's vertex array object for the shadow pass and the depth pre-pass
+	GLuint staticDepthVao;
+	glGenVertexArrays(1, &staticDepthVao);
+	SetupStaticMeshAttributes(staticDepthVao, staticEbo, staticPositionVbo, 0);
+	SetupInstanceAttributes(staticDepthVao, staticInstanceVbo);
+
+	// With OpenGL 4.3 the wall quads are culled by a compute shader instead, which writes the visible quads' indices
+	// and the draw commands straight into GPU buffers. The colour pass and the depth pre-pass draw them through
+	// their own vertex array objects, while the shadow pass keeps drawing every wall from staticDepthVao.
+	GpuWallCulling gpuCulling;
+#ifdef GL_VERSION_4_3
+	if (settings.gpuCulling && GLAD_GL_VERSION_4_3)
+	{
+		CreateGpuWallCulling(wallBounds, wallClusters, hasPvs ? pvs : Pvs(), staticIndices, gpuCulling);
+
+		glGenVertexArrays(1, &gpuCulling.vao);
+		SetupStaticMeshAttributes(gpuCulling.vao, gpuCulling.indexBuffer, staticPositionVbo, staticAttributeVbo);
+		SetupInstanceAttributes(gpuCulling.vao, staticInstanceVbo);
+
+		glGenVertexArrays(1, &gpuCulling.depthVao);
+		SetupStaticMeshAttributes(gpuCulling.depthVao, gpuCulling.indexBuffer, staticPositionVbo, 0);
+		SetupInstanceAttributes(gpuCulling.depthVao, staticInstanceVbo);
+		gpuCulling.enabled = true;
+	}
+#endif
+
+	// FRAMEBUFFERS
+	//
+	//
+	GLuint fbo;
+	glGenFramebuffers(1, &fbo);
+
+	GLint maxTextureSize;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+	int shadowMapSize = std::min(settings.shadowMapSize, static_cast<int>(maxTextureSize));
+	if (shadowMapSize != settings.shadowMapSize)
+	{
+		std::cerr << "Shadow map size " << settings.shadowMapSize << " is not supported, using " << shadowMapSize << std::endl;
+	}
+
+	GLenum shadowInternalFormat = GL_DEPTH_COMPONENT24;
+	GLenum shadowDataType = GL_UNSIGNED_INT;
+	if (settings.shadowDepthBits == 16)
+	{
+		shadowInternalFormat = GL_DEPTH_COMPONENT16;
+		shadowDataType = GL_UNSIGNED_SHORT;
+	}
+	else if (settings.shadowDepthBits == 32)
+	{
+		shadowInternalFormat = GL_DEPTH_COMPONENT32F;
+		shadowDataType = GL_FLOAT;
+	}
+
+	// One layer per shadow cascade
+	int cascadeCount = settings.shadowCascades;
+
+	GLuint fboTex;
+	glGenTextures(1, &fboTex);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, fboTex);
+
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, shadowInternalFormat, shadowMapSize, shadowMapSize, cascadeCount, 0, GL_DEPTH_COMPONENT, shadowDataType, nullptr);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	// Let the sampler do the depth comparison, so linear filtering blends the results of 2x2 comparisons
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, fboTex, 0, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		std::cout << "Error! Framebuffer not complete!" << std::endl;
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	// main.fsh is built in permutations that only contain the lighting they use. The settings and the level pick
+	// the shadow cascades and filter and whether there are local lights, and there is one variant with the flashlight and one without.
+	bool shadows = settings.shadowFilterTaps > 0;
+	std::string mainDefines = ShaderDefine("SHADOWS", shadows ? 1 : 0)
+		+ ShaderDefine("SHADOW_CASCADES", cascadeCount)
+		+ ShaderDefine("SHADOW_FILTER_TAPS", std::max(settings.shadowFilterTaps, 1))
+		+ ShaderDefine("LOCAL_LIGHT_COUNT", static_cast<int>(levelHeader.lightCount));
+
+	// Create the shader programs. Linked programs are kept in ShaderCache.bin, so only the first run has to compile them.
+	ShaderCache shaderCache;
+	LoadShaderCache("ShaderCache.bin", shaderCache);
+	std::vector<ShaderProgramSource> shaderSources = {
+		{ "main.vsh", "main.fsh", mainDefines + ShaderDefine("LIGHT_ON", 0) },
+		{ "main.vsh", "main.fsh", mainDefines + ShaderDefine("LIGHT_ON", 1) },
+		{ "depthShader.vsh", "depthShader.fsh" },
+		{ "skyboxShader.vsh", "skyboxShader.fsh" },
+		{ "occlusionShader.vsh", "occlusionShader.fsh" },
+		{ "prepassShader.vsh", "depthShader.fsh" }
+	};
+	if (gpuCulling.enabled)
+	{
+		ShaderProgramSource cullingSource;
+		cullingSource.computeShaderFilePath = "cullingShader.csh";
+		shaderSources.push_back(cullingSource);
+	}
+	std::vector<ShaderProgram> shaderPrograms = CreateShaderPrograms(shaderCache, shaderSources);
+	SaveShaderCache(shaderCache);
+
+	// The main program variants, indexed by whether the flashlight is on
+	ShaderProgram mainPrograms[2] = { shaderPrograms[0], shaderPrograms[1] };
+	ShaderProgram depthshaders = shaderPrograms[2];
+	ShaderProgram skyboxshaders = shaderPrograms[3];
+	ShaderProgram occlusionshaders = shaderPrograms[4];
+	ShaderProgram prepassshaders = shaderPrograms[5];
+	if (gpuCulling.enabled)
+	{
+		gpuCulling.program = shaderPrograms[6];
+		gpuCulling.firstCandidateUniform = GetUniform<GLint>(gpuCulling.program, "firstCandidate");
+		gpuCulling.candidateCountUniform = GetUniform<GLint>(gpuCulling.program, "candidateCount");
+		BindUniformBlock(gpuCulling.program, "FrameUniforms", FRAME_UNIFORMS_BINDING);
+
+		GLint linkStatus = GL_FALSE;
+		glGetProgramiv(gpuCulling.program.id, GL_LINK_STATUS, &linkStatus);
+		if (linkStatus != GL_TRUE)
+		{
+			std::cerr << "Culling shader failed to build, culling walls on the CPU instead" << std::endl;
+			DeleteGpuWallCulling(gpuCulling);
+		}
+	}
+
+	// Camera and light matrices live in one uniform buffer shared by all the programs
+	BindUniformBlock(mainPrograms[0], "FrameUniforms", FRAME_UNIFORMS_BINDING);
+	BindUniformBlock(mainPrograms[1], "FrameUniforms", FRAME_UNIFORMS_BINDING);
+	BindUniformBlock(depthshaders, "FrameUniforms", FRAME_UNIFORMS_BINDING);
+	BindUniformBlock(skyboxshaders, "FrameUniforms", FRAME_UNIFORMS_BINDING);
+	BindUniformBlock(occlusionshaders, "FrameUniforms", FRAME_UNIFORMS_BINDING);
+	BindUniformBlock(prepassshaders, "FrameUniforms", FRAME_UNIFORMS_BINDING);
+
+	// Everything that changes every frame is written to frameStream: the light data, cluster ranges and light indices,
+	// then the frame uniforms. Each region is big enough for the worst case, where every light reaches every cluster.
+	const GLsizeiptr lightClusterCount = LIGHT_CLUSTERS_X * LIGHT_CLUSTERS_Y * LIGHT_CLUSTERS_Z;
+	const GLenum lightBufferFormats[LIGHT_BUFFER_COUNT] = { GL_RGBA32F, GL_RG32UI, GL_R32UI };
+	const GLsizeiptr lightBufferTexelSizes[LIGHT_BUFFER_COUNT] = { sizeof(glm::vec4), 2 * sizeof(GLuint), sizeof(GLuint) };
+	const GLsizeiptr lightBufferSizes[LIGHT_BUFFER_COUNT] = {
+		static_cast<GLsizeiptr>(levelHeader.lightCount * 3 * sizeof(glm::vec4)),
+		static_cast<GLsizeiptr>(lightClusterCount * 2 * sizeof(GLuint)),
+		static_cast<GLsizeiptr>(lightClusterCount * levelHeader.lightCount * sizeof(GLuint))
+	};
+
+	GLint uniformBufferAlignment = 0;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformBufferAlignment);
+	GLsizeiptr frameStreamAlignment = std::max<GLsizeiptr>(uniformBufferAlignment, sizeof(glm::vec4));
+	GLsizeiptr frameStreamSize = 4 * frameStreamAlignment + sizeof(FrameUniforms)
+		+ lightBufferSizes[0] + lightBufferSizes[1] + lightBufferSizes[2];
+
+	// The buffer textures can only span the whole ring if it has few enough texels. Otherwise each one is pointed
+	// at just this frame's data, which needs texture buffer ranges, or else the lights go to buffers of their own.
+	GLint maxTextureBufferSize = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTextureBufferSize);
+	LightBufferMode lightBufferMode = LIGHT_BUFFERS_WHOLE_STREAM;
+	if (STREAM_BUFFER_FRAMES * frameStreamSize / static_cast<GLsizeiptr>(sizeof(GLuint)) > maxTextureBufferSize)
+	{
+		lightBufferMode = LIGHT_BUFFERS_PER_FRAME;
+#ifdef GL_ARB_texture_buffer_range
+		if (GLAD_GL_ARB_texture_buffer_range || GLAD_GL_VERSION_4_3)
+		{
+			// Every write to frameStream must then start where a texture buffer range may start
+			GLint textureBufferAlignment = 0;
+			glGetIntegerv(GL_TEXTURE_BUFFER_OFFSET_ALIGNMENT, &textureBufferAlignment);
+			frameStreamAlignment = std::max<GLsizeiptr>(frameStreamAlignment, textureBufferAlignment);
+			frameStreamSize = 4 * frameStreamAlignment + sizeof(FrameUniforms)
+				+ lightBufferSizes[0] + lightBufferSizes[1] + lightBufferSizes[2];
+			lightBufferMode = LIGHT_BUFFERS_RANGES;
+		}
+#endif
+		if (lightBufferMode == LIGHT_BUFFERS_PER_FRAME)
+		{
+			frameStreamSize = frameStreamAlignment + sizeof(FrameUniforms);
+		}
+	}
+	for (int i = 0; i < LIGHT_BUFFER_COUNT; ++i)
+	{
+		if (lightBufferSizes[i] / lightBufferTexelSizes[i] > maxTextureBufferSize)
+		{
+			std::cerr << "The level has too many lights for a buffer texture of " << maxTextureBufferSize
+				<< " texels, so some clusters will miss lights" << std::endl;
+			break;
+		}
+	}
+
+	StreamBuffer frameStream;
+	CreateStreamBuffer(frameStream, frameStreamSize, frameStreamAlignment);
+
+	// What each layer of fboTex currently holds. They start invalid so the first frame renders every cascade.
+	ShadowCache shadowCaches[MAX_SHADOW_CASCADES];
+
+	Uniform<GLint> cascadeIndexUniform = GetUniform<GLint>(depthshaders, "cascadeIndex");
+
+	Uniform<glm::vec3> boxMinUniform = GetUniform<glm::vec3>(occlusionshaders, "boxMin");
+	Uniform<glm::vec3> boxMaxUniform = GetUniform<glm::vec3>(occlusionshaders, "boxMax");
+
+	// Two sets of occlusion queries, one per cluster in each. A frame draws with the results of the set issued
+	// the frame before while it issues the other set, so it never waits on the GPU for a result.
+	std::vector<GLuint> occlusionQueries(wallClusters.size() * 2);
+	glGenQueries(static_cast<GLsizei>(occlusionQueries.size()), occlusionQueries.data());
+	std::vector<char> occlusionQueryIssued(occlusionQueries.size(), 0);
+	size_t occlusionQuerySet = 0;
+
+	// GPU timers for the floor and walls. They alternate, so each result has had a whole frame to arrive before it is read.
+	GLuint mainPassTimers[2];
+	glGenQueries(2, mainPassTimers);
+	bool mainPassTimerIssued[2] = { false, false };
+	size_t mainPassTimer = 0;
+	GLuint64 mainPassGpuTime = 0;
+	size_t mainPassTimedFrames = 0;
+
+	// The light never moves, so its view is computed once.
+	// The cascades are fitted inside the level's bounds, so no shadow texels are spent outside the maze.
+	glm::vec3 lightPosition = glm::vec3(-2.0f, 5.0f, 5.0f);
+	glm::mat4 lightView = glm::lookAt(lightPosition, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+	glm::vec3 levelBoundsMin, levelBoundsMax;
+	GetLevelBounds(level, levelBoundsMin, levelBoundsMax);
+
+	glm::vec3 levelLightMin, levelLightMax;
+	TransformBounds(lightView, levelBoundsMin, levelBoundsMax, levelLightMin, levelLightMax);
+
+	// Culling statistics, reported once per second
+	double cullingTime = 0.0;
+	size_t culledFrames = 0;
+	size_t visibleQuadTotal = 0;
+	size_t clusteredLightTotal = 0;
+	double lightClusteringTime = 0.0;
+	double cullingReportTime = glfwGetTime();
+
+	const float cameraFieldOfView = glm::radians(90.0f);
+	const float cameraNear = 0.1f;
+	const float cameraFar = 100.0f;
+
+	// Uniforms of a main program variant that the render loop sets
+	struct MainProgramUniforms
+	{
+		Uniform<glm::vec3> cameraPosition;
+		Uniform<glm::vec3> spotLightPosition;
+		Uniform<glm::vec3> spotLightDirection;
+		Uniform<glm::vec3> clusterScale;
+	};
+
+	// Resolve every uniform the render loop uses once, so the loop does no lookups by name.
+	// Each variant only has the uniforms of the lighting compiled into it.
+	bool localLights = levelHeader.lightCount > 0;
+	MainProgramUniforms mainUniforms[2];
+	for (int variant = 0; variant < 2; ++variant)
+	{
+		const ShaderProgram& program = mainPrograms[variant];
+		bool flashlight = variant == 1;
+
+		mainUniforms[variant].cameraPosition = GetUniform<glm::vec3>(program, "cameraPosition");
+		if (flashlight)
+		{
+			mainUniforms[variant].spotLightPosition = GetUniform<glm::vec3>(program, "spotLightPosition");
+			mainUniforms[variant].spotLightDirection = GetUniform<glm::vec3>(program, "spotLightDirection");
+		}
+		if (localLights)
+		{
+			mainUniforms[variant].clusterScale = GetUniform<glm::vec3>(program, "clusterScale");
+		}
+
+		// These never change, so they are set once here instead of every frame
+		glUseProgram(program.id);
+
+		if (shadows)
+		{
+			SetUniform(GetUniform<GLint>(program, "shadowMap"), 0);
+		}
+		SetUniform(GetUniform<GLint>(program, "tex"), 1);
+		if (localLights)
+		{
+			SetUniform(GetUniform<GLint>(program, "lightData"), 2);
+			SetUniform(GetUniform<GLint>(program, "lightClusters"), 3);
+			SetUniform(GetUniform<GLint>(program, "lightIndices"), 4);
+			SetUniform(GetUniform<GLfloat>(program, "clusterNear"), cameraNear);
+		}
+
+		SetUniform(GetUniform<glm::vec3>(program, "objectSpec"), glm::vec3(0.2f, 0.2f, 0.2f));
+		SetUniform(GetUniform<GLfloat>(program, "objectShine"), 50.f);
+		SetUniform(GetUniform<glm::vec3>(program, "directionalLightDirection"), glm::vec3(-0.25f, -1.0f, -0.25f));
+
+		SetUniform(GetUniform<glm::vec3>(program, "lightAmbient"), glm::vec3(0.75f, 0.75f, 0.75f));
+		SetUniform(GetUniform<glm::vec3>(program, "lightDiffuse"), glm::vec3(0.75f, 0.75f, 0.75f));
+		SetUniform(GetUniform<glm::vec3>(program, "lightSpecular"), glm::vec3(0.75f, 0.75f, 0.75f));
+
+		SetUniform(GetUniform<glm::vec3>(program, "sLightAmbient"), glm::vec3(1.0f, 1.0f, 1.0f));
+		if (flashlight)
+		{
+			SetUniform(GetUniform<glm::vec3>(program, "sLightDiffuse"), glm::vec3(1.0f, 1.0f, 1.0f));
+			SetUniform(GetUniform<glm::vec3>(program, "sLightSpecular"), glm::vec3(1.0f, 1.0f, 1.0f));
+
+			// sLightConstant is never set, so the flashlight falloff uses its default of 0
+			SetUniform(GetUniform<GLfloat>(program, "sLightLinear"), 0.35f);
+			SetUniform(GetUniform<GLfloat>(program, "sLightQuadratic"), 0.44f);
+		}
+	}
+
+	glUseProgram(0);
+
+	// Clustered local lights. Every frame the lights are binned into clusters on the CPU, and the light data,
+	// each cluster's range of light indices and the indices themselves are written out for main.fsh,
+	// which reads them through buffer textures. See LightBufferMode for where they are written.
+	LightClusterGrid lightClusterGrid;
+	LightClusters lightClusters;
+	GLfloat lightClusterAspectRatio = 0.0f;
+
+	GLuint lightBufferTextures[LIGHT_BUFFER_COUNT];
+	glGenTextures(LIGHT_BUFFER_COUNT, lightBufferTextures);
+	GLuint lightBuffers[STREAM_BUFFER_FRAMES][LIGHT_BUFFER_COUNT] = {};
+	if (lightBufferMode == LIGHT_BUFFERS_PER_FRAME)
+	{
+		glGenBuffers(STREAM_BUFFER_FRAMES * LIGHT_BUFFER_COUNT, &lightBuffers[0][0]);
+		for (int frame = 0; frame < STREAM_BUFFER_FRAMES; ++frame)
+		{
+			for (int i = 0; i < LIGHT_BUFFER_COUNT; ++i)
+			{
+				glBindBuffer(GL_TEXTURE_BUFFER, lightBuffers[frame][i]);
+				glBufferData(GL_TEXTURE_BUFFER, lightBufferSizes[i], nullptr, GL_STREAM_DRAW);
+			}
+		}
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	}
+	else if (lightBufferMode == LIGHT_BUFFERS_WHOLE_STREAM)
+	{
+		for (int i = 0; i < LIGHT_BUFFER_COUNT; ++i)
+		{
+			glBindTexture(GL_TEXTURE_BUFFER, lightBufferTextures[i]);
+			glTexBuffer(GL_TEXTURE_BUFFER, lightBufferFormats[i], frameStream.buffer);
+		}
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+	}
+
+	// Tell OpenGL the dimensions of the region where stuff will be drawn.
+	// For now, tell OpenGL to use the whole screen
+	glViewport(0, 0, windowWidth, windowHeight);
+
+
+	// Textures are cached next to their images as BC1-compressed KTX files with their mip chains (see LoadTextureImage),
+	// so they load without any decoding or filtering work. Drivers without S3TC get uncompressed textures instead.
+	bool compressTextures = false;
+#ifdef GL_EXT_texture_compression_s3tc
+	compressTextures = GLAD_GL_EXT_texture_compression_s3tc != 0;
+#endif
+
+	// The images are loaded on worker threads while the game starts, so rendering doesn't wait for them.
+	// Each texture is a single-colour placeholder until all of its images are loaded, then they are streamed in
+	// through texturePixelBuffer at the start of a frame.
+	TextureLoader textureLoader;
+	textureLoader.compress = compressTextures;
+	std::vector<PendingTexture> pendingTextures;
+
+	// The wall and floor textures are sampled trilinearly with anisotropic filtering.
+	// They share one texture array, one layer per SurfaceMaterial, which stays bound to texture unit 1.
+	const char* surfaceTextureFiles[MATERIAL_COUNT] = {
+		"BrickWallTex.jpg",	// MATERIAL_BRICK_WALL
+		"BrownTileTex.jpg"	// MATERIAL_BROWN_TILE
+	};
+	const GLubyte surfacePlaceholder[3] = { 110, 90, 75 };
+	GLuint surfaceTextures = CreatePlaceholderTexture(GL_TEXTURE_2D_ARRAY, MATERIAL_COUNT, surfacePlaceholder);
+	PendingTexture pendingSurfaces = { surfaceTextures, GL_TEXTURE_2D_ARRAY, {}, settings.anisotropy };
+	for (int i = 0; i < MATERIAL_COUNT; i++)
+	{
+		pendingSurfaces.requests.push_back(RequestTextureImage(textureLoader, surfaceTextureFiles[i], true));
+	}
+	pendingTextures.push_back(pendingSurfaces);
+
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, surfaceTextures);
+	glActiveTexture(GL_TEXTURE0);
+
+	
+	// Skybox textures code
+	std::vector<std::string> skyboxFaces{
+		"night2.jpg",
+		"night2.jpg",
+		"nightmoon.jpg",
+		"night2.jpg",
+		"night4.jpg",
+		"night4.jpg"
+	};
+
+	// Faces that share an image only load it once
+	const GLubyte skyboxPlaceholder[3] = { 10, 12, 24 };
+	GLuint skyboxTexture = CreatePlaceholderTexture(GL_TEXTURE_CUBE_MAP, 6, skyboxPlaceholder);
+	PendingTexture pendingSkybox = { skyboxTexture, GL_TEXTURE_CUBE_MAP, {}, 1 };
+	for (unsigned int i = 0; i < skyboxFaces.size(); i++)
+	{
+		pendingSkybox.requests.push_back(RequestTextureImage(textureLoader, skyboxFaces[i], false));
+	}
+	pendingTextures.push_back(pendingSkybox);
+
+	StartTextureLoader(textureLoader);
+
+	GLuint texturePixelBuffer;
+	glGenBuffers(1, &texturePixelBuffer);
+
+	//
+	// Skybox code - end
+
+	glEnable(GL_DEPTH_TEST);
+
+	glm::vec3 cameraPosition = glm::vec3(0.0f, 0.5f, 0.0f);
+	glm::vec3 cameraTarget = glm::vec3(0.0f, 0.5f, -3.0f);
+	glm::vec3 cameraUp = glm::vec3(0.0f, 1.0f, 0.0f);
+
+	GLfloat angleX = M_PI;
+	GLfloat angleY = 0.0f;
+
+	if (levelHeader.spawnCount > 0)
+	{
+		cameraPosition = glm::vec3(level.spawns[0].x, level.spawns[0].y, level.spawns[0].z);
+		angleX = glm::radians(level.spawns[0].yaw);
+	}
+
+	GLfloat camSpeed = 0.5f;
+	GLfloat mouseSpeed = 0.25f;
+
+	GLfloat prevTime = glfwGetTime();
+
+	GLdouble xpos, ypos;
+
+	int forwardInput = glfwGetKey(window, GLFW_KEY_W);
+	int backwardInput = glfwGetKey(window, GLFW_KEY_S);
+	int leftInput = glfwGetKey(window, GLFW_KEY_A);
+	int rightInput = glfwGetKey(window, GLFW_KEY_D);
+
+	SoundEngine->play2D("Thesis Game.mp3", true);
+	SoundEngine->setSoundVolume(0.05f);
+	sfx = sfxEngine->play2D("FootStep.mp3", false, false, true);
+	sfxEngine->setSoundVolume(0.25f);
+
+	
+
+	glfwSetKeyCallback(window, key_callback);
+
+	// Render loop
+	while (!glfwWindowShouldClose(window))
+	{
+		GLfloat time = glfwGetTime();
+		GLfloat deltaTime = time - prevTime;
+
+		// Swap in at most one loaded texture per frame, so the uploads are spread out instead of stalling a single frame
+		for (size_t i = 0; i < pendingTextures.size(); i++)
+		{
+			if (UpdatePendingTexture(textureLoader, pendingTextures[i], texturePixelBuffer))
+			{
+				pendingTextures.erase(pendingTextures.begin() + i);
+				break;
+			}
+		}
+		if (pendingTextures.empty() && !textureLoader.requests.empty())
+		{
+			StopTextureLoader(textureLoader);
+		}
+		prevTime = time;
+
+		glfwGetCursorPos(window, &xpos, &ypos);
+		glfwSetCursorPos(window, (double)windowWidth / 2, (double)windowHeight / 2);
+		glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+
+		angleX += mouseSpeed * deltaTime * float(windowWidth / 2 - xpos);
+		angleY += mouseSpeed * deltaTime * float(windowHeight / 2 - ypos);
+
+		if (angleY * (180/M_PI) > 89) { angleY = 89 * (M_PI/180); }
+		if (angleY * (180/M_PI) < -89) { angleY = -89 * (M_PI / 180); }
+		glm::vec3 cameraTarget(cos(angleY) * sin(angleX), sin(angleY), cos(angleY) * cos(angleX));
+		glm::vec3 right(sin(angleX - M_PI / 2.0f), 0.0f, cos(angleX - M_PI / 2.0f));
+		glm::vec3 cameraUp = glm::cross(right, cameraTarget);
+
+		glm::vec3 upcomingCameraPosition = cameraPosition;
+
+
+		if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
+		{
+			upcomingCameraPosition += camSpeed * deltaTime * glm::normalize(glm::vec3(cameraTarget.x, 0.0f, cameraTarget.z));
+
+			if (checkCollision(upcomingCameraPosition, level) == false)
+			{
+				if (glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS)
+				{
+					cameraPosition += (camSpeed + 0.25f) * deltaTime * glm::normalize(glm::vec3(cameraTarget.x, 0.0f, cameraTarget.z));
+				}
+				else
+				{
+					cameraPosition += camSpeed * deltaTime * glm::normalize(glm::vec3(cameraTarget.x, 0.0f, cameraTarget.z));
+				}
+				
+			}
+			else
+			{
+				if (collidedWall.isXWall())
+				{
+					cameraPosition += camSpeed * deltaTime * glm::normalize(glm::vec3(0.0f, 0.0f, cameraTarget.z));
+				}
+				else if (collidedWall.isZWall())
+				{
+					cameraPosition += camSpeed * deltaTime * glm::normalize(glm::vec3(cameraTarget.x, 0.0f, 0.0f));
+				}
+			}
+
+			if (sfx->isFinished())
+			{
+				sfx = sfxEngine->play2D("FootStep.mp3", false, false, true);
+			}
+			
+		}
+		if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
+		{
+			upcomingCameraPosition -= camSpeed * deltaTime * glm::normalize(glm::vec3(cameraTarget.x, 0.0f, cameraTarget.z));
+
+			if (checkCollision(upcomingCameraPosition, level) == false)
+			{
+				cameraPosition -= camSpeed * deltaTime * glm::normalize(glm::vec3(cameraTarget.x, 0.0f, cameraTarget.z));
+			}
+			else
+			{
+				if (collidedWall.isXWall())
+				{
+					cameraPosition -= camSpeed * deltaTime * glm::normalize(glm::vec3(0.0f, 0.0f, cameraTarget.z));
+				}
+				else if (collidedWall.isZWall())
+				{
+					cameraPosition -= camSpeed * deltaTime * glm::normalize(glm::vec3(cameraTarget.x, 0.0f, 0.0f));
+				}
+			}
+			if (sfx->isFinished())
+			{
+				sfx = sfxEngine->play2D("FootStep.mp3", false, false, true);
+			}
+		}
+		if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
+		{
+			upcomingCameraPosition -= camSpeed * right * deltaTime;
+
+			if (checkCollision(upcomingCameraPosition, level) == false)
+			{
+				cameraPosition -= camSpeed * right * deltaTime;
+			}
+			else
+			{
+				if (collidedWall.isXWall())
+				{
+					cameraPosition -= camSpeed * deltaTime * glm::normalize(glm::vec3(0.0f, 0.0f, right.z));
+				}
+				else if (collidedWall.isZWall())
+				{
+					cameraPosition -= camSpeed * deltaTime * glm::normalize(glm::vec3(right.x, 0.0f, 0.0f));
+				}
+			}
+			if (sfx->isFinished())
+			{
+				sfx = sfxEngine->play2D("FootStep.mp3", false, false, true);
+			}
+		}
+		if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
+		{
+			upcomingCameraPosition += camSpeed * right * deltaTime;
+
+			if (checkCollision(upcomingCameraPosition, level) == false)
+			{
+				cameraPosition += camSpeed * right * deltaTime;
+			}
+			else
+			{
+				if (collidedWall.isXWall())
+				{
+					cameraPosition += camSpeed * deltaTime * glm::normalize(glm::vec3(0.0f, 0.0f, right.z));
+				}
+				else if (collidedWall.isZWall())
+				{
+					cameraPosition += camSpeed * deltaTime * glm::normalize(glm::vec3(right.x, 0.0f, 0.0f));
+				}
+			}
+			if (sfx->isFinished())
+			{
+				sfx = sfxEngine->play2D("FootStep.mp3", false, false, true);
+			}
+		}
+		
+
+		// Camera computations
+		camera = glm::lookAt(cameraPosition, cameraPosition + cameraTarget, cameraUp);
+		GLfloat aspectRatio = (GLfloat)windowWidth / (GLfloat)windowHeight;
+		perspective = glm::perspective(cameraFieldOfView, aspectRatio, cameraNear, cameraFar);
+
+		// Only the part of the view that can contain level geometry needs shadows, so split just that range
+		glm::vec3 levelViewMin, levelViewMax;
+		TransformBounds(camera, levelBoundsMin, levelBoundsMax, levelViewMin, levelViewMax);
+		float shadowFar = glm::clamp(-levelViewMin.z, cameraNear * 2.0f, cameraFar);
+
+		float splitDistances[MAX_SHADOW_CASCADES + 1];
+		ComputeCascadeSplits(cameraNear, shadowFar, cascadeCount, splitDistances);
+
+		glm::mat4 cascadeProjections[MAX_SHADOW_CASCADES];
+		for (int i = 0; i < cascadeCount; ++i)
+		{
+			cascadeProjections[i] = FitCascadeProjection(lightView, camera, cameraFieldOfView, aspectRatio,
+				splitDistances[i + 1], levelLightMin, levelLightMax, shadowMapSize);
+		}
+
+		// This frame's data goes into the next region of frameStream, which the GPU finished reading frames ago
+		BeginStreamFrame(frameStream);
+
+		// Bin the local lights into the clusters of this frame's view. The cluster boxes only depend on the projection.
+		double lightClusteringStart = glfwGetTime();
+		if (aspectRatio != lightClusterAspectRatio)
+		{
+			BuildLightClusterGrid(perspective, cameraNear, cameraFar, lightClusterGrid);
+			lightClusterAspectRatio = aspectRatio;
+		}
+		clusteredLightTotal += AssignLightsToClusters(level, time, camera, lightClusterGrid, lightClusters);
+
+		const void* lightBufferData[LIGHT_BUFFER_COUNT] = { lightClusters.lightData.data(), lightClusters.clusterRanges.data(), lightClusters.lightIndices.data() };
+		const GLsizeiptr lightBufferDataSizes[LIGHT_BUFFER_COUNT] = {
+			static_cast<GLsizeiptr>(lightClusters.lightData.size() * sizeof(glm::vec4)),
+			static_cast<GLsizeiptr>(lightClusters.clusterRanges.size() * sizeof(GLuint)),
+			static_cast<GLsizeiptr>(lightClusters.lightIndices.size() * sizeof(GLuint))
+		};
+		glm::ivec4 lightBufferOffsets = glm::ivec4(0);
+		for (int i = 0; i < LIGHT_BUFFER_COUNT; ++i)
+		{
+			if (lightBufferMode == LIGHT_BUFFERS_PER_FRAME)
+			{
+				// The frame that last used this set of buffers is done, since BeginStreamFrame waited for it
+				GLuint buffer = lightBuffers[frameStream.frame][i];
+				glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+				glBufferSubData(GL_TEXTURE_BUFFER, 0, std::min(lightBufferDataSizes[i], lightBufferSizes[i]), lightBufferData[i]);
+				glBindTexture(GL_TEXTURE_BUFFER, lightBufferTextures[i]);
+				glTexBuffer(GL_TEXTURE_BUFFER, lightBufferFormats[i], buffer);
+				continue;
+			}
+
+			GLintptr offset = WriteStreamBuffer(frameStream, lightBufferData[i], lightBufferDataSizes[i]);
+			if (offset < 0)
+			{
+				continue;
+			}
+#ifdef GL_ARB_texture_buffer_range
+			if (lightBufferMode == LIGHT_BUFFERS_RANGES)
+			{
+				// A range can't be empty, and an empty array is never read
+				if (lightBufferDataSizes[i] > 0)
+				{
+					glBindTexture(GL_TEXTURE_BUFFER, lightBufferTextures[i]);
+					glTexBufferRange(GL_TEXTURE_BUFFER, lightBufferFormats[i], frameStream.buffer, offset, lightBufferDataSizes[i]);
+				}
+				continue;
+			}
+#endif
+			lightBufferOffsets[i] = static_cast<GLint>(offset / lightBufferTexelSizes[i]);
+		}
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+		lightClusteringTime += glfwGetTime() - lightClusteringStart;
+
+		// The shared matrices are written once for every pass, along with where this frame's lights start in frameStream
+		FrameUniforms frameUniforms;
+		frameUniforms.camera = camera;
+		frameUniforms.perspective = perspective;
+		for (int i = 0; i < MAX_SHADOW_CASCADES; ++i)
+		{
+			frameUniforms.lightViewProjection[i] = (i < cascadeCount) ? cascadeProjections[i] * lightView : glm::mat4(1.0f);
+
+			// The last cascade also takes anything beyond its split, so fragments never select an unused cascade
+			frameUniforms.cascadeSplits[i] = (i < cascadeCount - 1) ? splitDistances[i + 1] : cameraFar;
+		}
+		frameUniforms.lightBufferOffsets = lightBufferOffsets;
+		GLintptr frameUniformsOffset = WriteStreamBuffer(frameStream, &frameUniforms, sizeof(FrameUniforms));
+		glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_UNIFORMS_BINDING, frameStream.buffer, frameUniformsOffset, sizeof(FrameUniforms));
+
+		// FIRST PASS
+		// 
+		// Only re-render the cascades whose projection or shadow casters changed, and none if shadows are off
+		//
+		for (int i = 0; i < cascadeCount && shadows; ++i)
+		{
+			if (IsShadowCacheCurrent(shadowCaches[i], cascadeProjections[i], lightView, shadowCasterVersion))
+			{
+				continue;
+			}
+
+			glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+			glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, fboTex, 0, i);
+			glClear(GL_DEPTH_BUFFER_BIT);
+			glViewport(0, 0, shadowMapSize, shadowMapSize);
+			glUseProgram(depthshaders.id);
+			SetUniform(cascadeIndexUniform, i);
+
+			// Push the stored depth away from the light, more on surfaces that are steep relative to it
+			glEnable(GL_POLYGON_OFFSET_FILL);
+			glPolygonOffset(1.5f, 4.0f);
+
+			// The floor and every wall in one draw, reading only positions
+			glBindVertexArray(staticDepthVao);
+			glDrawElements(GL_TRIANGLES, staticIndexCount, GL_UNSIGNED_INT, (void*)0);
+			glBindVertexArray(0);
+
+			glDisable(GL_POLYGON_OFFSET_FILL);
+
+			UpdateShadowCache(shadowCaches[i], cascadeProjections[i], lightView, shadowCasterVersion);
+		}
+
+
+
+		// Only the wall quads that are potentially visible from the camera's cell and inside the view frustum
+		// are drawn in the second pass
+		double cullingStart = glfwGetTime();
+		const GLuint* candidateQuads = allWallQuads.data();
+		size_t candidateCount = allWallQuads.size();
+		GLint firstGpuCandidate = gpuCulling.allQuadsOffset;
+		if (hasPvs)
+		{
+			int cellX = static_cast<int>(std::floor(cameraPosition.x - pvs.originX));
+			int cellZ = static_cast<int>(std::floor(cameraPosition.z - pvs.originZ));
+			if (cellX >= 0 && cellX < pvs.cellsX && cellZ >= 0 && cellZ < pvs.cellsZ)
+			{
+				int cell = cellZ * pvs.cellsX + cellX;
+				candidateQuads = pvs.quads.data() + pvs.cellStarts[cell];
+				candidateCount = pvs.cellStarts[cell + 1] - pvs.cellStarts[cell];
+				firstGpuCandidate = static_cast<GLint>(pvs.cellStarts[cell]);
+			}
+		}
+
+		glm::vec4 frustumPlanes[6];
+		ExtractFrustumPlanes(perspective * camera, frustumPlanes);
+		if (gpuCulling.enabled)
+		{
+			DispatchGpuWallCulling(gpuCulling, firstGpuCandidate, static_cast<GLint>(candidateCount));
+		}
+		else
+		{
+			visibleQuadTotal += CullWallQuads(wallBounds, frustumPlanes, candidateQuads, candidateCount, visibleWalls);
+			SplitDrawList(visibleWalls, wallClusters, visibleClusterWalls);
+		}
+		cullingTime += glfwGetTime() - cullingStart;
+		++culledFrames;
+
+		// Collect the GPU time of the frame before last, if it has finished
+		if (mainPassTimerIssued[mainPassTimer])
+		{
+			GLint available = 0;
+			glGetQueryObjectiv(mainPassTimers[mainPassTimer], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (available)
+			{
+				GLuint64 elapsed = 0;
+				glGetQueryObjectui64v(mainPassTimers[mainPassTimer], GL_QUERY_RESULT, &elapsed);
+				mainPassGpuTime += elapsed;
+				++mainPassTimedFrames;
+			}
+		}
+
+		if (time - cullingReportTime >= 1.0)
+		{
+			// The measurements are always taken, but only reported when asked for with --stats
+			if (settings.stats)
+			{
+				if (gpuCulling.enabled)
+				{
+					std::cout << "Wall culling: on the GPU, " << cullingTime / culledFrames * 1000000.0 << " us per frame to issue" << std::endl;
+				}
+				else
+				{
+					std::cout << "Wall culling: " << visibleQuadTotal / culledFrames << " of " << wallBounds.count << " quads visible, "
+						<< cullingTime / culledFrames * 1000000.0 << " us per frame" << std::endl;
+				}
+				std::cout << "Light clustering: " << clusteredLightTotal / culledFrames << " light-cluster pairs for " << levelHeader.lightCount << " lights, "
+					<< lightClusteringTime / culledFrames * 1000000.0 << " us per frame" << std::endl;
+				if (mainPassTimedFrames > 0)
+				{
+					std::cout << "Floor and walls: " << mainPassGpuTime / mainPassTimedFrames / 1000 << " us per frame on the GPU, depth pre-pass "
+						<< (depthPrePass ? "on" : "off") << std::endl;
+				}
+			}
+			mainPassGpuTime = 0;
+			mainPassTimedFrames = 0;
+			cullingTime = 0.0;
+			lightClusteringTime = 0.0;
+			culledFrames = 0;
+			visibleQuadTotal = 0;
+			clusteredLightTotal = 0;
+			cullingReportTime = time;
+		}
+
+		//
+		// SECOND PASS 
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glViewport(0, 0, windowWidth, windowHeight);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, fboTex);
+		
+
+		// A cluster whose bounding box was hidden last frame is skipped by the GPU without a round trip to the CPU
+		size_t previousQueryOffset = (occlusionQuerySet ^ 1) * wallClusters.size();
+
+		// Time the floor and walls on the GPU, so the depth pre-pass can be compared against drawing without it
+		glBeginQuery(GL_TIME_ELAPSED, mainPassTimers[mainPassTimer]);
+
+		// DEPTH PRE-PASS
+		// Lays down the depth of the floor and walls with a trivial program first. The colour pass then only accepts
+		// fragments at exactly that depth, so main.fsh runs once per pixel however many walls overlap.
+		if (depthPrePass)
+		{
+			glUseProgram(prepassshaders.id);
+			glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+			if (gpuCulling.enabled)
+			{
+				glBindVertexArray(gpuCulling.depthVao);
+				DrawGpuCulledStaticMesh(gpuCulling, floorRange, &occlusionQueries[previousQueryOffset], &occlusionQueryIssued[previousQueryOffset]);
+			}
+			else
+			{
+				glBindVertexArray(staticDepthVao);
+				DrawStaticMesh(floorRange, visibleClusterWalls, &occlusionQueries[previousQueryOffset], &occlusionQueryIssued[previousQueryOffset], staticBatch);
+			}
+			glBindVertexArray(0);
+
+			glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+			glDepthFunc(GL_EQUAL);
+			glDepthMask(GL_FALSE);
+		}
+
+		// Use the variant of the main program that matches the flashlight
+		const MainProgramUniforms& uniforms = mainUniforms[lightOn ? 1 : 0];
+		glUseProgram(mainPrograms[lightOn ? 1 : 0].id);
+
+		SetUniform(uniforms.cameraPosition, cameraPosition);
+		SetUniform(uniforms.spotLightPosition, cameraPosition);
+		SetUniform(uniforms.spotLightDirection, cameraTarget);
+
+		// Fragment coordinates to cluster tiles, and log of view depth to depth slices
+		SetUniform(uniforms.clusterScale, glm::vec3(static_cast<float>(LIGHT_CLUSTERS_X) / windowWidth, static_cast<float>(LIGHT_CLUSTERS_Y) / windowHeight,
+			LIGHT_CLUSTERS_Z / std::log(cameraFar / cameraNear)));
+
+		for (int i = 0; i < LIGHT_BUFFER_COUNT; ++i)
+		{
+			glActiveTexture(GL_TEXTURE2 + i);
+			glBindTexture(GL_TEXTURE_BUFFER, lightBufferTextures[i]);
+		}
+
+
+		// FLOOR AND WALLS
+		// Every surface texture is a layer of the array on texture unit 1, so nothing needs binding between them
+		if (gpuCulling.enabled)
+		{
+			glBindVertexArray(gpuCulling.vao);
+			DrawGpuCulledStaticMesh(gpuCulling, floorRange, &occlusionQueries[previousQueryOffset], &occlusionQueryIssued[previousQueryOffset]);
+		}
+		else
+		{
+			glBindVertexArray(staticVao);
+			DrawStaticMesh(floorRange, visibleClusterWalls, &occlusionQueries[previousQueryOffset], &occlusionQueryIssued[previousQueryOffset], staticBatch);
+		}
+		glBindVertexArray(0);
+
+		if (depthPrePass)
+		{
+			glDepthFunc(GL_LESS);
+			glDepthMask(GL_TRUE);
+		}
+		glEndQuery(GL_TIME_ELAPSED);
+		mainPassTimerIssued[mainPassTimer] = true;
+		mainPassTimer ^= 1;
+
+		// Draw Skybox
+		// It sits on the far plane, so drawing it last means only the pixels that the floor and walls left empty pass the depth test
+		glDepthFunc(GL_LEQUAL);
+		glDepthMask(GL_FALSE);
+		glUseProgram(skyboxshaders.id);
+
+		glBindVertexArray(skyboxVao);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTexture);
+		glDrawArrays(GL_TRIANGLES, 0, 36);
+		glDepthMask(GL_TRUE);
+		glDepthFunc(GL_LESS);
+		glBindVertexArray(0);
+
+		// Test each cluster's bounding box against the finished depth buffer, for next frame. Clusters outside the frustum,
+		// or close enough that the near plane could clip their box, are left unqueried so they get drawn next frame.
+		// The CPU doesn't know which quads the GPU culling kept, so then only each cluster's box is tested against the frustum.
+		float nearPlaneHalfHeight = cameraNear * std::tan(cameraFieldOfView * 0.5f);
+		float nearPlaneReach = std::sqrt(cameraNear * cameraNear + nearPlaneHalfHeight * nearPlaneHalfHeight * (1.0f + aspectRatio * aspectRatio));
+		glUseProgram(occlusionshaders.id);
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		glDepthMask(GL_FALSE);
+		glBindVertexArray(occlusionBoxVao);
+		for (size_t i = 0; i < wallClusters.size(); ++i)
+		{
+			const WallCluster& cluster = wallClusters[i];
+			size_t query = occlusionQuerySet * wallClusters.size() + i;
+			glm::vec3 nearestPoint = glm::clamp(cameraPosition, cluster.min, cluster.max);
+			bool cameraInside = glm::distance(nearestPoint, cameraPosition) <= nearPlaneReach;
+			bool clusterInView = gpuCulling.enabled ? IsBoxInFrustum(cluster.min, cluster.max, frustumPlanes) : !visibleClusterWalls[i].counts.empty();
+			occlusionQueryIssued[query] = clusterInView && !cameraInside;
+			if (!occlusionQueryIssued[query])
+			{
+				continue;
+			}
+
+			SetUniform(boxMinUniform, cluster.min);
+			SetUniform(boxMaxUniform, cluster.max);
+			glBeginQuery(GL_ANY_SAMPLES_PASSED, occlusionQueries[query]);
+			glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, (void*)0);
+			glEndQuery(GL_ANY_SAMPLES_PASSED);
+		}
+		glBindVertexArray(0);
+		glDepthMask(GL_TRUE);
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		occlusionQuerySet ^= 1;
+
+
+		glBindVertexArray(0);
+
+		glEnable(GL_DEPTH_TEST);
+
+		// Nothing after this reads from frameStream's current region
+		EndStreamFrame(frameStream);
+
+		// Tell GLFW to swap the screen buffer with the offscreen buffer
+		glfwSwapBuffers(window);
+
+		// Tell GLFW to process window events (e.g., input events, window closed events, etc.)
+		glfwPollEvents();
+	}
+
+	// --- Cleanup ---
+
+	// Don't leave the loader's workers running if the game is closed before they are done
+	StopTextureLoader(textureLoader);
+
+	// Make sure to delete the shader programs
+	glDeleteProgram(mainPrograms[0].id);
+	glDeleteProgram(mainPrograms[1].id);
+	glDeleteProgram(depthshaders.id);
+	glDeleteProgram(skyboxshaders.id);
+	glDeleteProgram(occlusionshaders.id);
+	glDeleteProgram(prepassshaders.id);
+	if (gpuCulling.enabled)
+	{
+		DeleteGpuWallCulling(gpuCulling);
+	}
+
+	glDeleteQueries(static_cast<GLsizei>(occlusionQueries.size()), occlusionQueries.data());
+	glDeleteQueries(2, mainPassTimers);
+
+	// Delete the VBO that contains our vertices
+	glDeleteBuffers(1, &staticPositionVbo);
+	glDeleteBuffers(1, &staticAttributeVbo);
+	glDeleteBuffers(1, &staticEbo);
+	glDeleteBuffers(1, &skyboxVbo);
+	glDeleteBuffers(1, &occlusionBoxVbo);
+	glDeleteBuffers(1, &occlusionBoxEbo);
+	glDeleteBuffers(1, &staticInstanceVbo);
+	DeleteStreamBuffer(frameStream);
+	glDeleteBuffers(1, &texturePixelBuffer);
+	glDeleteTextures(1, &surfaceTextures);
+	glDeleteTextures(1, &skyboxTexture);
+	glDeleteTextures(LIGHT_BUFFER_COUNT, lightBufferTextures);
+	glDeleteBuffers(STREAM_BUFFER_FRAMES * LIGHT_BUFFER_COUNT, &lightBuffers[0][0]);
+
+	// Delete the vertex array object
+	glDeleteVertexArrays(1, &staticVao);
+	glDeleteVertexArrays(1, &skyboxVao);
+	glDeleteVertexArrays(1, &occlusionBoxVao);
+	glDeleteVertexArrays(1, &staticDepthVao);
+
+	UnloadLevel(level);
+
+	// Remember to tell GLFW to clean itself up before exiting the application
+	glfwTerminate();
+
+	return 0;
+}
+
+/**
+ * @brief Creates shader programs from their shader files, loading them from the shader cache where possible.
+ * Every program is compiled and linked before any of them is checked, so the driver can build them in parallel.
+ * Each shader gets its program's defines and the FrameUniforms block inserted after its #version directive.
+ * @param[in,out] cache Shader cache. Programs that had to be compiled are added to it.
+ * @param[in] sources Shader files of each program
+ * @return The created shader programs along with their active uniforms, in the same order as sources
+ */
+std::vector<ShaderProgram> CreateShaderPrograms(ShaderCache& cache, const std::vector<ShaderProgramSource>& sources)
+{
+	// A program being built from either a cached binary or its shader sources
+	struct ProgramBuild
+	{
+		GLuint program = 0;
+		int stageCount = 0;
+		GLenum shaderTypes[2] = { 0, 0 };
+		GLuint shaders[2] = { 0, 0 };			// Vertex and fragment shaders, or the compute shader, while they are being compiled
+		std::string shaderFilePaths[2];
+		std::string shaderSources[2];
+		uint64_t cacheKey = 0;
+		bool fromBinary = false;
+		bool finished = false;
+	};
+
+	// With KHR_parallel_shader_compile, the driver compiles on its own threads and reports when each program is done.
+	// Without it, checking a program's status waits for it, but the programs after it may still be compiling meanwhile.
+	bool parallelCompile = false;
+#ifdef GL_KHR_parallel_shader_compile
+	if (GLAD_GL_KHR_parallel_shader_compile)
+	{
+		parallelCompile = true;
+		glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+	}
+#endif
+
+	auto compileProgram = [&cache](ProgramBuild& build)
+	{
+		build.fromBinary = false;
+		for (int stage = 0; stage < build.stageCount; stage++)
+		{
+			build.shaders[stage] = CreateShaderFromSource(build.shaderTypes[stage], build.shaderSources[stage]);
+			glAttachShader(build.program, build.shaders[stage]);
+		}
+#ifdef GL_ARB_get_program_binary
+		if (cache.enabled)
+		{
+			glProgramParameteri(build.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		}
+#endif
+		glLinkProgram(build.program);
+	};
+
+	const std::string frameUniformsDeclaration = GetFrameUniformsDeclaration();
+
+	std::vector<ProgramBuild> builds(sources.size());
+	for (size_t i = 0; i < sources.size(); i++)
+	{
+		ProgramBuild& build = builds[i];
+		if (!sources[i].computeShaderFilePath.empty())
+		{
+			// Compute shaders need OpenGL 4.3. Without it the program has no shaders, and fails to link.
+#ifdef GL_VERSION_4_3
+			build.stageCount = 1;
+			build.shaderTypes[0] = GL_COMPUTE_SHADER;
+			build.shaderFilePaths[0] = sources[i].computeShaderFilePath;
+#endif
+		}
+		else
+		{
+			build.stageCount = 2;
+			build.shaderTypes[0] = GL_VERTEX_SHADER;
+			build.shaderTypes[1] = GL_FRAGMENT_SHADER;
+			build.shaderFilePaths[0] = sources[i].vertexShaderFilePath;
+			build.shaderFilePaths[1] = sources[i].fragmentShaderFilePath;
+		}
+		build.cacheKey = cache.driverKey;
+		for (int stage = 0; stage < build.stageCount; stage++)
+		{
+			ReadShaderFile(build.shaderFilePaths[stage], build.shaderSources[stage]);
+			InsertShaderDefines(build.shaderSources[stage], sources[i].defines + frameUniformsDeclaration);
+
+			// Hashing the terminator too keeps the boundary between the sources part of the key
+			build.cacheKey = HashFnv1a(build.shaderSources[stage].c_str(), build.shaderSources[stage].size() + 1, build.cacheKey);
+		}
+
+		build.program = glCreateProgram();
+#ifdef GL_ARB_get_program_binary
+		std::map<uint64_t, ShaderBinary>::const_iterator cached = cache.binaries.find(build.cacheKey);
+		if (cache.enabled && cached != cache.binaries.end())
+		{
+			glProgramBinary(build.program, cached->second.format, cached->second.data.data(), static_cast<GLsizei>(cached->second.data.size()));
+			build.fromBinary = true;
+		}
+#endif
+		if (!build.fromBinary)
+		{
+			compileProgram(build);
+		}
+	}
+
+	// Finish the programs in whatever order the driver completes them
+	std::vector<ShaderProgram> programs(sources.size());
+	size_t remaining = builds.size();
+	while (remaining > 0)
+	{
+		for (size_t i = 0; i < builds.size(); i++)
+		{
+			ProgramBuild& build = builds[i];
+			if (build.finished)
+			{
+				continue;
+			}
+
+#ifdef GL_KHR_parallel_shader_compile
+			if (parallelCompile)
+			{
+				GLint completed = GL_FALSE;
+				glGetProgramiv(build.program, GL_COMPLETION_STATUS_KHR, &completed);
+				if (completed != GL_TRUE)
+				{
+					continue;
+				}
+			}
+#endif
+
+			GLint linkStatus;
+			glGetProgramiv(build.program, GL_LINK_STATUS, &linkStatus);
+			if (linkStatus != GL_TRUE && build.fromBinary)
+			{
+				// A driver can refuse binaries it made before, e.g. after it has been updated
+				std::cout << "Cached program for " << build.shaderFilePaths[0] << (build.stageCount > 1 ? " and " + build.shaderFilePaths[1] : "")
+					<< " is out of date, compiling it" << std::endl;
+				compileProgram(build);
+				continue;
+			}
+
+			for (int stage = 0; stage < build.stageCount; stage++)
+			{
+				if (build.shaders[stage] != 0)
+				{
+					CheckShaderCompileStatus(build.shaders[stage], build.shaderFilePaths[stage]);
+					glDetachShader(build.program, build.shaders[stage]);
+					glDeleteShader(build.shaders[stage]);
+				}
+			}
+
+			// Check shader program link status
+			if (linkStatus != GL_TRUE)
+			{
+				char infoLog[512];
+				GLsizei infoLogLen = sizeof(infoLog);
+				glGetProgramInfoLog(build.program, infoLogLen, &infoLogLen, infoLog);
+				std::cerr << "program link error: " << infoLog << std::endl;
+			}
+#ifdef GL_ARB_get_program_binary
+			else if (cache.enabled && !build.fromBinary)
+			{
+				GLint binaryLength = 0;
+				glGetProgramiv(build.program, GL_PROGRAM_BINARY_LENGTH, &binaryLength);
+
+				ShaderBinary binary;
+				binary.data.resize(std::max(binaryLength, 0));
+				glGetProgramBinary(build.program, binaryLength, &binaryLength, &binary.format, binary.data.data());
+				binary.data.resize(std::max(binaryLength, 0));
+				if (!binary.data.empty())
+				{
+					cache.binaries[build.cacheKey] = std::move(binary);
+					cache.modified = true;
+				}
+			}
+#endif
+			if (linkStatus == GL_TRUE && cache.binaries.count(build.cacheKey) > 0)
+			{
+				cache.used.insert(build.cacheKey);
+			}
+
+			programs[i] = GetActiveUniforms(build.program);
+			build.finished = true;
+			remaining--;
+		}
+
+		if (remaining > 0)
+		{
+			std::this_thread::yield();
+		}
+	}
+
+	return programs;
+}
+
+/**
+ * @brief Enumerates the active uniforms of a linked shader program, so that nothing has to be looked up by name while rendering.
+ * @param[in] program OpenGL handle to the linked program
+ * @return The shader program along with its active uniforms
+ */
+ShaderProgram GetActiveUniforms(GLuint program)
+{
+	ShaderProgram shaderProgram;
+	shaderProgram.id = program;
+
+	GLint uniformCount = 0;
+	GLint maxNameLength = 0;
+	glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &uniformCount);
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+
+	std::vector<GLchar> nameBuffer(std::max(maxNameLength, 1));
+	for (GLint i = 0; i < uniformCount; ++i)
+	{
+		ActiveUniform uniform;
+		GLsizei nameLength = 0;
+		glGetActiveUniform(program, static_cast<GLuint>(i), static_cast<GLsizei>(nameBuffer.size()), &nameLength, &uniform.size, &uniform.type, nameBuffer.data());
+
+		std::string name(nameBuffer.data(), nameLength);
+		uniform.location = glGetUniformLocation(program, name.c_str());
+
+		// Uniforms inside uniform blocks have no location and are not set through glUniform*
+		if (uniform.location == -1)
+		{
+			continue;
+		}
+
+		// Array uniforms are reported as "name[0]"; store them under their base name
+		if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+		{
+			name.erase(name.size() - 3);
+		}
+
+		shaderProgram.uniforms[name] = uniform;
+	}
+
+	return shaderProgram;
+}
+
+/**
+ * @brief Makes a #define line that selects a shader permutation.
+ * @param[in] name Name of the macro
+ * @param[in] value Value of the macro
+ * @return The #define line
+ */
+std::string ShaderDefine(const std::string& name, int value)
+{
+	return "#define " + name + " " + std::to_string(value) + "\n";
+}
+
+/**
+ * @brief Inserts #define lines into shader source right after its #version directive, which has to stay first.
+ * A #line directive after them keeps the line numbers in compilation errors matching the file.
+ * @param[in,out] shaderSource Shader source string
+ * @param[in] defines #define lines to insert, and any declarations shared between shaders
+ */
+void InsertShaderDefines(std::string& shaderSource, const std::string& defines)
+{
+	if (defines.empty())
+	{
+		return;
+	}
+
+	size_t insertAt = 0;
+	size_t version = shaderSource.find("#version");
+	if (version != std::string::npos)
+	{
+		insertAt = shaderSource.find('\n', version);
+		if (insertAt == std::string::npos)
+		{
+			shaderSource += '\n';
+			insertAt = shaderSource.size();
+		}
+		else
+		{
+			insertAt++;
+		}
+	}
+
+	// The line after the inserted ones is the file's line number insertAt's line
+	int nextLine = 1 + static_cast<int>(std::count(shaderSource.begin(), shaderSource.begin() + insertAt, '\n'));
+	shaderSource.insert(insertAt, defines + "#line " + std::to_string(nextLine) + "\n");
+}
+
+/**
+ * @brief Makes the GLSL declaration of the FrameUniforms block. CreateShaderPrograms inserts it into every shader,
+ * so the layout is only written down here and in the FrameUniforms struct.
+ * @return The block declaration
+ */
+std::string GetFrameUniformsDeclaration()
+{
+	return "// Per-frame matrices shared by every program, see FrameUniforms in Main.cpp\n"
+		"layout(std140) uniform FrameUniforms\n"
+		"{\n"
+		"\tmat4 camera;\n"
+		"\tmat4 perspective;\n"
+		"\tmat4 lightViewProjection[" + std::to_string(MAX_SHADOW_CASCADES) + "];\t// One per shadow cascade\n"
+		"\tvec4 cascadeSplits;\t\t\t\t// View-space distance where each cascade ends\n"
+		"\tivec4 lightBufferOffsets;\t\t// First texel of this frame's light data, cluster ranges and light indices\n"
+		"};\n";
+}
+
+/**
+ * @brief Reads the shader cache file, if the driver can load program binaries.
+ * @param[in] cacheFilePath Path to the shader cache file
+ * @param[out] cache Shader cache
+ */
+void LoadShaderCache(const std::string& cacheFilePath, ShaderCache& cache)
+{
+	cache = ShaderCache();
+	cache.filePath = cacheFilePath;
+
+	// Program binaries are core in OpenGL 4.1, but drivers may not support any binary formats
+#ifdef GL_ARB_get_program_binary
+	if (GLAD_GL_ARB_get_program_binary || GLAD_GL_VERSION_4_1)
+	{
+		GLint formatCount = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+		cache.enabled = formatCount > 0;
+	}
+#endif
+	if (!cache.enabled)
+	{
+		return;
+	}
+
+	// Binaries only load on the driver that made them, so it is part of every key
+	std::string driver;
+	for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION })
+	{
+		const GLubyte* value = glGetString(name);
+		driver += (value != nullptr) ? reinterpret_cast<const char*>(value) : "";
+		driver += '\0';
+	}
+	cache.driverKey = HashFnv1a(driver.data(), driver.size(), HashFnv1a(&SHADER_CACHE_VERSION, sizeof(SHADER_CACHE_VERSION)));
+
+	// There is no cache file until the first run has saved one
+	std::ifstream cacheFile(cacheFilePath, std::ios::binary);
+	if (cacheFile.fail())
+	{
+		return;
+	}
+
+	ShaderCacheHeader header = {};
+	cacheFile.read(reinterpret_cast<char*>(&header), sizeof(header));
+	if (cacheFile.fail() || std::memcmp(header.identifier, SHADER_CACHE_IDENTIFIER, sizeof(SHADER_CACHE_IDENTIFIER)) != 0 || header.version != SHADER_CACHE_VERSION)
+	{
+		std::cerr << "Ignoring invalid shader cache file: " << cacheFilePath << std::endl;
+		return;
+	}
+
+	for (uint32_t i = 0; i < header.binaryCount; i++)
+	{
+		ShaderCacheEntry entry = {};
+		cacheFile.read(reinterpret_cast<char*>(&entry), sizeof(entry));
+
+		ShaderBinary binary;
+		binary.format = entry.format;
+		binary.data.resize(cacheFile.fail() ? 0 : entry.size);
+		cacheFile.read(binary.data.data(), binary.data.size());
+		if (cacheFile.fail())
+		{
+			std::cerr << "Shader cache file is truncated: " << cacheFilePath << std::endl;
+			break;
+		}
+		cache.binaries[entry.key] = std::move(binary);
+	}
+}
+
+/**
+ * @brief Writes the shader cache file if it has changed, keeping only the binaries used this run.
+ * @param[in] cache Shader cache
+ * @return True if the file is up to date
+ */
+bool SaveShaderCache(const ShaderCache& cache)
+{
+	if (!cache.enabled || (!cache.modified && cache.used.size() == cache.binaries.size()))
+	{
+		return true;
+	}
+
+	ShaderCacheHeader header = {};
+	std::memcpy(header.identifier, SHADER_CACHE_IDENTIFIER, sizeof(SHADER_CACHE_IDENTIFIER));
+	header.version = SHADER_CACHE_VERSION;
+	header.binaryCount = static_cast<uint32_t>(cache.used.size());
+
+	std::ofstream cacheFile(cache.filePath, std::ios::binary);
+	cacheFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	for (uint64_t key : cache.used)
+	{
+		const ShaderBinary& binary = cache.binaries.at(key);
+		ShaderCacheEntry entry = { key, binary.format, static_cast<uint32_t>(binary.data.size()) };
+		cacheFile.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+		cacheFile.write(binary.data.data(), binary.data.size());
+	}
+
+	if (cacheFile.fail())
+	{
+		std::cerr << "Unable to write shader cache file: " << cache.filePath << std::endl;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Hashes bytes with 64-bit FNV-1a.
+ * @param[in] data Bytes to hash
+ * @param[in] size Number of bytes
+ * @param[in] hash Hash to continue from, so that several pieces of data can be hashed together
+ * @return Hash of the bytes
+ */
+uint64_t HashFnv1a(const void* data, size_t size, uint64_t hash)
+{
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+/**
+ * @brief Looks up the location of an active uniform and checks that it has the expected type.
+ * @param[in] program Shader program to search
+ * @param[in] name Name of the uniform. Array uniforms are found by their base name.
+ * @param[in] expectedType GLSL type the caller will upload. GL_INT also accepts sampler uniforms.
+ * @return Location of the uniform, or -1 if it is inactive or has a different type
+ */
+GLint FindUniform(const ShaderProgram& program, const std::string& name, GLenum expectedType)
+{
+	std::map<std::string, ActiveUniform>::const_iterator it = program.uniforms.find(name);
+	if (it == program.uniforms.end())
+	{
+		// The compiler may strip uniforms that don't contribute to the output, so this is not an error
+		std::cerr << "Uniform " << name << " is not active in program " << program.id << std::endl;
+		return -1;
+	}
+
+	GLenum type = it->second.type;
+	bool isSampler = false;
+	switch (type)
+	{
+	case GL_SAMPLER_2D:
+	case GL_SAMPLER_3D:
+	case GL_SAMPLER_CUBE:
+	case GL_SAMPLER_2D_SHADOW:
+	case GL_SAMPLER_2D_ARRAY:
+	case GL_SAMPLER_2D_ARRAY_SHADOW:
+	case GL_SAMPLER_BUFFER:
+	case GL_INT_SAMPLER_BUFFER:
+	case GL_UNSIGNED_INT_SAMPLER_BUFFER:
+		isSampler = true;
+		break;
+	}
+
+	if (type != expectedType && !(expectedType == GL_INT && isSampler))
+	{
+		std::cerr << "Uniform " << name << " in program " << program.id << " has a different type than expected" << std::endl;
+		return -1;
+	}
+
+	return it->second.location;
+}
+
+/**
+ * @brief Connects a uniform block of a program to a uniform buffer binding point.
+ * GLSL 3.30 has no layout(binding) qualifier, so this has to be done after linking.
+ * @param[in] program Shader program containing the block
+ * @param[in] blockName Name of the uniform block
+ * @param[in] binding Uniform buffer binding point
+ */
+void BindUniformBlock(const ShaderProgram& program, const std::string& blockName, GLuint binding)
+{
+	GLuint blockIndex = glGetUniformBlockIndex(program.id, blockName.c_str());
+	if (blockIndex == GL_INVALID_INDEX)
+	{
+		std::cerr << "Uniform block " << blockName << " is not active in program " << program.id << std::endl;
+		return;
+	}
+
+	glUniformBlockBinding(program.id, blockIndex, binding);
+}
+
+/**
+ * @brief Uploads a value to a uniform of the currently bound program.
+ * @param[in] uniform Handle to the uniform
+ * @param[in] value Value to upload
+ */
+void SetUniform(const Uniform<glm::mat4>& uniform, const glm::mat4& value)
+{
+	glUniformMatrix4fv(uniform.location, 1, GL_FALSE, glm::value_ptr(value));
+}
+
+void SetUniform(const Uniform<glm::vec3>& uniform, const glm::vec3& value)
+{
+	glUniform3fv(uniform.location, 1, glm::value_ptr(value));
+}
+
+void SetUniform(const Uniform<GLfloat>& uniform, GLfloat value)
+{
+	glUniform1f(uniform.location, value);
+}
+
+void SetUniform(const Uniform<GLint>& uniform, GLint value)
+{
+	glUniform1i(uniform.location, value);
+}
+
+void SetUniform(const Uniform<bool>& uniform, bool value)
+{
+	glUniform1i(uniform.location, value ? GL_TRUE : GL_FALSE);
+}
+
+/**
+ * @brief Reads a shader source file.
+ * @param[in] shaderFilePath Path to the file containing the shader source
+ * @param[out] shaderSource Shader source string
+ * @return True if the file was read
+ */
+bool ReadShaderFile(const std::string& shaderFilePath, std::string& shaderSource)
+{
+	std::ifstream shaderFile(shaderFilePath, std::ios::binary);
+	if (shaderFile.fail())
+	{
+		std::cerr << "Unable to open shader file: " << shaderFilePath << std::endl;
+		shaderSource.clear();
+		return false;
+	}
+
+	std::ostringstream sourceStream;
+	sourceStream << shaderFile.rdbuf();
+	shaderSource = sourceStream.str();
+	return true;
+}
+
+/**
+ * @brief Creates a shader based on the provided shader type and the string containing the shader source.
+ * The compile status is not checked here, so that several shaders can compile at once. See CheckShaderCompileStatus.
+ * @param[in] shaderType Shader type
+ * @param[in] shaderSource Shader source string
+ * @return OpenGL handle to the created shader
+ */
+GLuint CreateShaderFromSource(const GLuint& shaderType, const std::string& shaderSource)
+{
+	GLuint shader = glCreateShader(shaderType);
+
+	const char* shaderSourceCStr = shaderSource.c_str();
+	GLint shaderSourceLen = static_cast<GLint>(shaderSource.length());
+	glShaderSource(shader, 1, &shaderSourceCStr, &shaderSourceLen);
+	glCompileShader(shader);
+
+	return shader;
+}
+
+/**
+ * @brief Reports a shader's compilation errors, if it failed to compile.
+ * @param[in] shader OpenGL handle to the shader
+ * @param[in] shaderFilePath Path to the file the shader was compiled from
+ * @return True if the shader compiled
+ */
+bool CheckShaderCompileStatus(GLuint shader, const std::string& shaderFilePath)
+{
+	// Check compilation status
+	GLint compileStatus;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &compileStatus);
+	if (compileStatus == GL_FALSE)
+	{
+		char infoLog[512];
+		GLsizei infoLogLen = sizeof(infoLog);
+		glGetShaderInfoLog(shader, infoLogLen, &infoLogLen, infoLog);
+		std::cerr << "shader compilation error in " << shaderFilePath << ": " << infoLog << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Merges the level's wall tiles into a single pre-transformed, indexed mesh.
+ * Adjacent tiles that lie on the same plane with the same orientation are greedily combined into larger quads,
+ * with UVs that keep the texture repeating once per tile.
+ * @param[in] level Level whose wall tiles will be merged
+ * @param[out] vertices World-space vertices of the merged quads, four per quad
+ * @param[out] indices Triangle indices into vertices, six per quad
+ */
+void BuildWallMesh(const Level& level, std::vector<Vertex>& vertices, std::vector<GLuint>& indices)
+{
+	// Each tile is a unit plane lying flat on the XZ plane facing +Y, with u = 0.5 - z and v = 0.5 - x,
+	// moved into place by its model matrix. Tiles are grouped by their rotation and the plane they lie on.
+	struct WallPlane
+	{
+		glm::mat4 firstTile;					// Tile that the grid coordinates are relative to
+		std::set<std::pair<int, int>> cells;	// Tile positions along the plane's local x and z axes
+	};
+	std::map<std::vector<int>, WallPlane> planes;
+
+	for (uint32_t i = 0; i < level.header->tileCount; i++)
+	{
+		const glm::mat4& tile = level.tileTransforms[i];
+
+		// Rotation entries are always -1, 0 or 1 for axis-aligned tiles, and the plane offset sits on a half-unit grid
+		std::vector<int> planeKey;
+		for (int column = 0; column < 3; column++)
+		{
+			for (int row = 0; row < 3; row++)
+			{
+				planeKey.push_back(static_cast<int>(std::lround(tile[column][row])));
+			}
+		}
+		glm::vec3 tileCenter = glm::vec3(tile[3]);
+		planeKey.push_back(static_cast<int>(std::lround(glm::dot(tileCenter, glm::vec3(tile[1])) * 2.0f)));
+
+		WallPlane& plane = planes[planeKey];
+		if (plane.cells.empty())
+		{
+			plane.firstTile = tile;
+		}
+
+		glm::vec3 offset = tileCenter - glm::vec3(plane.firstTile[3]);
+		plane.cells.insert(std::make_pair(
+			static_cast<int>(std::lround(glm::dot(offset, glm::vec3(plane.firstTile[0])))),
+			static_cast<int>(std::lround(glm::dot(offset, glm::vec3(plane.firstTile[2]))))));
+	}
+
+	for (auto& planeEntry : planes)
+	{
+		WallPlane& plane = planeEntry.second;
+		glm::vec3 normal = glm::vec3(plane.firstTile[1]);
+
+		// Greedy meshing: grow a run along x as far as it goes, then grow it along z
+		// for as long as every cell in the next row is still available
+		while (!plane.cells.empty())
+		{
+			std::pair<int, int> start = *plane.cells.begin();
+
+			int width = 1;
+			while (plane.cells.count(std::make_pair(start.first + width, start.second)))
+			{
+				width++;
+			}
+
+			int depth = 1;
+			bool rowAvailable = true;
+			while (rowAvailable)
+			{
+				for (int x = 0; x < width && rowAvailable; x++)
+				{
+					rowAvailable = plane.cells.count(std::make_pair(start.first + x, start.second + depth)) > 0;
+				}
+				if (rowAvailable)
+				{
+					depth++;
+				}
+			}
+
+			for (int z = 0; z < depth; z++)
+			{
+				for (int x = 0; x < width; x++)
+				{
+					plane.cells.erase(std::make_pair(start.first + x, start.second + z));
+				}
+			}
+
+			// Corners of the merged quad in the first tile's local space
+			float minX = start.first - 0.5f;
+			float maxX = start.first + width - 0.5f;
+			float minZ = start.second - 0.5f;
+			float maxZ = start.second + depth - 0.5f;
+			glm::vec2 corners[4] = { { minX, maxZ }, { maxX, maxZ }, { maxX, minZ }, { minX, minZ } };
+
+			GLuint firstVertex = static_cast<GLuint>(vertices.size());
+			for (const glm::vec2& corner : corners)
+			{
+				glm::vec4 position = plane.firstTile * glm::vec4(corner.x, 0.0f, corner.y, 1.0f);
+
+				Vertex vertex;
+				vertex.x = position.x; vertex.y = position.y; vertex.z = position.z;
+				vertex.layer = MATERIAL_BRICK_WALL;
+				vertex.u = 0.5f - corner.y;
+				vertex.v = 0.5f - corner.x;
+				vertex.nx = normal.x; vertex.ny = normal.y; vertex.nz = normal.z;
+				vertices.push_back(vertex);
+			}
+
+			GLuint quadIndices[6] = { 0, 1, 2, 2, 3, 0 };
+			for (GLuint index : quadIndices)
+			{
+				indices.push_back(firstVertex + index);
+			}
+		}
+	}
+
+	std::cout << "Merged " << level.header->tileCount << " wall tiles into " << indices.size() / 6 << " quads" << std::endl;
+}
+
+/**
+ * @brief Adds the level's floor to a mesh as a single world-space quad, so it can be drawn together with the walls.
+ * @param[in] level Level whose floor will be added
+ * @param[in,out] vertices Vertices of the mesh. Four are added.
+ * @param[in,out] indices Triangle indices into vertices. Six are added.
+ */
+void AppendFloorQuad(const Level& level, std::vector<Vertex>& vertices, std::vector<GLuint>& indices)
+{
+	// The floor texture repeats this many times along each side, however large the floor is
+	const float textureRepeats = 10.0f;
+
+	const LevelHeader& header = *level.header;
+	glm::vec2 center = glm::vec2(header.floorMinX + header.floorMaxX, header.floorMinZ + header.floorMaxZ) * 0.5f;
+	glm::vec2 size = glm::vec2(header.floorMaxX - header.floorMinX, header.floorMaxZ - header.floorMinZ);
+
+	// Lower-left, lower-right, upper-right and upper-left, with the corners as fractions of the floor's size
+	glm::vec2 corners[4] = { { -0.5f, 0.5f }, { 0.5f, 0.5f }, { 0.5f, -0.5f }, { -0.5f, -0.5f } };
+
+	GLuint firstVertex = static_cast<GLuint>(vertices.size());
+	for (const glm::vec2& corner : corners)
+	{
+		Vertex vertex;
+		vertex.x = center.x + corner.x * size.x; vertex.y = header.floorHeight; vertex.z = center.y + corner.y * size.y;
+		vertex.layer = MATERIAL_BROWN_TILE;
+		vertex.u = (0.5f - corner.y) * textureRepeats;
+		vertex.v = (0.5f - corner.x) * textureRepeats;
+		vertex.nx = 0.0f; vertex.ny = 1.0f; vertex.nz = 0.0f;
+		vertices.push_back(vertex);
+	}
+
+	GLuint quadIndices[6] = { 0, 1, 2, 2, 3, 0 };
+	for (GLuint index : quadIndices)
+	{
+		indices.push_back(firstVertex + index);
+	}
+}
+
+/**
+ * @brief Converts mesh vertices into the streams the GPU reads: positions, and the packed remaining attributes.
+ * @param[in] vertices Vertices of the mesh
+ * @param[out] positions Position of each vertex
+ * @param[out] packedVertices Packed UVs, normal and texture layer of each vertex
+ */
+void PackVertices(const std::vector<Vertex>& vertices, std::vector<glm::vec3>& positions, std::vector<PackedVertex>& packedVertices)
+{
+	positions.resize(vertices.size());
+	packedVertices.resize(vertices.size());
+	for (size_t i = 0; i < vertices.size(); ++i)
+	{
+		const Vertex& vertex = vertices[i];
+		positions[i] = glm::vec3(vertex.x, vertex.y, vertex.z);
+
+		PackedVertex& packed = packedVertices[i];
+		packed.u = glm::packHalf1x16(vertex.u);
+		packed.v = glm::packHalf1x16(vertex.v);
+		packed.normal = glm::packSnorm3x10_1x2(glm::vec4(vertex.nx, vertex.ny, vertex.nz, 0.0f));
+		packed.layer = vertex.layer;
+		packed.padding[0] = packed.padding[1] = packed.padding[2] = 0;
+	}
+}
+
+/**
+ * @brief Sorts the quads of a mesh built by BuildWallMesh into clusters on a square grid.
+ * Vertices are reordered so each cluster's quads are contiguous, and the indices are rebuilt to match.
+ * @param[in,out] vertices Vertices of the mesh, four per quad
+ * @param[in,out] indices Triangle indices into vertices, six per quad
+ * @param[in] clusterSize Width of a cluster along X and Z in world units
+ * @param[out] clusters Clusters in the order their quads appear in the mesh
+ */
+void BuildWallClusters(std::vector<Vertex>& vertices, std::vector<GLuint>& indices, float clusterSize, std::vector<WallCluster>& clusters)
+{
+	// Each quad goes in the grid square that holds its centre
+	std::map<std::pair<int, int>, std::vector<size_t>> quadsBySquare;
+	size_t quadCount = vertices.size() / 4;
+	for (size_t quad = 0; quad < quadCount; ++quad)
+	{
+		glm::vec3 center = glm::vec3(0.0f);
+		for (size_t corner = 0; corner < 4; ++corner)
+		{
+			const Vertex& vertex = vertices[quad * 4 + corner];
+			center += glm::vec3(vertex.x, vertex.y, vertex.z) * 0.25f;
+		}
+
+		std::pair<int, int> square = std::make_pair(static_cast<int>(std::floor(center.x / clusterSize)), static_cast<int>(std::floor(center.z / clusterSize)));
+		quadsBySquare[square].push_back(quad);
+	}
+
+	// Far enough out that the box's faces are never behind the walls they enclose
+	const float padding = 0.05f;
+
+	std::vector<Vertex> sortedVertices;
+	sortedVertices.reserve(vertices.size());
+	indices.clear();
+	clusters.clear();
+	for (const auto& square : quadsBySquare)
+	{
+		WallCluster cluster;
+		cluster.firstQuad = static_cast<GLuint>(sortedVertices.size() / 4);
+		cluster.quadCount = static_cast<GLuint>(square.second.size());
+		cluster.min = glm::vec3(std::numeric_limits<float>::max());
+		cluster.max = glm::vec3(-std::numeric_limits<float>::max());
+
+		for (size_t quad : square.second)
+		{
+			GLuint firstVertex = static_cast<GLuint>(sortedVertices.size());
+			for (size_t corner = 0; corner < 4; ++corner)
+			{
+				const Vertex& vertex = vertices[quad * 4 + corner];
+				cluster.min = glm::min(cluster.min, glm::vec3(vertex.x, vertex.y, vertex.z));
+				cluster.max = glm::max(cluster.max, glm::vec3(vertex.x, vertex.y, vertex.z));
+				sortedVertices.push_back(vertex);
+			}
+
+			GLuint quadIndices[6] = { 0, 1, 2, 2, 3, 0 };
+			for (GLuint index : quadIndices)
+			{
+				indices.push_back(firstVertex + index);
+			}
+		}
+
+		cluster.min -= glm::vec3(padding);
+		cluster.max += glm::vec3(padding);
+		clusters.push_back(cluster);
+	}
+	vertices.swap(sortedVertices);
+
+	std::cout << "Grouped " << quadCount << " wall quads into " << clusters.size() << " occlusion clusters" << std::endl;
+}
+
+/**
+ * @brief Computes the bounding box of every quad in a mesh built by BuildWallMesh.
+ * @param[in] vertices Vertices of the mesh, four per quad
+ * @param[out] bounds Bounding boxes of the quads
+ */
+void BuildWallBounds(const std::vector<Vertex>& vertices, WallBounds& bounds)
+{
+	bounds.count = vertices.size() / 4;
+	bounds.minX.resize(bounds.count);
+	bounds.minY.resize(bounds.count);
+	bounds.minZ.resize(bounds.count);
+	bounds.maxX.resize(bounds.count);
+	bounds.maxY.resize(bounds.count);
+	bounds.maxZ.resize(bounds.count);
+
+	for (size_t quad = 0; quad < bounds.count; ++quad)
+	{
+		glm::vec3 quadMin = glm::vec3(std::numeric_limits<float>::max());
+		glm::vec3 quadMax = glm::vec3(-std::numeric_limits<float>::max());
+		for (size_t corner = 0; corner < 4; ++corner)
+		{
+			const Vertex& vertex = vertices[quad * 4 + corner];
+			quadMin = glm::min(quadMin, glm::vec3(vertex.x, vertex.y, vertex.z));
+			quadMax = glm::max(quadMax, glm::vec3(vertex.x, vertex.y, vertex.z));
+		}
+
+		bounds.minX[quad] = quadMin.x;
+		bounds.minY[quad] = quadMin.y;
+		bounds.minZ[quad] = quadMin.z;
+		bounds.maxX[quad] = quadMax.x;
+		bounds.maxY[quad] = quadMax.y;
+		bounds.maxZ[quad] = quadMax.z;
+	}
+}
+
+/**
+ * @brief Extracts the six clipping planes of a view-projection matrix.
+ * A point p is inside the frustum if dot(plane.xyz, p) + plane.w >= 0 for every plane.
+ * @param[in] viewProjection Combined projection and view matrix
+ * @param[out] planes Left, right, bottom, top, near and far planes
+ */
+void ExtractFrustumPlanes(const glm::mat4& viewProjection, glm::vec4* planes)
+{
+	// glm matrices are column-major, so row i is made of element i of each column
+	glm::vec4 rows[4];
+	for (int i = 0; i < 4; ++i)
+	{
+		rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+	}
+
+	planes[0] = rows[3] + rows[0];
+	planes[1] = rows[3] - rows[0];
+	planes[2] = rows[3] + rows[1];
+	planes[3] = rows[3] - rows[1];
+	planes[4] = rows[3] + rows[2];
+	planes[5] = rows[3] - rows[2];
+}
+
+/**
+ * @brief Checks whether a box intersects the view frustum. Like CullWallQuads, it may let through boxes near the frustum's corners.
+ * @param[in] boxMin Minimum corner of the box
+ * @param[in] boxMax Maximum corner of the box
+ * @param[in] planes The six frustum planes from ExtractFrustumPlanes
+ * @return True if the box is at least partly inside the frustum
+ */
+bool IsBoxInFrustum(const glm::vec3& boxMin, const glm::vec3& boxMax, const glm::vec4* planes)
+{
+	for (int p = 0; p < 6; ++p)
+	{
+		const glm::vec4& plane = planes[p];
+		float distance = std::max(plane.x * boxMin.x, plane.x * boxMax.x)
+			+ std::max(plane.y * boxMin.y, plane.y * boxMax.y)
+			+ std::max(plane.z * boxMin.z, plane.z * boxMax.z)
+			+ plane.w;
+		if (distance < 0.0f)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief Finds the wall quads whose bounding boxes intersect the view frustum.
+ * @param[in] bounds Bounding boxes of the wall quads
+ * @param[in] planes The six frustum planes from ExtractFrustumPlanes
+ * @param[in] candidates Indices of the quads to test, in increasing order
+ * @param[in] candidateCount Number of quads to test
+ * @param[out] drawList Index ranges of the visible quads, with neighbouring quads merged into one range
+ * @return Number of visible quads
+ */
+size_t CullWallQuads(const WallBounds& bounds, const glm::vec4* planes, const GLuint* candidates, size_t candidateCount, DrawList& drawList)
+{
+	drawList.counts.clear();
+	drawList.offsets.clear();
+
+	// Every quad is six indices, stored in quad order
+	const GLsizei indicesPerQuad = 6;
+	size_t visibleCount = 0;
+	size_t nextOffset = 0;
+
+	for (size_t first = 0; first < candidateCount; first += 4)
+	{
+		// Quads tested in this group. A short last group repeats its final quad, whose extra results are ignored.
+		GLuint lanes[4];
+		for (int lane = 0; lane < 4; ++lane)
+		{
+			lanes[lane] = candidates[std::min(first + lane, candidateCount - 1)];
+		}
+
+		// A box is outside if even its corner furthest along a plane's normal is behind that plane.
+		// max(n * boxMin, n * boxMax) picks that corner's coordinate without branching on the sign of n.
+		int visibleMask = 0;
+#ifdef USE_SSE_CULLING
+		__m128 minX = _mm_setr_ps(bounds.minX[lanes[0]], bounds.minX[lanes[1]], bounds.minX[lanes[2]], bounds.minX[lanes[3]]);
+		__m128 minY = _mm_setr_ps(bounds.minY[lanes[0]], bounds.minY[lanes[1]], bounds.minY[lanes[2]], bounds.minY[lanes[3]]);
+		__m128 minZ = _mm_setr_ps(bounds.minZ[lanes[0]], bounds.minZ[lanes[1]], bounds.minZ[lanes[2]], bounds.minZ[lanes[3]]);
+		__m128 maxX = _mm_setr_ps(bounds.maxX[lanes[0]], bounds.maxX[lanes[1]], bounds.maxX[lanes[2]], bounds.maxX[lanes[3]]);
+		__m128 maxY = _mm_setr_ps(bounds.maxY[lanes[0]], bounds.maxY[lanes[1]], bounds.maxY[lanes[2]], bounds.maxY[lanes[3]]);
+		__m128 maxZ = _mm_setr_ps(bounds.maxZ[lanes[0]], bounds.maxZ[lanes[1]], bounds.maxZ[lanes[2]], bounds.maxZ[lanes[3]]);
+
+		__m128 outside = _mm_setzero_ps();
+		for (int p = 0; p < 6; ++p)
+		{
+			__m128 normalX = _mm_set1_ps(planes[p].x);
+			__m128 normalY = _mm_set1_ps(planes[p].y);
+			__m128 normalZ = _mm_set1_ps(planes[p].z);
+
+			__m128 distance = _mm_add_ps(
+				_mm_add_ps(_mm_max_ps(_mm_mul_ps(normalX, minX), _mm_mul_ps(normalX, maxX)),
+					_mm_max_ps(_mm_mul_ps(normalY, minY), _mm_mul_ps(normalY, maxY))),
+				_mm_add_ps(_mm_max_ps(_mm_mul_ps(normalZ, minZ), _mm_mul_ps(normalZ, maxZ)),
+					_mm_set1_ps(planes[p].w)));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, _mm_setzero_ps()));
+		}
+		visibleMask = ~_mm_movemask_ps(outside) & 0xF;
+#else
+		for (int lane = 0; lane < 4; ++lane)
+		{
+			GLuint i = lanes[lane];
+			bool inside = true;
+			for (int p = 0; p < 6 && inside; ++p)
+			{
+				const glm::vec4& plane = planes[p];
+				float distance = std::max(plane.x * bounds.minX[i], plane.x * bounds.maxX[i])
+					+ std::max(plane.y * bounds.minY[i], plane.y * bounds.maxY[i])
+					+ std::max(plane.z * bounds.minZ[i], plane.z * bounds.maxZ[i])
+					+ plane.w;
+				inside = distance >= 0.0f;
+			}
+
+			if (inside)
+			{
+				visibleMask |= 1 << lane;
+			}
+		}
+#endif
+
+		for (int lane = 0; lane < 4 && first + lane < candidateCount; ++lane)
+		{
+			if ((visibleMask & (1 << lane)) == 0)
+			{
+				continue;
+			}
+
+			// Extend the previous range if this quad directly follows it
+			size_t offset = lanes[lane] * indicesPerQuad * sizeof(GLuint);
+			if (!drawList.counts.empty() && offset == nextOffset)
+			{
+				drawList.counts.back() += indicesPerQuad;
+			}
+			else
+			{
+				drawList.counts.push_back(indicesPerQuad);
+				drawList.offsets.push_back(reinterpret_cast<const void*>(offset));
+			}
+			nextOffset = offset + indicesPerQuad * sizeof(GLuint);
+			++visibleCount;
+		}
+	}
+
+	return visibleCount;
+}
+
+/**
+ * @brief Splits a draw list into one draw list per wall cluster.
+ * @param[in] drawList Index ranges of the quads to draw
+ * @param[in] clusters Clusters from BuildWallClusters
+ * @param[out] clusterDrawLists Index ranges of the quads to draw in each cluster
+ */
+void SplitDrawList(const DrawList& drawList, const std::vector<WallCluster>& clusters, std::vector<DrawList>& clusterDrawLists)
+{
+	const GLsizei indicesPerQuad = 6;
+	clusterDrawLists.resize(clusters.size());
+	for (DrawList& clusterDrawList : clusterDrawLists)
+	{
+		clusterDrawList.counts.clear();
+		clusterDrawList.offsets.clear();
+	}
+
+	// Ranges are in increasing order, and so are the clusters, so both lists are walked once
+	size_t cluster = 0;
+	for (size_t range = 0; range < drawList.counts.size(); ++range)
+	{
+		GLuint firstQuad = static_cast<GLuint>(reinterpret_cast<size_t>(drawList.offsets[range]) / (indicesPerQuad * sizeof(GLuint)));
+		GLuint quadCount = static_cast<GLuint>(drawList.counts[range] / indicesPerQuad);
+		while (quadCount > 0)
+		{
+			while (firstQuad >= clusters[cluster].firstQuad + clusters[cluster].quadCount)
+			{
+				++cluster;
+			}
+
+			// A range can run on into the next cluster
+			GLuint clusterQuads = std::min(quadCount, clusters[cluster].firstQuad + clusters[cluster].quadCount - firstQuad);
+			clusterDrawLists[cluster].counts.push_back(static_cast<GLsizei>(clusterQuads * indicesPerQuad));
+			clusterDrawLists[cluster].offsets.push_back(reinterpret_cast<const void*>(firstQuad * indicesPerQuad * sizeof(GLuint)));
+			firstQuad += clusterQuads;
+			quadCount -= clusterQuads;
+		}
+	}
+}
+
+/**
+ * @brief Draws the static mesh: the ranges outside any cluster, and the given wall ranges of each cluster,
+ * letting the GPU skip clusters that last frame's occlusion queries found hidden.
+ * Clusters without a query go out in the same draw call as the ranges outside any cluster.
+ * The static mesh's vertex array object has to be bound already.
+ * @param[in] unclusteredRanges Index ranges that belong to no cluster and are always drawn, such as the floor
+ * @param[in] clusterDrawLists Index ranges to draw in each cluster
+ * @param[in] queries Occlusion queries issued last frame, one per cluster
+ * @param[in] queryIssued Whether each of those queries was issued. Clusters without one are always drawn.
+ * @param[in,out] batch Scratch draw list for the ranges drawn together, kept between calls so it isn't reallocated
+ */
+void DrawStaticMesh(const DrawList& unclusteredRanges, const std::vector<DrawList>& clusterDrawLists, const GLuint* queries, const char* queryIssued, DrawList& batch)
+{
+	batch.counts.assign(unclusteredRanges.counts.begin(), unclusteredRanges.counts.end());
+	batch.offsets.assign(unclusteredRanges.offsets.begin(), unclusteredRanges.offsets.end());
+	for (size_t i = 0; i < clusterDrawLists.size(); ++i)
+	{
+		if (!queryIssued[i])
+		{
+			batch.counts.insert(batch.counts.end(), clusterDrawLists[i].counts.begin(), clusterDrawLists[i].counts.end());
+			batch.offsets.insert(batch.offsets.end(), clusterDrawLists[i].offsets.begin(), clusterDrawLists[i].offsets.end());
+		}
+	}
+	if (!batch.counts.empty())
+	{
+		glMultiDrawElements(GL_TRIANGLES, batch.counts.data(), GL_UNSIGNED_INT, batch.offsets.data(), static_cast<GLsizei>(batch.counts.size()));
+	}
+
+	for (size_t i = 0; i < clusterDrawLists.size(); ++i)
+	{
+		const DrawList& clusterWalls = clusterDrawLists[i];
+		if (!queryIssued[i] || clusterWalls.counts.empty())
+		{
+			continue;
+		}
+
+		glBeginConditionalRender(queries[i], GL_QUERY_NO_WAIT);
+		glMultiDrawElements(GL_TRIANGLES, clusterWalls.counts.data(), GL_UNSIGNED_INT, clusterWalls.offsets.data(), static_cast<GLsizei>(clusterWalls.counts.size()));
+		glEndConditionalRender();
+	}
+}
+
+/**
+ * @brief Builds the potentially visible set of a level by casting rays across the grid from sample points in each cell.
+ * Walls are assumed to be taller than the camera, so visibility is worked out from above.
+ * Rays only go to the corners of cells that earlier rays reached, so the cost grows with how much can be seen rather than with the whole grid.
+ * The result is approximate: each cell only sees from a 9x9 grid of spots, widened by what its open neighbours see,
+ * so a quad that is only visible through a sliver between the spots can be missing and pop in as the camera moves.
+ * @param[in] level Level whose floor defines the grid
+ * @param[in] bounds Bounding boxes of the merged wall quads
+ * @param[out] pvs Potentially visible set
+ * @return True if the level is aligned to the grid and the set was built
+ */
+bool BuildPvs(const Level& level, const WallBounds& bounds, Pvs& pvs)
+{
+	const LevelHeader& header = *level.header;
+	const float epsilon = 0.001f;
+
+	float width = header.floorMaxX - header.floorMinX;
+	float depth = header.floorMaxZ - header.floorMinZ;
+	pvs.cellsX = static_cast<int>(std::round(width));
+	pvs.cellsZ = static_cast<int>(std::round(depth));
+	pvs.originX = header.floorMinX;
+	pvs.originZ = header.floorMinZ;
+	if (pvs.cellsX < 1 || pvs.cellsZ < 1 || std::fabs(width - pvs.cellsX) > epsilon || std::fabs(depth - pvs.cellsZ) > epsilon)
+	{
+		std::cerr << "Floor is not a whole number of cells, skipping PVS" << std::endl;
+		return false;
+	}
+
+	// Record which quad covers each cell edge that walls sit on. Walls aren't back-face culled, so either side of a quad counts.
+	std::vector<int> edgeQuadsX((pvs.cellsX + 1) * pvs.cellsZ, -1);
+	std::vector<int> edgeQuadsZ((pvs.cellsZ + 1) * pvs.cellsX, -1);
+	std::vector<char> onGrid(bounds.count, 0);
+	for (size_t quad = 0; quad < bounds.count; ++quad)
+	{
+		glm::vec2 quadMin = glm::vec2(bounds.minX[quad] - pvs.originX, bounds.minZ[quad] - pvs.originZ);
+		glm::vec2 quadMax = glm::vec2(bounds.maxX[quad] - pvs.originX, bounds.maxZ[quad] - pvs.originZ);
+		bool onXLine = quadMax.x - quadMin.x < epsilon;
+		bool onZLine = quadMax.y - quadMin.y < epsilon;
+
+		// Along the wall's line, it has to start and end on cell corners
+		float line = onXLine ? quadMin.x : quadMin.y;
+		float start = onXLine ? quadMin.y : quadMin.x;
+		float end = onXLine ? quadMax.y : quadMax.x;
+		if (onXLine == onZLine
+			|| std::fabs(line - std::round(line)) > epsilon
+			|| std::fabs(start - std::round(start)) > epsilon
+			|| std::fabs(end - std::round(end)) > epsilon)
+		{
+			std::cerr << "Wall quad " << quad << " is not aligned to the cell grid, skipping PVS" << std::endl;
+			return false;
+		}
+
+		int lineIndex = static_cast<int>(std::round(line));
+		int lineCount = onXLine ? pvs.cellsX : pvs.cellsZ;
+		int rowCount = onXLine ? pvs.cellsZ : pvs.cellsX;
+		if (lineIndex < 0 || lineIndex > lineCount)
+		{
+			// Outside the floor, so it can't come between two cells
+			continue;
+		}
+
+		std::vector<int>& edgeQuads = onXLine ? edgeQuadsX : edgeQuadsZ;
+		int firstRow = std::max(static_cast<int>(std::round(start)), 0);
+		int lastRow = std::min(static_cast<int>(std::round(end)), rowCount);
+		for (int row = firstRow; row < lastRow; ++row)
+		{
+			edgeQuads[lineIndex * rowCount + row] = static_cast<int>(quad);
+			onGrid[quad] = 1;
+		}
+	}
+
+	// No ray can reach a quad that lies on no edge of the grid, so every cell lists it instead
+	std::vector<GLuint> offGridQuads;
+	for (size_t quad = 0; quad < bounds.count; ++quad)
+	{
+		if (!onGrid[quad])
+		{
+			offGridQuads.push_back(static_cast<GLuint>(quad));
+		}
+	}
+
+	// Spots in each cell that rays are cast from. They reach right up to the cell's edges, where walls are seen at the most grazing angles.
+	const int viewSamplesPerAxis = 9;
+
+	// What a spot sees only changes at the angles of the cell corners, where a wall starts or ends. Casting a ray
+	// just either side of every corner therefore finds every wall visible from that spot.
+	const float cornerCos = std::cos(0.0001f);
+	const float cornerSin = std::sin(0.0001f);
+
+	// Those corners all belong to cells the spot can see into, so rather than aiming at every corner of the grid,
+	// the rays flood outwards: each cell a ray passes through adds its corners to aim at. Cells and corners are
+	// marked with the number of the spot that reached them, so the marks never need clearing.
+	int cellCount = pvs.cellsX * pvs.cellsZ;
+	int cornersX = pvs.cellsX + 1;
+	std::vector<int> cellReachedBy(cellCount, -1);
+	std::vector<int> cornerAimedBy(cornersX * (pvs.cellsZ + 1), -1);
+	std::vector<int> quadSeenBy(bounds.count, -1);
+	std::vector<std::vector<GLuint>> cellQuads(cellCount);
+	std::vector<int> reachedCells;
+	std::vector<int> crossedCells;
+	int spot = 0;
+	for (int cell = 0; cell < cellCount; ++cell)
+	{
+		int cellX = cell % pvs.cellsX;
+		int cellZ = cell / pvs.cellsX;
+		for (int v = 0; v < viewSamplesPerAxis * viewSamplesPerAxis; ++v, ++spot)
+		{
+			glm::vec2 from = glm::vec2(
+				cellX + epsilon + (1.0f - 2.0f * epsilon) * (v % viewSamplesPerAxis) / (viewSamplesPerAxis - 1),
+				cellZ + epsilon + (1.0f - 2.0f * epsilon) * (v / viewSamplesPerAxis) / (viewSamplesPerAxis - 1));
+
+			cellReachedBy[cell] = spot;
+			reachedCells.assign(1, cell);
+			while (!reachedCells.empty())
+			{
+				int reached = reachedCells.back();
+				reachedCells.pop_back();
+
+				for (int corner = 0; corner < 4; ++corner)
+				{
+					int cornerX = reached % pvs.cellsX + (corner & 1);
+					int cornerZ = reached / pvs.cellsX + (corner >> 1);
+					int& aimedBy = cornerAimedBy[cornerZ * cornersX + cornerX];
+					if (aimedBy == spot)
+					{
+						continue;
+					}
+					aimedBy = spot;
+
+					glm::vec2 direction = glm::vec2(cornerX, cornerZ) - from;
+					glm::vec2 sides[2] = {
+						glm::vec2(direction.x * cornerCos - direction.y * cornerSin, direction.x * cornerSin + direction.y * cornerCos),
+						glm::vec2(direction.x * cornerCos + direction.y * cornerSin, direction.y * cornerCos - direction.x * cornerSin)
+					};
+					for (const glm::vec2& side : sides)
+					{
+						crossedCells.clear();
+						int quad = TraceWallRay(edgeQuadsX, edgeQuadsZ, pvs.cellsX, pvs.cellsZ, from, side, crossedCells);
+						if (quad >= 0 && quadSeenBy[quad] != cell)
+						{
+							quadSeenBy[quad] = cell;
+							cellQuads[cell].push_back(static_cast<GLuint>(quad));
+						}
+
+						for (int crossed : crossedCells)
+						{
+							if (cellReachedBy[crossed] != spot)
+							{
+								cellReachedBy[crossed] = spot;
+								reachedCells.push_back(crossed);
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+
+	// The spots can still miss walls that are only seen through a sliver from between them. Each cell also takes
+	// what its open neighbours see, which covers the camera standing right at the edge they share.
+	pvs.cellStarts.assign(cellCount + 1, 0);
+	pvs.quads.clear();
+	std::vector<GLuint> visibleQuads;
+	for (int cellZ = 0; cellZ < pvs.cellsZ; ++cellZ)
+	{
+		for (int cellX = 0; cellX < pvs.cellsX; ++cellX)
+		{
+			int cell = cellZ * pvs.cellsX + cellX;
+			pvs.cellStarts[cell] = static_cast<GLuint>(pvs.quads.size());
+
+			bool openLeft = cellX > 0 && edgeQuadsX[cellX * pvs.cellsZ + cellZ] < 0;
+			bool openRight = cellX + 1 < pvs.cellsX && edgeQuadsX[(cellX + 1) * pvs.cellsZ + cellZ] < 0;
+			bool openBack = cellZ > 0 && edgeQuadsZ[cellZ * pvs.cellsX + cellX] < 0;
+			bool openFront = cellZ + 1 < pvs.cellsZ && edgeQuadsZ[(cellZ + 1) * pvs.cellsX + cellX] < 0;
+
+			visibleQuads = offGridQuads;
+			visibleQuads.insert(visibleQuads.end(), cellQuads[cell].begin(), cellQuads[cell].end());
+			if (openLeft) { visibleQuads.insert(visibleQuads.end(), cellQuads[cell - 1].begin(), cellQuads[cell - 1].end()); }
+			if (openRight) { visibleQuads.insert(visibleQuads.end(), cellQuads[cell + 1].begin(), cellQuads[cell + 1].end()); }
+			if (openBack) { visibleQuads.insert(visibleQuads.end(), cellQuads[cell - pvs.cellsX].begin(), cellQuads[cell - pvs.cellsX].end()); }
+			if (openFront) { visibleQuads.insert(visibleQuads.end(), cellQuads[cell + pvs.cellsX].begin(), cellQuads[cell + pvs.cellsX].end()); }
+
+			std::sort(visibleQuads.begin(), visibleQuads.end());
+			visibleQuads.erase(std::unique(visibleQuads.begin(), visibleQuads.end()), visibleQuads.end());
+			pvs.quads.insert(pvs.quads.end(), visibleQuads.begin(), visibleQuads.end());
+		}
+	}
+	pvs.cellStarts[cellCount] = static_cast<GLuint>(pvs.quads.size());
+
+	std::cout << "Built PVS for " << cellCount << " cells: " << pvs.quads.size() / cellCount << " of " << bounds.count
+		<< " wall quads potentially visible per cell on average, " << offGridQuads.size() << " of them off the grid and visible from every cell" << std::endl;
+	return true;
+}
+
+/**
+ * @brief Copies the potentially visible set out of a level file.
+ * @param[in] level Level that was loaded with LoadLevel
+ * @param[in] wallQuadCount Number of merged wall quads in the game's wall mesh
+ * @param[out] pvs Potentially visible set
+ * @return True if the level has a set, and it was built for the same wall quads
+ */
+bool LoadPvs(const Level& level, size_t wallQuadCount, Pvs& pvs)
+{
+	const LevelHeader& header = *level.header;
+	if (header.pvsCellsX == 0)
+	{
+		std::cerr << "Level has no potentially visible set, culling against every wall" << std::endl;
+		return false;
+	}
+
+	// The quad numbers only mean something if the game merged the walls the same way the baker did
+	if (header.pvsWallQuadCount != wallQuadCount)
+	{
+		std::cerr << "Potentially visible set was built for " << header.pvsWallQuadCount << " wall quads instead of " << wallQuadCount
+			<< ", rebake the level to use it" << std::endl;
+		return false;
+	}
+
+	int cellCount = static_cast<int>(header.pvsCellsX * header.pvsCellsZ);
+	pvs.cellsX = static_cast<int>(header.pvsCellsX);
+	pvs.cellsZ = static_cast<int>(header.pvsCellsZ);
+	pvs.originX = header.floorMinX;
+	pvs.originZ = header.floorMinZ;
+	pvs.cellStarts.assign(level.pvsCellStarts, level.pvsCellStarts + cellCount + 1);
+	pvs.quads.assign(level.pvsQuads, level.pvsQuads + header.pvsQuadCount);
+	return true;
+}
+
+/**
+ * @brief Walks a ray through the grid and finds the first wall it runs into.
+ * @param[in] edgeQuadsX Wall quad on each cell edge crossed when moving along X, or -1, indexed by line * cellsZ + row
+ * @param[in] edgeQuadsZ Wall quad on each cell edge crossed when moving along Z, or -1, indexed by line * cellsX + column
+ * @param[in] cellsX Number of cells along X
+ * @param[in] cellsZ Number of cells along Z
+ * @param[in] from Start of the ray in grid coordinates, inside the grid
+ * @param[in] direction Direction of the ray
+ * @param[out] crossedCells Receives the index of every cell the ray enters after the one it starts in
+ * @return Index of the wall quad the ray hits, or -1 if it leaves the grid first
+ */
+int TraceWallRay(const std::vector<int>& edgeQuadsX, const std::vector<int>& edgeQuadsZ, int cellsX, int cellsZ, glm::vec2 from, glm::vec2 direction,
+	std::vector<int>& crossedCells)
+{
+	// Grid traversal (Amanatides and Woo): step into whichever neighbouring cell the ray reaches first
+	int cellX = static_cast<int>(std::floor(from.x));
+	int cellZ = static_cast<int>(std::floor(from.y));
+	int stepX = direction.x > 0.0f ? 1 : -1;
+	int stepZ = direction.y > 0.0f ? 1 : -1;
+
+	// Distance along the ray at which the next X and Z cell edges are crossed, and the distance between edges
+	const float never = std::numeric_limits<float>::max();
+	float nextX = direction.x != 0.0f ? ((stepX > 0 ? cellX + 1 : cellX) - from.x) / direction.x : never;
+	float nextZ = direction.y != 0.0f ? ((stepZ > 0 ? cellZ + 1 : cellZ) - from.y) / direction.y : never;
+	float deltaX = direction.x != 0.0f ? std::fabs(1.0f / direction.x) : never;
+	float deltaZ = direction.y != 0.0f ? std::fabs(1.0f / direction.y) : never;
+
+	while (cellX >= 0 && cellX < cellsX && cellZ >= 0 && cellZ < cellsZ)
+	{
+		if (nextX < nextZ)
+		{
+			int quad = edgeQuadsX[(stepX > 0 ? cellX + 1 : cellX) * cellsZ + cellZ];
+			if (quad >= 0)
+			{
+				return quad;
+			}
+
+			cellX += stepX;
+			nextX += deltaX;
+		}
+		else
+		{
+			int quad = edgeQuadsZ[(stepZ > 0 ? cellZ + 1 : cellZ) * cellsX + cellX];
+			if (quad >= 0)
+			{
+				return quad;
+			}
+
+			cellZ += stepZ;
+			nextZ += deltaZ;
+		}
+
+		if (cellX >= 0 && cellX < cellsX && cellZ >= 0 && cellZ < cellsZ)
+		{
+			crossedCells.push_back(cellZ * cellsX + cellX);
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * @brief Uploads the wall quads' bounds, the candidate lists and the initial draw commands for culling on the GPU.
+ * The compute program is created along with the others, and has to be set in culling.program afterwards.
+ * @param[in] bounds Bounding boxes of the wall quads
+ * @param[in] clusters Clusters from BuildWallClusters
+ * @param[in] pvs Potentially visible set, or an empty one if the level has none
+ * @param[in] staticIndices Indices of the static mesh, which the visible wall indices replace and the floor's are kept from
+ * @param[out] culling Buffers for culling on the GPU
+ */
+void CreateGpuWallCulling(const WallBounds& bounds, const std::vector<WallCluster>& clusters, const Pvs& pvs, const std::vector<GLuint>& staticIndices, GpuWallCulling& culling)
+{
+	culling = GpuWallCulling();
+	culling.clusterCount = clusters.size();
+
+	std::vector<GpuWallQuad> quads(bounds.count);
+	for (size_t cluster = 0; cluster < clusters.size(); ++cluster)
+	{
+		for (GLuint quad = clusters[cluster].firstQuad; quad < clusters[cluster].firstQuad + clusters[cluster].quadCount; ++quad)
+		{
+			quads[quad].boundsMin = glm::vec3(bounds.minX[quad], bounds.minY[quad], bounds.minZ[quad]);
+			quads[quad].boundsMax = glm::vec3(bounds.maxX[quad], bounds.maxY[quad], bounds.maxZ[quad]);
+			quads[quad].cluster = static_cast<GLuint>(cluster);
+			quads[quad].padding = 0;
+		}
+	}
 
-	// Render loop
-	while (!glfwWindowShouldClose(window))
+	std::vector<GLuint> candidates(pvs.quads);
+	culling.allQuadsOffset = static_cast<GLint>(candidates.size());
+	for (size_t quad = 0; quad < bounds.count; ++quad)
 	{
-		GLfloat time = glfwGetTime();
-		GLfloat deltaTime = time - prevTime;
-		prevTime = time;
+		candidates.push_back(static_cast<GLuint>(quad));
+	}
 
-		glfwGetCursorPos(window, &xpos, &ypos);
-		glfwSetCursorPos(window, (double)windowWidth / 2, (double)windowHeight / 2);
-		glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+	// Each cluster draws from its own part of indexBuffer, where its quads' indices are in the static index buffer
+	std::vector<DrawElementsIndirectCommand> commands(clusters.size());
+	for (size_t cluster = 0; cluster < clusters.size(); ++cluster)
+	{
+		commands[cluster].count = 0;
+		commands[cluster].instanceCount = 1;
+		commands[cluster].firstIndex = clusters[cluster].firstQuad * 6;
+		commands[cluster].baseVertex = 0;
+		commands[cluster].baseInstance = 0;
+	}
 
-		angleX += mouseSpeed * deltaTime * float(windowWidth / 2 - xpos);
-		angleY += mouseSpeed * deltaTime * float(windowHeight / 2 - ypos);
+	GLuint buffers[5];
+	glGenBuffers(5, buffers);
+	culling.quadBuffer = buffers[0];
+	culling.candidateBuffer = buffers[1];
+	culling.commandBuffer = buffers[2];
+	culling.commandResetBuffer = buffers[3];
+	culling.indexBuffer = buffers[4];
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, culling.quadBuffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, quads.size() * sizeof(GpuWallQuad), quads.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, culling.candidateBuffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, candidates.size() * sizeof(GLuint), candidates.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, culling.commandBuffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data(), GL_DYNAMIC_COPY);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, culling.commandResetBuffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data(), GL_STATIC_COPY);
+
+	// Starting from the static indices puts the floor's indices in place, and they are never overwritten
+	glBindBuffer(GL_COPY_WRITE_BUFFER, culling.indexBuffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, staticIndices.size() * sizeof(GLuint), staticIndices.data(), GL_DYNAMIC_COPY);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
 
-		if (angleY * (180/M_PI) > 89) { angleY = 89 * (M_PI/180); }
-		if (angleY * (180/M_PI) < -89) { angleY = -89 * (M_PI / 180); }
-		glm::vec3 cameraTarget(cos(angleY) * sin(angleX), sin(angleY), cos(angleY) * cos(angleX));
-		glm::vec3 right(sin(angleX - M_PI / 2.0f), 0.0f, cos(angleX - M_PI / 2.0f));
-		glm::vec3 cameraUp = glm::cross(right, cameraTarget);
+/**
+ * @brief Culls wall quads against the view frustum in FrameUniforms, filling in culling.commandBuffer and culling.indexBuffer.
+ * The frame uniforms have to be bound already.
+ * @param[in] culling Buffers and program for culling on the GPU
+ * @param[in] firstCandidate Position of the first quad to test in culling.candidateBuffer
+ * @param[in] candidateCount Number of quads to test
+ */
+void DispatchGpuWallCulling(const GpuWallCulling& culling, GLint firstCandidate, GLint candidateCount)
+{
+#ifdef GL_VERSION_4_3
+	// Clear the counts left by the last frame
+	glBindBuffer(GL_COPY_READ_BUFFER, culling.commandResetBuffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, culling.commandBuffer);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, culling.clusterCount * sizeof(DrawElementsIndirectCommand));
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	// Must match the bindings in cullingShader.csh
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, culling.quadBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, culling.candidateBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, culling.commandBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, culling.indexBuffer);
+
+	// One invocation per candidate, in groups of 64 as declared in the shader
+	const GLint groupSize = 64;
+	glUseProgram(culling.program.id);
+	SetUniform(culling.firstCandidateUniform, firstCandidate);
+	SetUniform(culling.candidateCountUniform, candidateCount);
+	glDispatchCompute((candidateCount + groupSize - 1) / groupSize, 1, 1);
+
+	// The draws read the commands and indices, and next frame's reset overwrites the commands
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_ELEMENT_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+#endif
+}
 
-		glm::vec3 upcomingCameraPosition = cameraPosition;
+/**
+ * @brief Draws the static mesh with the wall quads that DispatchGpuWallCulling found visible, letting the GPU skip
+ * clusters that last frame's occlusion queries found hidden. Runs of clusters without a query go out in one draw call.
+ * A vertex array object that reads culling.indexBuffer has to be bound already.
+ * @param[in] culling Buffers for culling on the GPU
+ * @param[in] unclusteredRanges Index ranges that belong to no cluster and are always drawn, such as the floor
+ * @param[in] queries Occlusion queries issued last frame, one per cluster
+ * @param[in] queryIssued Whether each of those queries was issued. Clusters without one are always drawn.
+ */
+void DrawGpuCulledStaticMesh(const GpuWallCulling& culling, const DrawList& unclusteredRanges, const GLuint* queries, const char* queryIssued)
+{
+#ifdef GL_VERSION_4_3
+	if (!unclusteredRanges.counts.empty())
+	{
+		glMultiDrawElements(GL_TRIANGLES, unclusteredRanges.counts.data(), GL_UNSIGNED_INT, unclusteredRanges.offsets.data(), static_cast<GLsizei>(unclusteredRanges.counts.size()));
+	}
 
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, culling.commandBuffer);
+	size_t cluster = 0;
+	while (cluster < culling.clusterCount)
+	{
+		const void* command = reinterpret_cast<const void*>(cluster * sizeof(DrawElementsIndirectCommand));
+		if (queryIssued[cluster])
+		{
+			glBeginConditionalRender(queries[cluster], GL_QUERY_NO_WAIT);
+			glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, command);
+			glEndConditionalRender();
+			++cluster;
+			continue;
+		}
 
-		if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
+		size_t firstCluster = cluster;
+		while (cluster < culling.clusterCount && !queryIssued[cluster])
 		{
-			upcomingCameraPosition += camSpeed * deltaTime * glm::normalize(glm::vec3(cameraTarget.x, 0.0f, cameraTarget.z));
+			++cluster;
+		}
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, command, static_cast<GLsizei>(cluster - firstCluster), 0);
+	}
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+#endif
+}
+
+/**
+ * @brief Deletes the program, buffers and vertex array objects used for culling on the GPU.
+ * @param[in,out] culling Buffers for culling on the GPU
+ */
+void DeleteGpuWallCulling(GpuWallCulling& culling)
+{
+	GLuint buffers[5] = { culling.quadBuffer, culling.candidateBuffer, culling.commandBuffer, culling.commandResetBuffer, culling.indexBuffer };
+	glDeleteBuffers(5, buffers);
+	glDeleteVertexArrays(1, &culling.vao);
+	glDeleteVertexArrays(1, &culling.depthVao);
+	glDeleteProgram(culling.program.id);
+	culling = GpuWallCulling();
+}
+
+/**
+ * @brief Computes the view-space bounding box of every light cluster.
+ * @param[in] perspective Symmetric perspective projection of the camera
+ * @param[in] nearPlane Distance where the first depth slice starts
+ * @param[in] farPlane Distance where the last depth slice ends
+ * @param[out] grid Cluster bounding boxes
+ */
+void BuildLightClusterGrid(const glm::mat4& perspective, float nearPlane, float farPlane, LightClusterGrid& grid)
+{
+	grid.perspective = perspective;
+	grid.nearPlane = nearPlane;
+	grid.farPlane = farPlane;
+	grid.min.resize(LIGHT_CLUSTERS_X * LIGHT_CLUSTERS_Y * LIGHT_CLUSTERS_Z);
+	grid.max.resize(grid.min.size());
+
+	for (int slice = 0; slice < LIGHT_CLUSTERS_Z; ++slice)
+	{
+		float sliceNear = nearPlane * std::pow(farPlane / nearPlane, static_cast<float>(slice) / LIGHT_CLUSTERS_Z);
+		float sliceFar = nearPlane * std::pow(farPlane / nearPlane, static_cast<float>(slice + 1) / LIGHT_CLUSTERS_Z);
 
-			if (checkCollision(upcomingCameraPosition, hitboxArray) == false)
+		for (int tileY = 0; tileY < LIGHT_CLUSTERS_Y; ++tileY)
+		{
+			for (int tileX = 0; tileX < LIGHT_CLUSTERS_X; ++tileX)
 			{
-				if (glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS)
-				{
-					cameraPosition += (camSpeed + 0.25f) * deltaTime * glm::normalize(glm::vec3(cameraTarget.x, 0.0f, cameraTarget.z));
-				}
-				else
+				// A point at normalized device coordinates (x, y) and distance d is at (x * d / P[0][0], y * d / P[1][1], -d)
+				glm::vec3 clusterMin = glm::vec3(std::numeric_limits<float>::max());
+				glm::vec3 clusterMax = glm::vec3(-std::numeric_limits<float>::max());
+				for (int corner = 0; corner < 8; ++corner)
 				{
-					cameraPosition += camSpeed * deltaTime * glm::normalize(glm::vec3(cameraTarget.x, 0.0f, cameraTarget.z));
+					float ndcX = -1.0f + 2.0f * (tileX + (corner & 1)) / LIGHT_CLUSTERS_X;
+					float ndcY = -1.0f + 2.0f * (tileY + ((corner >> 1) & 1)) / LIGHT_CLUSTERS_Y;
+					float distance = (corner & 4) ? sliceFar : sliceNear;
+					glm::vec3 point = glm::vec3(ndcX * distance / perspective[0][0], ndcY * distance / perspective[1][1], -distance);
+					clusterMin = glm::min(clusterMin, point);
+					clusterMax = glm::max(clusterMax, point);
 				}
-				
+
+				int cluster = (slice * LIGHT_CLUSTERS_Y + tileY) * LIGHT_CLUSTERS_X + tileX;
+				grid.min[cluster] = clusterMin;
+				grid.max[cluster] = clusterMax;
 			}
-			else
+		}
+	}
+}
+
+/**
+ * @brief Works out how bright a flickering light is at a point in time.
+ * @param[in] light Light to evaluate
+ * @param[in] lightIndex Index of the light in the level, so that lights flicker out of step with each other
+ * @param[in] time Time in seconds
+ * @return Brightness from 0 to 1
+ */
+float GetLightFlicker(const LevelLight& light, uint32_t lightIndex, float time)
+{
+	// Two sine waves at unrelated rates look irregular enough, and stay within 0 to 1
+	float phase = lightIndex * 2.39996f;
+	float wave = 0.5f + 0.25f * std::sin(time * 7.3f + phase) + 0.25f * std::sin(time * 13.1f + phase * 2.0f);
+	return 1.0f - light.flicker * wave;
+}
+
+/**
+ * @brief Bins the level's lights into the clusters their radius reaches.
+ * @param[in] level Level whose lights are binned
+ * @param[in] time Time in seconds, for flickering
+ * @param[in] camera View matrix of the camera
+ * @param[in] grid Cluster bounding boxes from BuildLightClusterGrid
+ * @param[out] clusters Light data and per-cluster light lists
+ * @return Total number of lights across all clusters
+ */
+size_t AssignLightsToClusters(const Level& level, float time, const glm::mat4& camera, const LightClusterGrid& grid, LightClusters& clusters)
+{
+	const LevelHeader& header = *level.header;
+	const int clusterCount = LIGHT_CLUSTERS_X * LIGHT_CLUSTERS_Y * LIGHT_CLUSTERS_Z;
+	const float sliceScale = LIGHT_CLUSTERS_Z / std::log(grid.farPlane / grid.nearPlane);
+
+	clusters.lightData.resize(header.lightCount * 3);
+	clusters.clusterRanges.assign(clusterCount * 2, 0);
+	clusters.lightIndices.clear();
+
+	// Every cluster each light touches, as (cluster, light) pairs. They are sorted by cluster afterwards.
+	std::vector<std::pair<GLuint, GLuint>> touches;
+	for (uint32_t i = 0; i < header.lightCount; ++i)
+	{
+		const LevelLight& light = level.lights[i];
+		glm::vec3 position = glm::vec3(light.x, light.y, light.z);
+		glm::vec3 color = glm::vec3(light.r, light.g, light.b) * GetLightFlicker(light, i, time);
+
+		// Point lights get a cone that lets everything through
+		float outerCosine = -2.0f;
+		float innerCosine = -1.0f;
+		if (light.spotAngle > 0.0f)
+		{
+			outerCosine = std::cos(glm::radians(light.spotAngle));
+			innerCosine = std::cos(glm::radians(light.spotAngle * 0.8f));
+		}
+
+		clusters.lightData[i * 3] = glm::vec4(position, light.radius);
+		clusters.lightData[i * 3 + 1] = glm::vec4(color, outerCosine);
+		clusters.lightData[i * 3 + 2] = glm::vec4(light.directionX, light.directionY, light.directionZ, innerCosine);
+
+		// Spot lights are binned by the sphere around their whole radius too
+		glm::vec3 center = glm::vec3(camera * glm::vec4(position, 1.0f));
+		float distance = -center.z;
+		if (distance + light.radius < grid.nearPlane || distance - light.radius > grid.farPlane)
+		{
+			continue;
+		}
+
+		auto sliceOf = [&](float sliceDistance)
+		{
+			int slice = static_cast<int>(std::floor(std::log(sliceDistance / grid.nearPlane) * sliceScale));
+			return glm::clamp(slice, 0, LIGHT_CLUSTERS_Z - 1);
+		};
+		int firstSlice = sliceOf(std::max(distance - light.radius, grid.nearPlane));
+		int lastSlice = sliceOf(std::min(distance + light.radius, grid.farPlane));
+
+		// The tiles covered by the light's view-space bounding box. Its extremes on screen are at its corners,
+		// unless it reaches the near plane, in which case it could cover anything.
+		int firstTileX = 0, lastTileX = LIGHT_CLUSTERS_X - 1;
+		int firstTileY = 0, lastTileY = LIGHT_CLUSTERS_Y - 1;
+		if (distance - light.radius > grid.nearPlane)
+		{
+			glm::vec2 ndcMin = glm::vec2(std::numeric_limits<float>::max());
+			glm::vec2 ndcMax = glm::vec2(-std::numeric_limits<float>::max());
+			for (int corner = 0; corner < 8; ++corner)
 			{
-				if (collidedWall.isXWall())
-				{
-					cameraPosition += camSpeed * deltaTime * glm::normalize(glm::vec3(0.0f, 0.0f, cameraTarget.z));
-				}
-				else if (collidedWall.isZWall())
+				glm::vec3 point = center + glm::vec3((corner & 1) ? light.radius : -light.radius,
+					(corner & 2) ? light.radius : -light.radius, (corner & 4) ? light.radius : -light.radius);
+				glm::vec2 ndc = glm::vec2(grid.perspective[0][0] * point.x, grid.perspective[1][1] * point.y) / -point.z;
+				ndcMin = glm::min(ndcMin, ndc);
+				ndcMax = glm::max(ndcMax, ndc);
+			}
+
+			if (ndcMax.x < -1.0f || ndcMin.x > 1.0f || ndcMax.y < -1.0f || ndcMin.y > 1.0f)
+			{
+				continue;
+			}
+
+			firstTileX = glm::clamp(static_cast<int>(std::floor((ndcMin.x + 1.0f) * 0.5f * LIGHT_CLUSTERS_X)), 0, LIGHT_CLUSTERS_X - 1);
+			lastTileX = glm::clamp(static_cast<int>(std::floor((ndcMax.x + 1.0f) * 0.5f * LIGHT_CLUSTERS_X)), 0, LIGHT_CLUSTERS_X - 1);
+			firstTileY = glm::clamp(static_cast<int>(std::floor((ndcMin.y + 1.0f) * 0.5f * LIGHT_CLUSTERS_Y)), 0, LIGHT_CLUSTERS_Y - 1);
+			lastTileY = glm::clamp(static_cast<int>(std::floor((ndcMax.y + 1.0f) * 0.5f * LIGHT_CLUSTERS_Y)), 0, LIGHT_CLUSTERS_Y - 1);
+		}
+
+		// Within that range, keep the clusters whose box is actually within the light's radius
+		for (int slice = firstSlice; slice <= lastSlice; ++slice)
+		{
+			for (int tileY = firstTileY; tileY <= lastTileY; ++tileY)
+			{
+				for (int tileX = firstTileX; tileX <= lastTileX; ++tileX)
 				{
-					cameraPosition += camSpeed * deltaTime * glm::normalize(glm::vec3(cameraTarget.x, 0.0f, 0.0f));
+					int cluster = (slice * LIGHT_CLUSTERS_Y + tileY) * LIGHT_CLUSTERS_X + tileX;
+					glm::vec3 nearestPoint = glm::clamp(center, grid.min[cluster], grid.max[cluster]);
+					glm::vec3 offset = nearestPoint - center;
+					if (glm::dot(offset, offset) <= light.radius * light.radius)
+					{
+						touches.push_back(std::make_pair(static_cast<GLuint>(cluster), static_cast<GLuint>(i)));
+					}
 				}
 			}
+		}
+	}
+
+	// Count the lights in each cluster, then give each cluster its own run of lightIndices
+	for (const auto& touch : touches)
+	{
+		++clusters.clusterRanges[touch.first * 2 + 1];
+	}
+
+	GLuint first = 0;
+	for (int cluster = 0; cluster < clusterCount; ++cluster)
+	{
+		clusters.clusterRanges[cluster * 2] = first;
+		first += clusters.clusterRanges[cluster * 2 + 1];
+	}
+
+	std::vector<GLuint> filled(clusterCount, 0);
+	clusters.lightIndices.resize(touches.size());
+	for (const auto& touch : touches)
+	{
+		clusters.lightIndices[clusters.clusterRanges[touch.first * 2] + filled[touch.first]++] = touch.second;
+	}
+
+	return touches.size();
+}
+
+/**
+ * @brief Sets up a stream buffer with one region per frame in flight.
+ * @param[out] stream Stream buffer to set up
+ * @param[in] regionSize Most bytes written in a single frame, including alignment padding
+ * @param[in] alignment Every write starts at a multiple of this many bytes
+ */
+void CreateStreamBuffer(StreamBuffer& stream, GLsizeiptr regionSize, GLsizeiptr alignment)
+{
+	stream = StreamBuffer();
+	stream.alignment = alignment;
+	stream.regionSize = (regionSize + alignment - 1) / alignment * alignment;
+
+	// Start on the last region, so the first frame writes to the first one
+	stream.frame = STREAM_BUFFER_FRAMES - 1;
+
+	GLsizeiptr bufferSize = stream.regionSize * STREAM_BUFFER_FRAMES;
+	glGenBuffers(1, &stream.buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, stream.buffer);
+
+	// With immutable storage the buffer can stay mapped while the GPU reads from it. A coherent mapping makes
+	// the writes visible to the GPU without flushing them.
+#ifdef GL_ARB_buffer_storage
+	if (GLAD_GL_ARB_buffer_storage || GLAD_GL_VERSION_4_4)
+	{
+		const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_COPY_WRITE_BUFFER, bufferSize, nullptr, flags);
+		stream.mapped = static_cast<char*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, bufferSize, flags));
+		if (!stream.mapped)
+		{
+			// Immutable storage can't be reallocated, so start over with a new buffer
+			std::cerr << "Failed to map the stream buffer, falling back to glBufferSubData" << std::endl;
+			glDeleteBuffers(1, &stream.buffer);
+			glGenBuffers(1, &stream.buffer);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, stream.buffer);
+		}
+	}
+#endif
+	if (!stream.mapped)
+	{
+		glBufferData(GL_COPY_WRITE_BUFFER, bufferSize, nullptr, GL_STREAM_DRAW);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+/**
+ * @brief Moves on to the next region of a stream buffer, waiting for the GPU to finish reading it if it still is.
+ * @param[in,out] stream Stream buffer
+ */
+void BeginStreamFrame(StreamBuffer& stream)
+{
+	stream.frame = (stream.frame + 1) % STREAM_BUFFER_FRAMES;
+	stream.offset = 0;
+
+	// The frame that used this region was submitted STREAM_BUFFER_FRAMES - 1 frames ago, so it has usually finished
+	GLsync& fence = stream.fences[stream.frame];
+	if (fence)
+	{
+		const GLuint64 timeout = 1000000;	// 1 ms in nanoseconds
+		GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		while (result == GL_TIMEOUT_EXPIRED)
+		{
+			result = glClientWaitSync(fence, 0, timeout);
+		}
+		glDeleteSync(fence);
+		fence = nullptr;
+	}
+}
+
+/**
+ * @brief Copies data into the current region of a stream buffer.
+ * @param[in,out] stream Stream buffer
+ * @param[in] data Data to copy
+ * @param[in] size Size of the data in bytes
+ * @return Offset of the data from the start of the buffer, or -1 if the region is full
+ */
+GLintptr WriteStreamBuffer(StreamBuffer& stream, const void* data, GLsizeiptr size)
+{
+	GLsizeiptr offset = (stream.offset + stream.alignment - 1) / stream.alignment * stream.alignment;
+	if (offset + size > stream.regionSize)
+	{
+		std::cerr << "Stream buffer region of " << stream.regionSize << " bytes is too small for this frame" << std::endl;
+		return -1;
+	}
+	stream.offset = offset + size;
+
+	GLintptr bufferOffset = stream.frame * stream.regionSize + offset;
+	if (size == 0)
+	{
+		return bufferOffset;
+	}
+
+	if (stream.mapped)
+	{
+		std::memcpy(stream.mapped + bufferOffset, data, size);
+	}
+	else
+	{
+		// The GPU is done with this region, so the driver can write it in place
+		glBindBuffer(GL_COPY_WRITE_BUFFER, stream.buffer);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, bufferOffset, size, data);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+	return bufferOffset;
+}
+
+/**
+ * @brief Fences the current region of a stream buffer. Call this after the last command that reads from it.
+ * @param[in,out] stream Stream buffer
+ */
+void EndStreamFrame(StreamBuffer& stream)
+{
+	stream.fences[stream.frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+/**
+ * @brief Unmaps and deletes a stream buffer.
+ * @param[in,out] stream Stream buffer
+ */
+void DeleteStreamBuffer(StreamBuffer& stream)
+{
+	for (GLsync& fence : stream.fences)
+	{
+		if (fence)
+		{
+			glDeleteSync(fence);
+			fence = nullptr;
+		}
+	}
+
+	if (stream.mapped)
+	{
+		glBindBuffer(GL_COPY_WRITE_BUFFER, stream.buffer);
+		glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		stream.mapped = nullptr;
+	}
+	glDeleteBuffers(1, &stream.buffer);
+	stream.buffer = 0;
+}
+
+/**
+ * @brief Computes the world-space box that encloses the floor and every wall tile of a level.
+ * @param[in] level Level to measure
+ * @param[out] boundsMin Minimum corner of the box
+ * @param[out] boundsMax Maximum corner of the box
+ */
+void GetLevelBounds(const Level& level, glm::vec3& boundsMin, glm::vec3& boundsMax)
+{
+	const LevelHeader& header = *level.header;
+	boundsMin = glm::vec3(header.floorMinX, header.floorHeight, header.floorMinZ);
+	boundsMax = glm::vec3(header.floorMaxX, header.floorHeight, header.floorMaxZ);
+
+	// Every wall tile is a unit quad, so a unit cube around its center encloses it whatever its orientation
+	for (uint32_t i = 0; i < header.tileCount; ++i)
+	{
+		glm::vec3 center = glm::vec3(level.tileTransforms[i][3]);
+		boundsMin = glm::min(boundsMin, center - 0.5f);
+		boundsMax = glm::max(boundsMax, center + 0.5f);
+	}
+}
+
+/**
+ * @brief Transforms a box and computes the axis-aligned box that encloses the result.
+ * @param[in] transform Transform to apply
+ * @param[in] boundsMin Minimum corner of the box
+ * @param[in] boundsMax Maximum corner of the box
+ * @param[out] transformedMin Minimum corner of the transformed box
+ * @param[out] transformedMax Maximum corner of the transformed box
+ */
+void TransformBounds(const glm::mat4& transform, const glm::vec3& boundsMin, const glm::vec3& boundsMax, glm::vec3& transformedMin, glm::vec3& transformedMax)
+{
+	transformedMin = glm::vec3(std::numeric_limits<float>::max());
+	transformedMax = glm::vec3(-std::numeric_limits<float>::max());
+	for (int corner = 0; corner < 8; ++corner)
+	{
+		glm::vec3 worldCorner = glm::vec3(
+			(corner & 1) ? boundsMax.x : boundsMin.x,
+			(corner & 2) ? boundsMax.y : boundsMin.y,
+			(corner & 4) ? boundsMax.z : boundsMin.z);
+		glm::vec3 transformedCorner = glm::vec3(transform * glm::vec4(worldCorner, 1.0f));
+		transformedMin = glm::min(transformedMin, transformedCorner);
+		transformedMax = glm::max(transformedMax, transformedCorner);
+	}
+}
+
+/**
+ * @brief Splits a view-space depth range into shadow cascades, blending logarithmic and uniform split schemes.
+ * @param[in] nearPlane Start of the depth range
+ * @param[in] farPlane End of the depth range
+ * @param[in] cascadeCount Number of cascades
+ * @param[out] splitDistances Receives cascadeCount + 1 distances. Cascade i covers splitDistances[i] to splitDistances[i + 1].
+ */
+void ComputeCascadeSplits(float nearPlane, float farPlane, int cascadeCount, float* splitDistances)
+{
+	// Mostly logarithmic, which keeps texel density even across cascades, with some uniform mixed in
+	// so the first cascade doesn't become tiny
+	const float logarithmicWeight = 0.75f;
+
+	splitDistances[0] = nearPlane;
+	for (int i = 1; i <= cascadeCount; ++i)
+	{
+		float fraction = static_cast<float>(i) / cascadeCount;
+		float logarithmicSplit = nearPlane * std::pow(farPlane / nearPlane, fraction);
+		float uniformSplit = nearPlane + (farPlane - nearPlane) * fraction;
+		splitDistances[i] = glm::mix(uniformSplit, logarithmicSplit, logarithmicWeight);
+	}
+}
+
+/**
+ * @brief Creates the orthographic light projection of one shadow cascade.
+ * The projection encloses a sphere around the camera position that reaches the slice's far corners.
+ * It ignores which way the camera faces, so it stays the same while the camera turns,
+ * and it is snapped to whole texels, so it only moves in texel steps while the camera moves.
+ * @param[in] lightView View matrix of the light
+ * @param[in] camera View matrix of the camera
+ * @param[in] fieldOfView Vertical field of view of the camera in radians
+ * @param[in] aspectRatio Aspect ratio of the camera
+ * @param[in] splitFar View-space distance where the cascade ends
+ * @param[in] levelLightMin Minimum corner of the level's bounds in the light's view space
+ * @param[in] levelLightMax Maximum corner of the level's bounds in the light's view space
+ * @param[in] shadowMapSize Width and height of the cascade's shadow map in texels
+ * @return Orthographic projection matrix for the cascade
+ */
+glm::mat4 FitCascadeProjection(const glm::mat4& lightView, const glm::mat4& camera, float fieldOfView, float aspectRatio,
+	float splitFar, const glm::vec3& levelLightMin, const glm::vec3& levelLightMax, int shadowMapSize)
+{
+	// Every point of the slice is at most this far from the camera, whichever way it faces
+	float tanHalfFov = std::tan(fieldOfView * 0.5f);
+	float farHalfHeight = splitFar * tanHalfFov;
+	float farHalfWidth = farHalfHeight * aspectRatio;
+	float radius = std::sqrt(splitFar * splitFar + farHalfHeight * farHalfHeight + farHalfWidth * farHalfWidth);
+	radius = std::ceil(radius * 16.0f) / 16.0f;
+
+	// Anchoring the sphere at the camera position rather than at the slice's centroid
+	// keeps it in place while the camera turns, so the cascade's ShadowCache stays valid
+	glm::vec3 center = glm::vec3(lightView * glm::inverse(camera) * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+
+	float left, right, bottom, top;
+	if (2.0f * radius >= std::max(levelLightMax.x - levelLightMin.x, levelLightMax.y - levelLightMin.y))
+	{
+		// The slice is at least as big as the whole level, so covering the level is both smaller and stable
+		left = levelLightMin.x;
+		right = levelLightMax.x;
+		bottom = levelLightMin.y;
+		top = levelLightMax.y;
+	}
+	else
+	{
+		// Move the cascade in whole texel steps, so shadow edges don't shimmer as the camera moves
+		float texelSize = 2.0f * radius / shadowMapSize;
+		center.x = std::floor(center.x / texelSize) * texelSize;
+		center.y = std::floor(center.y / texelSize) * texelSize;
+
+		left = center.x - radius;
+		right = center.x + radius;
+		bottom = center.y - radius;
+		top = center.y + radius;
+	}
+
+	// Cover the level's whole depth range, so walls outside the slice still cast shadows into it.
+	// The light looks down -Z in view space, so the near and far planes are the negated Z extents,
+	// padded slightly so that geometry touching the bounds isn't clipped.
+	const float depthPadding = 0.1f;
+	return glm::ortho(left, right, bottom, top, -levelLightMax.z - depthPadding, -levelLightMin.z + depthPadding);
+}
+
+/**
+ * @brief Binds a buffer of per-instance transforms to vertex attributes 4 to 10 of a vertex array object.
+ * The model matrix goes to attributes 4 to 7 and the normal matrix to attributes 8 to 10.
+ * @param[in] vao Vertex array object to set up
+ * @param[in] instanceVbo Buffer containing one InstanceData per instance
+ */
+void SetupInstanceAttributes(GLuint vao, GLuint instanceVbo)
+{
+	glBindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, instanceVbo);
+
+	// A mat4 attribute takes up four consecutive locations, one per column,
+	// and advances once per instance instead of once per vertex
+	for (GLuint column = 0; column < 4; column++)
+	{
+		glEnableVertexAttribArray(4 + column);
+		glVertexAttribPointer(4 + column, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(offsetof(InstanceData, modelMatrix) + sizeof(glm::vec4) * column));
+		glVertexAttribDivisor(4 + column, 1);
+	}
+
+	// Likewise a mat3 takes up three
+	for (GLuint column = 0; column < 3; column++)
+	{
+		glEnableVertexAttribArray(8 + column);
+		glVertexAttribPointer(8 + column, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(offsetof(InstanceData, normalMatrix) + sizeof(glm::vec3) * column));
+		glVertexAttribDivisor(8 + column, 1);
+	}
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/**
+ * @brief Binds the static mesh's index buffer and vertex streams to a vertex array object.
+ * @param[in] vao Vertex array object to set up
+ * @param[in] indexBuffer Index buffer to draw from
+ * @param[in] positionVbo Buffer containing one position per vertex, for attribute 0
+ * @param[in] attributeVbo Buffer containing one PackedVertex per vertex, for attributes 2, 3 and 11. 0 leaves them out, for depth-only passes.
+ */
+void SetupStaticMeshAttributes(GLuint vao, GLuint indexBuffer, GLuint positionVbo, GLuint attributeVbo)
+{
+	glBindVertexArray(vao);
+
+	// The element buffer binding is stored in the VAO
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+
+	// Vertex attribute 0 - Position
+	glBindBuffer(GL_ARRAY_BUFFER, positionVbo);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+
+	if (attributeVbo != 0)
+	{
+		// Vertex attribute 2 - UV coordinate
+		glBindBuffer(GL_ARRAY_BUFFER, attributeVbo);
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (void*)(offsetof(PackedVertex, u)));
+
+		// Vertex attribute 3 - Normal coordinates. Packed normals always have four components; the shader ignores w.
+		glEnableVertexAttribArray(3);
+		glVertexAttribPointer(3, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(PackedVertex), (void*)(offsetof(PackedVertex, normal)));
+
+		// Vertex attribute 11 - Texture array layer. Locations 4 to 10 hold the instance transforms.
+		glEnableVertexAttribArray(11);
+		glVertexAttribPointer(11, 1, GL_UNSIGNED_BYTE, GL_FALSE, sizeof(PackedVertex), (void*)(offsetof(PackedVertex, layer)));
+	}
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/**
+ * @brief Computes the per-instance data for a model matrix, so the shaders don't have to invert it per vertex.
+ * @param[in] modelMatrix Model matrix of the instance
+ * @return Model matrix together with its normal matrix
+ */
+InstanceData MakeInstanceData(const glm::mat4& modelMatrix)
+{
+	InstanceData instance;
+	instance.modelMatrix = modelMatrix;
+	instance.normalMatrix = glm::transpose(glm::inverse(glm::mat3(modelMatrix)));
+	return instance;
+}
+
+/**
+ * @brief Function for handling the event when the size of the framebuffer changed.
+ * @param[in] window Reference to the window
+ * @param[in] width New width
+ * @param[in] height New height
+ */
+void FramebufferSizeChangedCallback(GLFWwindow* window, int width, int height)
+{
+	// Whenever the size of the framebuffer changed (due to window resizing, etc.),
+	// update the dimensions of the region to the new size
+	glViewport(0, 0, width, height);
+}
+
+
+/**
+ * @brief Reads renderer options from the command line.
+ * Supported options are "--shadow-size <texels>", "--shadow-depth <16|24|32>", "--shadow-cascades <1-4>",
+ * "--shadow-filter-taps <0-16>", "--anisotropy <1-16>", "--gpu-culling <0|1>" and "--stats <0|1>".
+ * @param[in] argc Number of command-line arguments
+ * @param[in] argv Command-line arguments
+ * @param[out] settings Settings to fill in. Options that are not given keep their defaults.
+ * @return True if every option was recognized and valid
+ */
+bool ParseRenderSettings(int argc, char* argv[], RenderSettings& settings)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string option = argv[i];
+		if (i + 1 >= argc)
+		{
+			std::cerr << "Missing value for option " << option << std::endl;
+			return false;
+		}
 
-			if (sfx->isFinished())
+		std::istringstream valueStream(argv[++i]);
+		int value = 0;
+		if (!(valueStream >> value) || !valueStream.eof())
+		{
+			std::cerr << "Invalid value for option " << option << ": " << argv[i] << std::endl;
+			return false;
+		}
+
+		if (option == "--shadow-size")
+		{
+			if (value < 1)
 			{
-				sfx = sfxEngine->play2D("FootStep.mp3", false, false, true);
+				std::cerr << "Shadow map size must be positive" << std::endl;
+				return false;
 			}
-			
+			settings.shadowMapSize = value;
 		}
-		if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
+		else if (option == "--shadow-depth")
 		{
-			upcomingCameraPosition -= camSpeed * deltaTime * glm::normalize(glm::vec3(cameraTarget.x, 0.0f, cameraTarget.z));
-
-			if (checkCollision(upcomingCameraPosition, hitboxArray) == false)
+			if (value != 16 && value != 24 && value != 32)
 			{
-				cameraPosition -= camSpeed * deltaTime * glm::normalize(glm::vec3(cameraTarget.x, 0.0f, cameraTarget.z));
+				std::cerr << "Shadow map depth must be 16, 24 or 32 bits" << std::endl;
+				return false;
 			}
-			else
+			settings.shadowDepthBits = value;
+		}
+		else if (option == "--shadow-cascades")
+		{
+			if (value < 1 || value > MAX_SHADOW_CASCADES)
 			{
-				if (collidedWall.isXWall())
-				{
-					cameraPosition -= camSpeed * deltaTime * glm::normalize(glm::vec3(0.0f, 0.0f, cameraTarget.z));
-				}
-				else if (collidedWall.isZWall())
-				{
-					cameraPosition -= camSpeed * deltaTime * glm::normalize(glm::vec3(cameraTarget.x, 0.0f, 0.0f));
-				}
+				std::cerr << "Shadow cascade count must be between 1 and " << MAX_SHADOW_CASCADES << std::endl;
+				return false;
 			}
-			if (sfx->isFinished())
+			settings.shadowCascades = value;
+		}
+		else if (option == "--shadow-filter-taps")
+		{
+			if (value < 0 || value > 16)
 			{
-				sfx = sfxEngine->play2D("FootStep.mp3", false, false, true);
+				std::cerr << "Shadow filter taps must be between 0 and 16" << std::endl;
+				return false;
 			}
+			settings.shadowFilterTaps = value;
 		}
-		if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
+		else if (option == "--anisotropy")
 		{
-			upcomingCameraPosition -= camSpeed * right * deltaTime;
-
-			if (checkCollision(upcomingCameraPosition, hitboxArray) == false)
+			if (value < 1 || value > 16)
 			{
-				cameraPosition -= camSpeed * right * deltaTime;
+				std::cerr << "Anisotropy must be between 1 and 16" << std::endl;
+				return false;
 			}
-			else
+			settings.anisotropy = value;
+		}
+		else if (option == "--gpu-culling")
+		{
+			if (value != 0 && value != 1)
 			{
-				if (collidedWall.isXWall())
-				{
-					cameraPosition -= camSpeed * deltaTime * glm::normalize(glm::vec3(0.0f, 0.0f, right.z));
-				}
-				else if (collidedWall.isZWall())
-				{
-					cameraPosition -= camSpeed * deltaTime * glm::normalize(glm::vec3(right.x, 0.0f, 0.0f));
-				}
+				std::cerr << "GPU culling must be 0 or 1" << std::endl;
+				return false;
 			}
-			if (sfx->isFinished())
+			settings.gpuCulling = value == 1;
+		}
+		else if (option == "--stats")
+		{
+			if (value != 0 && value != 1)
 			{
-				sfx = sfxEngine->play2D("FootStep.mp3", false, false, true);
+				std::cerr << "Stats must be 0 or 1" << std::endl;
+				return false;
 			}
+			settings.stats = value == 1;
 		}
-		if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
+		else
 		{
-			upcomingCameraPosition += camSpeed * right * deltaTime;
+			std::cerr << "Unknown option " << option << std::endl;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * @brief Converts a text level description into the binary level format.
+ * The potentially visible set of the wall quads is worked out here too, so the game doesn't have to build it on every launch.
+ * @param[in] sourceFilePath Path to the text level description
+ * @param[in] levelFilePath Path where the binary level file will be written
+ * @return True if the level was baked successfully
+ */
+bool BakeLevel(const std::string& sourceFilePath, const std::string& levelFilePath)
+{
+	std::ifstream sourceFile(sourceFilePath);
+	if (sourceFile.fail())
+	{
+		std::cerr << "Unable to open level source file: " << sourceFilePath << std::endl;
+		return false;
+	}
+
+	LevelHeader header = {};
+	std::memcpy(header.magic, "MAZE", 4);
+	header.version = LEVEL_VERSION;
+
+	std::vector<LevelSpawn> spawns;
+	std::vector<LevelWall> walls;
+	std::vector<glm::mat4> tiles;
+	std::vector<LevelLight> lights;
+
+	std::string line;
+	int lineNumber = 0;
+	while (std::getline(sourceFile, line))
+	{
+		lineNumber++;
+
+		std::istringstream lineStream(line);
+		std::string keyword;
+		if (!(lineStream >> keyword) || keyword[0] == '#')
+		{
+			continue;
+		}
 
-			if (checkCollision(upcomingCameraPosition, hitboxArray) == false)
+		if (keyword == "floor")
+		{
+			lineStream >> header.floorMinX >> header.floorMinZ >> header.floorMaxX >> header.floorMaxZ >> header.floorHeight;
+		}
+		else if (keyword == "spawn")
+		{
+			LevelSpawn spawn;
+			lineStream >> spawn.x >> spawn.y >> spawn.z >> spawn.yaw;
+			spawns.push_back(spawn);
+		}
+		else if (keyword == "wall")
+		{
+			float x0, z0, x1, z1;
+			std::string facing;
+			lineStream >> x0 >> z0 >> x1 >> z1 >> facing;
+
+			LevelWall wall = {};
+			wall.minX = std::min(x0, x1);
+			wall.minZ = std::min(z0, z1);
+			wall.maxX = std::max(x0, x1);
+			wall.maxZ = std::max(z0, z1);
+
+			if (facing == "+x") { wall.facing = FACING_POSITIVE_X; }
+			else if (facing == "-x") { wall.facing = FACING_NEGATIVE_X; }
+			else if (facing == "+z") { wall.facing = FACING_POSITIVE_Z; }
+			else if (facing == "-z") { wall.facing = FACING_NEGATIVE_Z; }
+			else
 			{
-				cameraPosition += camSpeed * right * deltaTime;
+				std::cerr << sourceFilePath << ":" << lineNumber << ": unknown wall facing '" << facing << "'" << std::endl;
+				return false;
 			}
-			else
+
+			if ((wall.isXWall() && wall.minX != wall.maxX) || (wall.isZWall() && wall.minZ != wall.maxZ))
 			{
-				if (collidedWall.isXWall())
-				{
-					cameraPosition += camSpeed * deltaTime * glm::normalize(glm::vec3(0.0f, 0.0f, right.z));
-				}
-				else if (collidedWall.isZWall())
+				std::cerr << sourceFilePath << ":" << lineNumber << ": wall facing does not match its direction" << std::endl;
+				return false;
+			}
+
+			// Split the segment into 1x1 tiles. The plane model lies flat on the XZ plane facing +Y,
+			// so each tile is rotated upright to face the wall's direction.
+			float wallLength = wall.isXWall() ? wall.maxZ - wall.minZ : wall.maxX - wall.minX;
+			wall.firstTile = static_cast<uint32_t>(tiles.size());
+			wall.tileCount = static_cast<uint32_t>(std::lround(wallLength));
+
+			for (uint32_t i = 0; i < wall.tileCount; i++)
+			{
+				glm::vec3 tileCenter = wall.isXWall()
+					? glm::vec3(wall.minX, header.floorHeight + 0.5f, wall.minZ + 0.5f + i)
+					: glm::vec3(wall.minX + 0.5f + i, header.floorHeight + 0.5f, wall.minZ);
+
+				glm::mat4 tile = glm::translate(glm::mat4(1.0f), tileCenter);
+				switch (wall.facing)
 				{
-					cameraPosition += camSpeed * deltaTime * glm::normalize(glm::vec3(right.x, 0.0f, 0.0f));
+				case FACING_POSITIVE_X:
+					tile = glm::rotate(tile, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+					break;
+				case FACING_NEGATIVE_X:
+					tile = glm::rotate(tile, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+					break;
+				case FACING_POSITIVE_Z:
+					tile = glm::rotate(tile, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+					tile = glm::rotate(tile, glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+					break;
+				case FACING_NEGATIVE_Z:
+					tile = glm::rotate(tile, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+					tile = glm::rotate(tile, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+					break;
 				}
+				tiles.push_back(tile);
 			}
-			if (sfx->isFinished())
+
+			walls.push_back(wall);
+		}
+		else if (keyword == "lamp" || keyword == "spot")
+		{
+			LevelLight light = {};
+			lineStream >> light.x >> light.y >> light.z;
+			if (keyword == "spot")
 			{
-				sfx = sfxEngine->play2D("FootStep.mp3", false, false, true);
+				lineStream >> light.directionX >> light.directionY >> light.directionZ >> light.spotAngle;
+			}
+			lineStream >> light.radius >> light.r >> light.g >> light.b >> light.flicker;
+
+			glm::vec3 direction = glm::vec3(light.directionX, light.directionY, light.directionZ);
+			if (!lineStream.fail() && (light.radius <= 0.0f || light.flicker < 0.0f || light.flicker > 1.0f
+				|| (keyword == "spot" && (light.spotAngle <= 0.0f || light.spotAngle >= 90.0f || glm::length(direction) == 0.0f))))
+			{
+				std::cerr << sourceFilePath << ":" << lineNumber << ": light values out of range" << std::endl;
+				return false;
 			}
+
+			if (keyword == "spot")
+			{
+				direction = glm::normalize(direction);
+				light.directionX = direction.x; light.directionY = direction.y; light.directionZ = direction.z;
+			}
+			lights.push_back(light);
+		}
+		else
+		{
+			std::cerr << sourceFilePath << ":" << lineNumber << ": unknown keyword '" << keyword << "'" << std::endl;
+			return false;
 		}
-		
 
-		// FIRST PASS
-		// 
-		// 
-		//
-		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-		glClear(GL_DEPTH_BUFFER_BIT);
-		glViewport(0, 0, shadowMapHeight, shadowMapWidth);
-		glUseProgram(depthshaders);
-		
+		if (lineStream.fail())
+		{
+			std::cerr << sourceFilePath << ":" << lineNumber << ": malformed '" << keyword << "' entry" << std::endl;
+			return false;
+		}
+	}
 
-		GLint dirLightProjectionUniformLocation = glGetUniformLocation(depthshaders, "lightProjection");
-		GLint dirLightViewUniformLocation = glGetUniformLocation(depthshaders, "lightView");
-		GLint dirModelMatrix = glGetUniformLocation(depthshaders, "modelMatrix");
+	// Build the wall quads the same way the game does, so the potentially visible set names the same quads
+	Level bakedLevel;
+	bakedLevel.header = &header;
+	bakedLevel.tileTransforms = tiles.data();
+	header.tileCount = static_cast<uint32_t>(tiles.size());
+
+	std::vector<Vertex> wallVertices;
+	std::vector<GLuint> wallIndices;
+	std::vector<WallCluster> wallClusters;
+	WallBounds wallBounds;
+	BuildWallMesh(bakedLevel, wallVertices, wallIndices);
+	BuildWallClusters(wallVertices, wallIndices, WALL_CLUSTER_SIZE, wallClusters);
+	BuildWallBounds(wallVertices, wallBounds);
+
+	Pvs pvs;
+	if (BuildPvs(bakedLevel, wallBounds, pvs))
+	{
+		header.pvsCellsX = static_cast<uint32_t>(pvs.cellsX);
+		header.pvsCellsZ = static_cast<uint32_t>(pvs.cellsZ);
+		header.pvsWallQuadCount = static_cast<uint32_t>(wallBounds.count);
+	}
 
-		glm::vec3 lightPosition = glm::vec3(-2.0f, 5.0f, 5.0f);
-		glm::mat4 lightProjection = glm::ortho(-10.0f, 10.0f, -10.0f, 10.0f, 1.0f, 50.0f);
-		glm::mat4 lightView = glm::lookAt(lightPosition, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-		
-		glUniformMatrix4fv(dirLightProjectionUniformLocation, 1, GL_FALSE, glm::value_ptr(lightProjection));
-		glUniformMatrix4fv(dirLightViewUniformLocation, 1, GL_FALSE, glm::value_ptr(lightView));
+	// Lay out the sections one after another, each starting on a 16-byte boundary
+	auto alignOffset = [](size_t offset) { return (offset + 15) & ~static_cast<size_t>(15); };
+
+	size_t fileSize = alignOffset(sizeof(LevelHeader));
+	header.spawnCount = static_cast<uint32_t>(spawns.size());
+	header.spawnOffset = static_cast<uint32_t>(fileSize);
+	fileSize = alignOffset(fileSize + spawns.size() * sizeof(LevelSpawn));
+	header.wallCount = static_cast<uint32_t>(walls.size());
+	header.wallOffset = static_cast<uint32_t>(fileSize);
+	fileSize = alignOffset(fileSize + walls.size() * sizeof(LevelWall));
+	header.tileCount = static_cast<uint32_t>(tiles.size());
+	header.tileOffset = static_cast<uint32_t>(fileSize);
+	fileSize = alignOffset(fileSize + tiles.size() * sizeof(glm::mat4));
+	header.lightCount = static_cast<uint32_t>(lights.size());
+	header.lightOffset = static_cast<uint32_t>(fileSize);
+	fileSize = alignOffset(fileSize + lights.size() * sizeof(LevelLight));
+	header.pvsCellStartOffset = static_cast<uint32_t>(fileSize);
+	fileSize = alignOffset(fileSize + pvs.cellStarts.size() * sizeof(uint32_t));
+	header.pvsQuadCount = static_cast<uint32_t>(pvs.quads.size());
+	header.pvsQuadOffset = static_cast<uint32_t>(fileSize);
+	fileSize += pvs.quads.size() * sizeof(uint32_t);
+
+	std::vector<char> fileData(fileSize, 0);
+	std::memcpy(fileData.data(), &header, sizeof(header));
+	if (!spawns.empty()) { std::memcpy(fileData.data() + header.spawnOffset, spawns.data(), spawns.size() * sizeof(LevelSpawn)); }
+	if (!walls.empty()) { std::memcpy(fileData.data() + header.wallOffset, walls.data(), walls.size() * sizeof(LevelWall)); }
+	if (!tiles.empty()) { std::memcpy(fileData.data() + header.tileOffset, tiles.data(), tiles.size() * sizeof(glm::mat4)); }
+	if (!lights.empty()) { std::memcpy(fileData.data() + header.lightOffset, lights.data(), lights.size() * sizeof(LevelLight)); }
+	if (!pvs.cellStarts.empty()) { std::memcpy(fileData.data() + header.pvsCellStartOffset, pvs.cellStarts.data(), pvs.cellStarts.size() * sizeof(uint32_t)); }
+	if (!pvs.quads.empty()) { std::memcpy(fileData.data() + header.pvsQuadOffset, pvs.quads.data(), pvs.quads.size() * sizeof(uint32_t)); }
+
+	std::ofstream levelFile(levelFilePath, std::ios::binary);
+	levelFile.write(fileData.data(), fileData.size());
+	if (levelFile.fail())
+	{
+		std::cerr << "Unable to write level file: " << levelFilePath << std::endl;
+		return false;
+	}
 
-		// PLANE
-		//
-		//
-		glBindVertexArray(floorVao);
+	std::cout << "Baked " << levelFilePath << ": " << walls.size() << " walls, " << tiles.size() << " tiles, " << lights.size() << " lights, " << spawns.size() << " spawn points, "
+		<< (header.pvsCellsX > 0 ? "with" : "without") << " a potentially visible set" << std::endl;
+	return true;
+}
 
-		GLint floorUniformLocation = glGetUniformLocation(depthshaders, "modelMatrix");
-		glUniformMatrix4fv(floorUniformLocation, 1, GL_FALSE, glm::value_ptr(floorTile01));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-	
-		glBindVertexArray(0);
+/**
+ * @brief Memory-maps a binary level file and points the level's arrays into the mapping.
+ * @param[in] levelFilePath Path to the binary level file
+ * @param[out] level Level that will reference the mapped data
+ * @return True if the level was loaded and passed validation
+ */
+bool LoadLevel(const std::string& levelFilePath, Level& level)
+{
+#ifdef _WIN32
+	level.fileHandle = CreateFileA(levelFilePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (level.fileHandle == INVALID_HANDLE_VALUE)
+	{
+		std::cerr << "Unable to open level file: " << levelFilePath << std::endl;
+		return false;
+	}
 
+	LARGE_INTEGER fileSize;
+	GetFileSizeEx(level.fileHandle, &fileSize);
+	level.mappedSize = static_cast<size_t>(fileSize.QuadPart);
 
-		glBindVertexArray(planeVao);
-
-		GLint planeUniformLocation = glGetUniformLocation(depthshaders, "modelMatrix");
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL01));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL02));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL03));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL04));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL05));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL06));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL07));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL08));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL09));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL10));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL11));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL12));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL13));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL14));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL15));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL16));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL17));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL18));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL19));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL20));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL21));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL22));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL23));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL24));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL25));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL26));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL27));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL28));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL29));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL30));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL31));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL32));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL33));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL34));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL35));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL36));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL37));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL38));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL39));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL40));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL41));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL42));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL43));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL44));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL45));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL46));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL47));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		
+	level.mappingHandle = CreateFileMappingA(level.fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (level.mappingHandle != nullptr)
+	{
+		level.mappedData = MapViewOfFile(level.mappingHandle, FILE_MAP_READ, 0, 0, 0);
+	}
+#else
+	int fileDescriptor = open(levelFilePath.c_str(), O_RDONLY);
+	if (fileDescriptor < 0)
+	{
+		std::cerr << "Unable to open level file: " << levelFilePath << std::endl;
+		return false;
+	}
 
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR01));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR02));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR03));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR04));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR05));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR06));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR07));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR08));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR09));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR10));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR11));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR12));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR13));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR14));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR15));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR16));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR17));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR18));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR19));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR20));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR21));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR22));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR23));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR24));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR25));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR26));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR27));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR28));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR29));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR30));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR31));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR32));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR33));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR34));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR35));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR36));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR37));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glBindVertexArray(0);
-	
+	struct stat fileStat;
+	fstat(fileDescriptor, &fileStat);
+	level.mappedSize = static_cast<size_t>(fileStat.st_size);
 
+	if (level.mappedSize > 0)
+	{
+		void* mapping = mmap(nullptr, level.mappedSize, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+		level.mappedData = (mapping != MAP_FAILED) ? mapping : nullptr;
+	}
+	close(fileDescriptor);
+#endif
 
+	if (level.mappedData == nullptr)
+	{
+		std::cerr << "Unable to map level file: " << levelFilePath << std::endl;
+		UnloadLevel(level);
+		return false;
+	}
 
-		//
-		// SECOND PASS 
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
-		glViewport(0, 0, windowWidth, windowHeight);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, fboTex);
-		
+	// Make sure the header and every section actually fit inside the file before using them
+	const char* data = static_cast<const char*>(level.mappedData);
+	const LevelHeader* header = reinterpret_cast<const LevelHeader*>(data);
+	auto sectionFits = [&](uint32_t offset, uint64_t count, size_t elementSize)
+	{
+		return offset % 16 == 0 && offset <= level.mappedSize && count <= (level.mappedSize - offset) / elementSize;
+	};
 
-		// Draw Skybox
-		glDepthMask(GL_FALSE);
-		glUseProgram(skyboxshaders);
+	if (level.mappedSize < sizeof(LevelHeader) || std::memcmp(header->magic, "MAZE", 4) != 0 || header->version != LEVEL_VERSION
+		|| !sectionFits(header->spawnOffset, header->spawnCount, sizeof(LevelSpawn))
+		|| !sectionFits(header->wallOffset, header->wallCount, sizeof(LevelWall))
+		|| !sectionFits(header->tileOffset, header->tileCount, sizeof(glm::mat4))
+		|| !sectionFits(header->lightOffset, header->lightCount, sizeof(LevelLight))
+		|| (header->pvsCellsX > 0 && !sectionFits(header->pvsCellStartOffset, static_cast<uint64_t>(header->pvsCellsX) * header->pvsCellsZ + 1, sizeof(uint32_t)))
+		|| (header->pvsCellsX > 0 && !sectionFits(header->pvsQuadOffset, header->pvsQuadCount, sizeof(uint32_t))))
+	{
+		std::cerr << "Invalid or outdated level file: " << levelFilePath << std::endl;
+		UnloadLevel(level);
+		return false;
+	}
 
-		GLint skyboxProjectionUniformLocation = glGetUniformLocation(skyboxshaders, "projection");
-		GLint skyboxViewUniformLocation = glGetUniformLocation(skyboxshaders, "view");
-	
-		glUniformMatrix4fv(skyboxProjectionUniformLocation, 1, GL_FALSE, glm::value_ptr(perspective));
-		glUniformMatrix4fv(skyboxViewUniformLocation, 1, GL_FALSE, glm::value_ptr(glm::mat4(glm::mat3(camera))));
+	level.header = header;
+	level.spawns = reinterpret_cast<const LevelSpawn*>(data + header->spawnOffset);
+	level.walls = reinterpret_cast<const LevelWall*>(data + header->wallOffset);
+	level.tileTransforms = reinterpret_cast<const glm::mat4*>(data + header->tileOffset);
+	level.lights = reinterpret_cast<const LevelLight*>(data + header->lightOffset);
+
+	for (uint32_t i = 0; i < header->wallCount; i++)
+	{
+		if (level.walls[i].firstTile > header->tileCount || level.walls[i].tileCount > header->tileCount - level.walls[i].firstTile)
+		{
+			std::cerr << "Invalid or outdated level file: " << levelFilePath << std::endl;
+			UnloadLevel(level);
+			return false;
+		}
+	}
+
+	// Each cell's list has to lie within the quad section, after the previous cell's, and name quads that exist
+	if (header->pvsCellsX > 0)
+	{
+		level.pvsCellStarts = reinterpret_cast<const uint32_t*>(data + header->pvsCellStartOffset);
+		level.pvsQuads = reinterpret_cast<const uint32_t*>(data + header->pvsQuadOffset);
+
+		uint32_t cellCount = header->pvsCellsX * header->pvsCellsZ;
+		bool pvsValid = level.pvsCellStarts[0] == 0 && level.pvsCellStarts[cellCount] == header->pvsQuadCount;
+		for (uint32_t i = 0; i < cellCount && pvsValid; i++)
+		{
+			pvsValid = level.pvsCellStarts[i] <= level.pvsCellStarts[i + 1];
+		}
+		for (uint32_t i = 0; i < header->pvsQuadCount && pvsValid; i++)
+		{
+			pvsValid = level.pvsQuads[i] < header->pvsWallQuadCount;
+		}
+
+		if (!pvsValid)
+		{
+			std::cerr << "Invalid or outdated level file: " << levelFilePath << std::endl;
+			UnloadLevel(level);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * @brief Unmaps a level that was loaded with LoadLevel.
+ * @param[in,out] level Level to unload
+ */
+void UnloadLevel(Level& level)
+{
+#ifdef _WIN32
+	if (level.mappedData != nullptr)
+	{
+		UnmapViewOfFile(level.mappedData);
+	}
+	if (level.mappingHandle != nullptr)
+	{
+		CloseHandle(level.mappingHandle);
+	}
+	if (level.fileHandle != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(level.fileHandle);
+	}
+	level.mappingHandle = nullptr;
+	level.fileHandle = INVALID_HANDLE_VALUE;
+#else
+	if (level.mappedData != nullptr)
+	{
+		munmap(const_cast<void*>(level.mappedData), level.mappedSize);
+	}
+#endif
+
+	level.header = nullptr;
+	level.spawns = nullptr;
+	level.walls = nullptr;
+	level.tileTransforms = nullptr;
+	level.lights = nullptr;
+	level.pvsCellStarts = nullptr;
+	level.pvsQuads = nullptr;
+	level.mappedData = nullptr;
+	level.mappedSize = 0;
+}
+
+/**
+ * @brief Gets the size in bytes of one mip level of a texture image.
+ * @param[in] image Texture image whose format is used
+ * @param[in] level Mip level
+ * @return Size of the level, with rows padded to 4 bytes if it is uncompressed
+ */
+size_t GetTextureLevelSize(const TextureImage& image, int level)
+{
+	size_t width = static_cast<size_t>(std::max(image.width >> level, 1));
+	size_t height = static_cast<size_t>(std::max(image.height >> level, 1));
+	if (image.compressedFormat != 0)
+	{
+		// BC1 stores each 4x4 block of texels in 8 bytes
+		return ((width + 3) / 4) * ((height + 3) / 4) * 8;
+	}
+
+	size_t channels = (image.format == GL_RGBA) ? 4 : 3;
+	return ((width * channels + 3) & ~static_cast<size_t>(3)) * height;
+}
+
+/**
+ * @brief Decodes an image and builds its mip chain.
+ * The image is flipped vertically to match OpenGL's texture coordinates, and each mip level is downsampled
+ * from the one above it with a Kaiser-windowed sinc filter in linear light.
+ * @param[in] fileData Contents of the image file
+ * @param[in] repeat True if the texture repeats, so the filter wraps around the edges instead of clamping to them
+ * @param[out] image Uncompressed texture image
+ * @return True if the image was decoded
+ */
+bool DecodeTextureImage(const std::vector<char>& fileData, bool repeat, TextureImage& image)
+{
+
+	const unsigned char* encoded = reinterpret_cast<const unsigned char*>(fileData.data());
+	int encodedSize = static_cast<int>(fileData.size());
+	int width, height, channels;
+	unsigned char* imageData = stbi_load_from_memory(encoded, encodedSize, &width, &height, &channels, 0);
+	if (imageData != nullptr && channels != 3 && channels != 4)
+	{
+		// Grayscale images are expanded so every texture is either RGB or RGBA
+		stbi_image_free(imageData);
+		imageData = stbi_load_from_memory(encoded, encodedSize, &width, &height, &channels, 3);
+		channels = 3;
+	}
+	if (imageData == nullptr)
+	{
+		return false;
+	}
+
+	// Colour channels are sRGB-encoded, so they are filtered in linear light. Alpha is already linear.
+	auto toLinear = [](float value) { return value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f); };
+	auto toSrgb = [](float value) { return value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f; };
+
+	// Im image-space (pixels), (0, 0) is the upper-left corner of the image
+	// However, in u-v coordinates, (0, 0) is the lower-left corner of the image
+	// The rows are flipped here rather than with stbi_set_flip_vertically_on_load, which isn't safe to use from the loader threads
+	size_t rowLength = static_cast<size_t>(width) * channels;
+	std::vector<float> texels(rowLength * height);
+	for (size_t i = 0; i < texels.size(); i++)
+	{
+		float value = imageData[(height - 1 - i / rowLength) * rowLength + i % rowLength] / 255.0f;
+		texels[i] = (i % channels < 3) ? toLinear(value) : value;
+	}
+	stbi_image_free(imageData);
+
+	// Kaiser-windowed sinc with 3 lobes on either side, as measured in texels of the smaller level
+	const float filterWidth = 3.0f;
+	const float kaiserAlpha = 4.0f;
+	auto besselI0 = [](float x)
+	{
+		float sum = 1.0f;
+		float term = 1.0f;
+		for (int k = 1; k < 16; k++)
+		{
+			term *= (x * 0.5f / k) * (x * 0.5f / k);
+			sum += term;
+		}
+		return sum;
+	};
+	auto filter = [&](float x)
+	{
+		float t = x / filterWidth;
+		if (std::abs(t) >= 1.0f)
+		{
+			return 0.0f;
+		}
+		float sinc = (std::abs(x) < 1e-5f) ? 1.0f : std::sin(static_cast<float>(M_PI) * x) / (static_cast<float>(M_PI) * x);
+		return sinc * besselI0(kaiserAlpha * std::sqrt(1.0f - t * t)) / besselI0(kaiserAlpha);
+	};
+
+	// Source texels and normalized weights for each texel along one axis of the next level
+	struct FilterTap
+	{
+		int source;
+		float weight;
+	};
+	auto buildTaps = [&](int sourceLength, int targetLength, std::vector<std::vector<FilterTap>>& taps)
+	{
+		float scale = static_cast<float>(sourceLength) / targetLength;
+		taps.assign(targetLength, std::vector<FilterTap>());
+		for (int i = 0; i < targetLength; i++)
+		{
+			float center = (i + 0.5f) * scale;
+			int first = static_cast<int>(std::floor(center - filterWidth * scale));
+			int last = static_cast<int>(std::ceil(center + filterWidth * scale));
+			float weightSum = 0.0f;
+			for (int s = first; s <= last; s++)
+			{
+				float weight = filter((s + 0.5f - center) / scale);
+				if (weight != 0.0f)
+				{
+					int source = repeat ? ((s % sourceLength) + sourceLength) % sourceLength : std::min(std::max(s, 0), sourceLength - 1);
+					taps[i].push_back({ source, weight });
+					weightSum += weight;
+				}
+			}
+			for (FilterTap& tap : taps[i])
+			{
+				tap.weight /= weightSum;
+			}
+		}
+	};
+
+	int levelCount = 1;
+	while ((std::max(width, height) >> levelCount) > 0)
+	{
+		levelCount++;
+	}
+
+	image.width = width;
+	image.height = height;
+	image.format = (channels == 4) ? GL_RGBA : GL_RGB;
+	image.compressedFormat = 0;
+	image.levelOffsets.clear();
+	image.levelSizes.clear();
+	for (int level = 0; level < levelCount; level++)
+	{
+		image.levelOffsets.push_back(image.levelSizes.empty() ? 0 : image.levelOffsets.back() + image.levelSizes.back());
+		image.levelSizes.push_back(GetTextureLevelSize(image, level));
+	}
+	image.data.assign(image.levelOffsets.back() + image.levelSizes.back(), 0);
+
+	int levelWidth = width;
+	int levelHeight = height;
+	std::vector<float> filtered;
+	std::vector<std::vector<FilterTap>> tapsX, tapsY;
+	for (int level = 0; level < levelCount; level++)
+	{
+		if (level > 0)
+		{
+			// Filter the previous level horizontally, then vertically
+			int nextWidth = std::max(levelWidth / 2, 1);
+			int nextHeight = std::max(levelHeight / 2, 1);
+			buildTaps(levelWidth, nextWidth, tapsX);
+			buildTaps(levelHeight, nextHeight, tapsY);
+
+			filtered.assign(static_cast<size_t>(nextWidth) * levelHeight * channels, 0.0f);
+			for (int y = 0; y < levelHeight; y++)
+			{
+				for (int x = 0; x < nextWidth; x++)
+				{
+					for (const FilterTap& tap : tapsX[x])
+					{
+						for (int c = 0; c < channels; c++)
+						{
+							filtered[(static_cast<size_t>(y) * nextWidth + x) * channels + c] += tap.weight * texels[(static_cast<size_t>(y) * levelWidth + tap.source) * channels + c];
+						}
+					}
+				}
+			}
+
+			texels.assign(static_cast<size_t>(nextWidth) * nextHeight * channels, 0.0f);
+			for (int y = 0; y < nextHeight; y++)
+			{
+				for (const FilterTap& tap : tapsY[y])
+				{
+					for (size_t i = 0; i < static_cast<size_t>(nextWidth) * channels; i++)
+					{
+						texels[static_cast<size_t>(y) * nextWidth * channels + i] += tap.weight * filtered[static_cast<size_t>(tap.source) * nextWidth * channels + i];
+					}
+				}
+			}
+
+			// The filter's negative lobes can overshoot
+			for (float& value : texels)
+			{
+				value = std::min(std::max(value, 0.0f), 1.0f);
+			}
+
+			levelWidth = nextWidth;
+			levelHeight = nextHeight;
+		}
+
+		unsigned char* levelData = reinterpret_cast<unsigned char*>(image.data.data() + image.levelOffsets[level]);
+		size_t rowSize = image.levelSizes[level] / levelHeight;
+		for (int y = 0; y < levelHeight; y++)
+		{
+			for (int i = 0; i < levelWidth * channels; i++)
+			{
+				float value = texels[static_cast<size_t>(y) * levelWidth * channels + i];
+				value = (i % channels < 3) ? toSrgb(value) : value;
+				levelData[y * rowSize + i] = static_cast<unsigned char>(value * 255.0f + 0.5f);
+			}
+		}
+	}
 
+	return true;
+}
 
-		glBindVertexArray(skyboxVao);
-		stbi_set_flip_vertically_on_load(true);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTexture);
-		glDrawArrays(GL_TRIANGLES, 0, 36);
-		glDepthMask(GL_TRUE);
-		glBindVertexArray(0);
+/**
+ * @brief Compresses an uncompressed RGB texture image to BC1 (DXT1), eight times smaller than RGBA8 in video memory.
+ * Images with an alpha channel are left uncompressed.
+ * @param[in,out] image Texture image to compress
+ */
+void CompressTextureImage(TextureImage& image)
+{
+	if (image.compressedFormat != 0 || image.format != GL_RGB)
+	{
+		return;
+	}
 
-		// Use the shader program that we created
-		glUseProgram(program);
-		
+	TextureImage compressed;
+	compressed.width = image.width;
+	compressed.height = image.height;
+	compressed.format = GL_RGB;
+	compressed.compressedFormat = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	for (size_t level = 0; level < image.levelSizes.size(); level++)
+	{
+		compressed.levelOffsets.push_back(compressed.levelSizes.empty() ? 0 : compressed.levelOffsets.back() + compressed.levelSizes.back());
+		compressed.levelSizes.push_back(GetTextureLevelSize(compressed, static_cast<int>(level)));
+	}
+	compressed.data.assign(compressed.levelOffsets.back() + compressed.levelSizes.back(), 0);
 
-		GLint shadowMapTexUniformLocation = glGetUniformLocation(program, "shadowMap");
-		glUniform1i(shadowMapTexUniformLocation, 0);
-		
-		
+	// 5:6:5 colour endpoints, and the same colours expanded back to 8 bits per channel
+	auto packColor = [](const glm::vec3& color)
+	{
+		int r = static_cast<int>(glm::clamp(color.x, 0.0f, 255.0f) * 31.0f / 255.0f + 0.5f);
+		int g = static_cast<int>(glm::clamp(color.y, 0.0f, 255.0f) * 63.0f / 255.0f + 0.5f);
+		int b = static_cast<int>(glm::clamp(color.z, 0.0f, 255.0f) * 31.0f / 255.0f + 0.5f);
+		return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+	};
+	auto unpackColor = [](uint16_t color)
+	{
+		int r = (color >> 11) & 31;
+		int g = (color >> 5) & 63;
+		int b = color & 31;
+		return glm::vec3(static_cast<float>((r << 3) | (r >> 2)), static_cast<float>((g << 2) | (g >> 4)), static_cast<float>((b << 3) | (b >> 2)));
+	};
 
-		// FLOOR
-		//
-		glBindVertexArray(floorVao);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, floorTex);
-		floorUniformLocation = glGetUniformLocation(program, "modelMatrix");
-		glUniformMatrix4fv(floorUniformLocation, 1, GL_FALSE, glm::value_ptr(floorTile01));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
+	for (size_t level = 0; level < image.levelSizes.size(); level++)
+	{
+		int levelWidth = std::max(image.width >> level, 1);
+		int levelHeight = std::max(image.height >> level, 1);
+		size_t rowSize = image.levelSizes[level] / levelHeight;
+		const unsigned char* source = reinterpret_cast<const unsigned char*>(image.data.data() + image.levelOffsets[level]);
+		unsigned char* block = reinterpret_cast<unsigned char*>(compressed.data.data() + compressed.levelOffsets[level]);
 
-		// Bind our texture to texture unit 1
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, wallTex);
+		for (int blockY = 0; blockY < levelHeight; blockY += 4)
+		{
+			for (int blockX = 0; blockX < levelWidth; blockX += 4, block += 8)
+			{
+				// Blocks that hang over the edge of a small level repeat its last row and column
+				glm::vec3 texels[16];
+				glm::vec3 mean = glm::vec3(0.0f);
+				for (int i = 0; i < 16; i++)
+				{
+					int x = std::min(blockX + i % 4, levelWidth - 1);
+					int y = std::min(blockY + i / 4, levelHeight - 1);
+					const unsigned char* texel = source + y * rowSize + x * 3;
+					texels[i] = glm::vec3(texel[0], texel[1], texel[2]);
+					mean += texels[i] / 16.0f;
+				}
 
-		glBindVertexArray(0);
+				// The endpoints are the block's extremes along the principal axis of its colours
+				float covariance[6] = {};
+				for (const glm::vec3& texel : texels)
+				{
+					glm::vec3 d = texel - mean;
+					covariance[0] += d.x * d.x; covariance[1] += d.x * d.y; covariance[2] += d.x * d.z;
+					covariance[3] += d.y * d.y; covariance[4] += d.y * d.z; covariance[5] += d.z * d.z;
+				}
+				glm::vec3 axis = glm::vec3(1.0f);
+				for (int iteration = 0; iteration < 8; iteration++)
+				{
+					glm::vec3 next = glm::vec3(
+						covariance[0] * axis.x + covariance[1] * axis.y + covariance[2] * axis.z,
+						covariance[1] * axis.x + covariance[3] * axis.y + covariance[4] * axis.z,
+						covariance[2] * axis.x + covariance[4] * axis.y + covariance[5] * axis.z);
+					float length = glm::length(next);
+					if (length < 1e-6f)
+					{
+						break;
+					}
+					axis = next / length;
+				}
 
+				float minProjection = std::numeric_limits<float>::max();
+				float maxProjection = -std::numeric_limits<float>::max();
+				for (const glm::vec3& texel : texels)
+				{
+					float projection = glm::dot(texel - mean, axis);
+					minProjection = std::min(minProjection, projection);
+					maxProjection = std::max(maxProjection, projection);
+				}
 
-		// PLANE
-		glBindVertexArray(planeVao);
-		planeUniformLocation = glGetUniformLocation(program, "modelMatrix");
-		
-		// Make our sampler in the fragment shader use texture unit 0
-		GLint texUniformLocation = glGetUniformLocation(program, "tex");
-		glUniform1i(texUniformLocation, 1);
-
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL01));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL02));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL03));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL04));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL05));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL06));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL07));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL08));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL09));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL10));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL11));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL12));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL13));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL14));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL15));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL16));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL17));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL18));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL19));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL20));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL21));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL22));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL23));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL24));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL25));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL26));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL27));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL28));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL29));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL30));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL31));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL32));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL33));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL34));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL35));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL36));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL37));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL38));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL39));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL40));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL41));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL42));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL43));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL44));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL45));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL46));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileL47));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		
+				uint16_t color0 = packColor(mean + axis * maxProjection);
+				uint16_t color1 = packColor(mean + axis * minProjection);
+				if (color0 < color1)
+				{
+					std::swap(color0, color1);
+				}
 
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR01));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR02));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR03));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR04));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR05));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR06));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR07));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR08));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR09));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR10));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR11));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR12));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR13));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR14));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR15));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR16));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR17));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR18));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR19));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR20));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR21));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR22));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR23));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR24));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR25));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR26));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR27));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR28));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR29));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR30));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR31));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR32));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR33));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR34));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR35));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR36));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glUniformMatrix4fv(planeUniformLocation, 1, GL_FALSE, glm::value_ptr(wallTileR37));
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		
-		glBindVertexArray(0);
+				// With color0 > color1 the block has four colours: both endpoints and two points between them.
+				// Equal endpoints mean a flat block, where index 0 is all that's needed.
+				uint32_t indices = 0;
+				if (color0 != color1)
+				{
+					glm::vec3 palette[4];
+					palette[0] = unpackColor(color0);
+					palette[1] = unpackColor(color1);
+					palette[2] = (palette[0] * 2.0f + palette[1]) / 3.0f;
+					palette[3] = (palette[0] + palette[1] * 2.0f) / 3.0f;
+					for (int i = 0; i < 16; i++)
+					{
+						uint32_t best = 0;
+						float bestDistance = std::numeric_limits<float>::max();
+						for (uint32_t entry = 0; entry < 4; entry++)
+						{
+							glm::vec3 d = texels[i] - palette[entry];
+							float distance = glm::dot(d, d);
+							if (distance < bestDistance)
+							{
+								best = entry;
+								bestDistance = distance;
+							}
+						}
+						indices |= best << (i * 2);
+					}
+				}
 
+				block[0] = static_cast<unsigned char>(color0 & 0xFF);
+				block[1] = static_cast<unsigned char>(color0 >> 8);
+				block[2] = static_cast<unsigned char>(color1 & 0xFF);
+				block[3] = static_cast<unsigned char>(color1 >> 8);
+				for (int i = 0; i < 4; i++)
+				{
+					block[4 + i] = static_cast<unsigned char>((indices >> (i * 8)) & 0xFF);
+				}
+			}
+		}
+	}
 
-		GLint cameraPositionUniformLocation = glGetUniformLocation(program, "cameraPosition");
-		GLint objectSpecUniformLocation = glGetUniformLocation(program, "objectSpec");
-		GLint objectShineUniformLocation = glGetUniformLocation(program, "objectShine");
-		GLint dirLightDirUniformLocation = glGetUniformLocation(program, "directionalLightDirection");
-		
-		GLint dirLightAmbientUniformLocation = glGetUniformLocation(program, "lightAmbient");
-		GLint dirLightDiffuseUniformLocation = glGetUniformLocation(program, "lightDiffuse");
-		GLint dirLightSpecularUniformLocation = glGetUniformLocation(program, "lightSpecular");
-
-		GLint sLightAmbientUniformLocation = glGetUniformLocation(program, "sLightAmbient");
-		GLint sLightDiffuseUniformLocation = glGetUniformLocation(program, "sLightDiffuse");
-		GLint sLightSpecularUniformLocation = glGetUniformLocation(program, "sLightSpecular");
-		GLint spotLightPositionUniformLocation = glGetUniformLocation(program, "spotLightPosition");
-		GLint spotLightDirectionUniformLocation = glGetUniformLocation(program, "spotLightDirection");
-
-		GLint sLightConstantUniformLocation = glGetUniformLocation(program, "sLightConstant");
-		GLint sLightLinearUniformLocation = glGetUniformLocation(program, "sLightLinear");
-		GLint sLightQuadraticUniformLocation = glGetUniformLocation(program, "sLightQuadratic");
-
-		GLint dirLightProjectionUniformLocation2 = glGetUniformLocation(program, "lightProjection");
-		GLint dirLightViewUniformLocation2 = glGetUniformLocation(program, "lightView");
-		
-		GLint lightOnUniformLocation = glGetUniformLocation(program, "lightOn");
+	image = std::move(compressed);
+}
 
-		glUniform1i(lightOnUniformLocation, lightOn);
+/**
+ * @brief Writes a texture image to a KTX file.
+ * @param[in] textureFilePath Path where the KTX file will be written
+ * @param[in] image Texture image to write
+ * @param[in] cacheKey Key of the source the image was made from, stored in the file's key/value data
+ * @return True if the file was written
+ */
+bool WriteKtxTexture(const std::string& textureFilePath, const TextureImage& image, uint64_t cacheKey)
+{
+	// A single "CacheKey" entry holding the key in hexadecimal, padded to 4 bytes
+	std::ostringstream keyStream;
+	keyStream << std::hex;
+	keyStream.width(16);
+	keyStream.fill('0');
+	keyStream << cacheKey;
+	std::string keyValue = std::string("CacheKey") + '\0' + keyStream.str() + '\0';
+	uint32_t keyValueSize = static_cast<uint32_t>(keyValue.size());
+	keyValue.resize((keyValue.size() + 3) & ~static_cast<size_t>(3), '\0');
+
+	KtxHeader header = {};
+	header.endianness = 0x04030201;
+	header.glType = (image.compressedFormat != 0) ? 0 : GL_UNSIGNED_BYTE;
+	header.glTypeSize = 1;
+	header.glFormat = (image.compressedFormat != 0) ? 0 : image.format;
+	header.glInternalFormat = (image.compressedFormat != 0) ? image.compressedFormat : ((image.format == GL_RGBA) ? GL_RGBA8 : GL_RGB8);
+	header.glBaseInternalFormat = image.format;
+	header.pixelWidth = static_cast<uint32_t>(image.width);
+	header.pixelHeight = static_cast<uint32_t>(image.height);
+	header.numberOfFaces = 1;
+	header.numberOfMipmapLevels = static_cast<uint32_t>(image.levelSizes.size());
+	header.bytesOfKeyValueData = static_cast<uint32_t>(sizeof(keyValueSize) + keyValue.size());
+
+	std::ofstream textureFile(textureFilePath, std::ios::binary);
+	textureFile.write(reinterpret_cast<const char*>(KTX_IDENTIFIER), sizeof(KTX_IDENTIFIER));
+	textureFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	textureFile.write(reinterpret_cast<const char*>(&keyValueSize), sizeof(keyValueSize));
+	textureFile.write(keyValue.data(), keyValue.size());
+	for (size_t level = 0; level < image.levelSizes.size(); level++)
+	{
+		// Every level size is already a multiple of 4, so no mip padding is needed
+		uint32_t imageSize = static_cast<uint32_t>(image.levelSizes[level]);
+		textureFile.write(reinterpret_cast<const char*>(&imageSize), sizeof(imageSize));
+		textureFile.write(image.data.data() + image.levelOffsets[level], imageSize);
+	}
 
-		glUniform3fv(cameraPositionUniformLocation, 1, glm::value_ptr(cameraPosition));
-		glUniform3f(objectSpecUniformLocation, 0.2f, 0.2f, 0.2f);
-		glUniform1f(objectShineUniformLocation, 50.f);
-		glUniform3f(dirLightDirUniformLocation, -0.25f, -1.0f, -0.25f);
+	if (textureFile.fail())
+	{
+		std::cerr << "Unable to write texture file: " << textureFilePath << std::endl;
+		return false;
+	}
+	return true;
+}
 
-		glUniform3f(dirLightAmbientUniformLocation, 0.75f, 0.75f, 0.75f);
-		glUniform3f(dirLightDiffuseUniformLocation, 0.75f, 0.75f, 0.75f);
-		glUniform3f(dirLightSpecularUniformLocation, 0.75f, 0.75f, 0.75f);
+/**
+ * @brief Reads a texture image from a KTX file written by WriteKtxTexture.
+ * @param[in] textureFilePath Path to the KTX file
+ * @param[out] image Texture image
+ * @param[out] cacheKey Key of the source the image was made from, or 0 if the file has none
+ * @return True if the file was read and passed validation
+ */
+bool ReadKtxTexture(const std::string& textureFilePath, TextureImage& image, uint64_t& cacheKey)
+{
+	cacheKey = 0;
 
+	std::ifstream textureFile(textureFilePath, std::ios::binary | std::ios::ate);
+	if (textureFile.fail())
+	{
+		return false;
+	}
 
-		glUniform3f(sLightAmbientUniformLocation, 1.0f, 1.0f, 1.0f);
-		glUniform3f(sLightDiffuseUniformLocation, 1.0f, 1.0f, 1.0f);
-		glUniform3f(sLightSpecularUniformLocation, 1.0f, 1.0f, 1.0f);
+	image.data.resize(static_cast<size_t>(textureFile.tellg()));
+	textureFile.seekg(0);
+	textureFile.read(image.data.data(), image.data.size());
 
-		glUniform1f(sLightAmbientUniformLocation, 1.0f);
-		glUniform1f(sLightLinearUniformLocation, 0.35f);
-		glUniform1f(sLightQuadraticUniformLocation, 0.44f);
+	KtxHeader header = {};
+	size_t offset = sizeof(KTX_IDENTIFIER) + sizeof(KtxHeader);
+	if (!textureFile.fail() && image.data.size() >= offset)
+	{
+		std::memcpy(&header, image.data.data() + sizeof(KTX_IDENTIFIER), sizeof(header));
+	}
 
-		glUniform3f(spotLightPositionUniformLocation,  cameraPosition.x, cameraPosition.y, cameraPosition.z);
-		glUniform3f(spotLightDirectionUniformLocation, cameraTarget.x, cameraTarget.y, cameraTarget.z);
+	uint32_t maxLevelCount = 1;
+	while ((std::max(header.pixelWidth, header.pixelHeight) >> maxLevelCount) > 0)
+	{
+		maxLevelCount++;
+	}
 
-		glUniformMatrix4fv(dirLightProjectionUniformLocation2, 1, GL_FALSE, glm::value_ptr(lightProjection));
-		glUniformMatrix4fv(dirLightViewUniformLocation2, 1, GL_FALSE, glm::value_ptr(lightView));
-		
-		// Camera computations
-		camera = glm::lookAt(cameraPosition, cameraPosition + cameraTarget, cameraUp);
-		perspective = glm::perspective(glm::radians(90.0f), (GLfloat)windowWidth / (GLfloat)windowHeight, 0.1f, 100.0f);
+	bool uncompressed = header.glType == GL_UNSIGNED_BYTE
+		&& ((header.glFormat == GL_RGB && header.glInternalFormat == GL_RGB8) || (header.glFormat == GL_RGBA && header.glInternalFormat == GL_RGBA8));
+	bool compressed = header.glType == 0 && header.glFormat == 0 && header.glInternalFormat == GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
 
-		GLint camUniformLocation = glGetUniformLocation(program, "camera");
-		GLint perspectiveUniformLocation = glGetUniformLocation(program, "perspective");
-		glUniformMatrix4fv(camUniformLocation, 1, GL_FALSE, glm::value_ptr(camera));
-		glUniformMatrix4fv(perspectiveUniformLocation, 1, GL_FALSE, glm::value_ptr(perspective));
+	bool valid = image.data.size() >= offset && std::memcmp(image.data.data(), KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER)) == 0
+		&& header.endianness == 0x04030201 && (uncompressed || compressed)
+		&& header.pixelWidth > 0 && header.pixelHeight > 0 && header.pixelDepth == 0
+		&& header.pixelWidth <= 65536 && header.pixelHeight <= 65536
+		&& header.numberOfArrayElements == 0 && header.numberOfFaces == 1
+		&& header.numberOfMipmapLevels >= 1 && header.numberOfMipmapLevels <= maxLevelCount
+		&& header.bytesOfKeyValueData <= image.data.size() - offset;
 
-		glBindVertexArray(0);
+	if (valid)
+	{
+		image.width = static_cast<GLsizei>(header.pixelWidth);
+		image.height = static_cast<GLsizei>(header.pixelHeight);
+		image.format = compressed ? GL_RGB : header.glFormat;
+		image.compressedFormat = compressed ? header.glInternalFormat : 0;
+
+		// Look for the cache key among the key/value pairs
+		size_t keyValueEnd = offset + header.bytesOfKeyValueData;
+		while (offset + sizeof(uint32_t) <= keyValueEnd)
+		{
+			uint32_t keyValueSize = 0;
+			std::memcpy(&keyValueSize, image.data.data() + offset, sizeof(keyValueSize));
+			offset += sizeof(keyValueSize);
+			if (keyValueSize > keyValueEnd - offset)
+			{
+				break;
+			}
 
-		glEnable(GL_DEPTH_TEST);
+			std::string keyValue(image.data.data() + offset, keyValueSize);
+			size_t separator = keyValue.find('\0');
+			if (separator != std::string::npos && keyValue.substr(0, separator) == "CacheKey")
+			{
+				std::istringstream valueStream(keyValue.substr(separator + 1));
+				valueStream >> std::hex >> cacheKey;
+			}
+			offset += (keyValueSize + 3) & ~static_cast<size_t>(3);
+		}
+		offset = keyValueEnd;
 
-		// Tell GLFW to swap the screen buffer with the offscreen buffer
-		glfwSwapBuffers(window);
+		// Find every mip level and make sure it fits inside the file
+		image.levelOffsets.clear();
+		image.levelSizes.clear();
+		for (uint32_t level = 0; level < header.numberOfMipmapLevels && valid; level++)
+		{
+			uint32_t imageSize = 0;
+			valid = image.data.size() - offset >= sizeof(imageSize);
+			if (valid)
+			{
+				std::memcpy(&imageSize, image.data.data() + offset, sizeof(imageSize));
+				offset += sizeof(imageSize);
+				valid = imageSize == GetTextureLevelSize(image, static_cast<int>(level)) && imageSize <= image.data.size() - offset;
+			}
+			if (valid)
+			{
+				image.levelOffsets.push_back(offset);
+				image.levelSizes.push_back(imageSize);
+				offset += (imageSize + 3) & ~static_cast<size_t>(3);
+				offset = std::min(offset, image.data.size());
+			}
+		}
+	}
 
-		// Tell GLFW to process window events (e.g., input events, window closed events, etc.)
-		glfwPollEvents();
+	if (!valid)
+	{
+		std::cerr << "Invalid texture file: " << textureFilePath << std::endl;
+		image.levelOffsets.clear();
+		image.levelSizes.clear();
+		return false;
 	}
+	return true;
+}
 
-	// --- Cleanup ---
+/**
+ * @brief Computes the texture cache key of an image file, from its contents and how it is filtered.
+ * @param[in] fileData Contents of the image file
+ * @param[in] repeat Whether the texture repeats
+ * @return 64-bit FNV-1a hash
+ */
+uint64_t GetTextureCacheKey(const std::vector<char>& fileData, bool repeat)
+{
+	unsigned char wrap = repeat ? 1 : 0;
+	uint64_t hash = HashFnv1a(fileData.data(), fileData.size());
+	hash = HashFnv1a(&wrap, sizeof(wrap), hash);
+	return HashFnv1a(&TEXTURE_CACHE_VERSION, sizeof(TEXTURE_CACHE_VERSION), hash);
+}
 
-	// Make sure to delete the shader program
-	glDeleteProgram(program);
+/**
+ * @brief Gets the path of the texture cache file for an image: the image's path with a .ktx extension.
+ * @param[in] imageFilePath Path to the image
+ * @return Path to the cache file
+ */
+std::string GetTextureCachePath(const std::string& imageFilePath)
+{
+	size_t extension = imageFilePath.find_last_of('.');
+	size_t directory = imageFilePath.find_last_of("/\\");
+	if (extension == std::string::npos || (directory != std::string::npos && extension < directory))
+	{
+		return imageFilePath + ".ktx";
+	}
+	return imageFilePath.substr(0, extension) + ".ktx";
+}
 
-	// Delete the VBO that contains our vertices
-	glDeleteBuffers(1, &planeVbo);
-	glDeleteBuffers(1, &floorVbo);
-	glDeleteBuffers(1, &skyboxVbo);
+/**
+ * @brief Loads an image as a mipmapped texture image through the texture cache.
+ * The cache file next to the image is used if it was made from the image as it is now. Otherwise the image is
+ * decoded and mipmapped, compressed if allowed, and written back to the cache for next time.
+ * @param[in] imageFilePath Path to the image
+ * @param[in] repeat Whether the texture repeats, see DecodeTextureImage
+ * @param[in] compress Whether the image may be block-compressed. Pass false if the driver can't sample BC1 textures.
+ * @param[out] image Texture image
+ * @return True if the image or its cache file was loaded
+ */
+bool LoadTextureImage(const std::string& imageFilePath, bool repeat, bool compress, TextureImage& image)
+{
+	std::string cacheFilePath = GetTextureCachePath(imageFilePath);
 
-	// Delete the vertex array object
-	glDeleteVertexArrays(1, &planeVao);
-	glDeleteVertexArrays(1, &floorVao);
-	glDeleteVertexArrays(1, &skyboxVao);
+	std::vector<char> fileData;
+	std::ifstream imageFile(imageFilePath, std::ios::binary | std::ios::ate);
+	bool hasImage = !imageFile.fail();
+	if (hasImage)
+	{
+		fileData.resize(static_cast<size_t>(imageFile.tellg()));
+		imageFile.seekg(0);
+		imageFile.read(fileData.data(), fileData.size());
+		hasImage = !imageFile.fail();
+	}
+	uint64_t cacheKey = hasImage ? GetTextureCacheKey(fileData, repeat) : 0;
 
+	// Without the image there is nothing to check the cache against, so it is trusted as it is
+	uint64_t cachedKey = 0;
+	bool cacheCurrent = ReadKtxTexture(cacheFilePath, image, cachedKey) && (!hasImage || cachedKey == cacheKey);
+	if (cacheCurrent && (compress || image.compressedFormat == 0))
+	{
+		return true;
+	}
 
-	// Remember to tell GLFW to clean itself up before exiting the application
-	glfwTerminate();
+	if (!hasImage)
+	{
+		std::cerr << "Unable to open image: " << imageFilePath << std::endl;
+		return false;
+	}
 
-	return 0;
+	if (!DecodeTextureImage(fileData, repeat, image))
+	{
+		std::cerr << "Unable to decode image: " << imageFilePath << std::endl;
+		return false;
+	}
+	if (compress)
+	{
+		CompressTextureImage(image);
+	}
+
+	// Leave a cache file that is current alone, even if this driver couldn't use it
+	if (!cacheCurrent && WriteKtxTexture(cacheFilePath, image, cacheKey))
+	{
+		std::cout << "Cached " << imageFilePath << " as " << cacheFilePath << std::endl;
+	}
+	return true;
 }
 
 /**
- * @brief Creates a shader program based on the provided file paths for the vertex and fragment shaders.
- * @param[in] vertexShaderFilePath Vertex shader file path
- * @param[in] fragmentShaderFilePath Fragment shader file path
- * @return OpenGL handle to the created shader program
+ * @brief Converts images into texture cache files ahead of time, so the first launch doesn't have to.
+ * @param[in] imageFilePaths Paths to the images
+ * @param[in] repeat Whether the textures repeat, see DecodeTextureImage
+ * @return True if every image was baked
  */
-GLuint CreateShaderProgram(const std::string& vertexShaderFilePath, const std::string& fragmentShaderFilePath)
+bool BakeTextures(const std::vector<std::string>& imageFilePaths, bool repeat)
 {
-	GLuint vertexShader = CreateShaderFromFile(GL_VERTEX_SHADER, vertexShaderFilePath);
-	GLuint fragmentShader = CreateShaderFromFile(GL_FRAGMENT_SHADER, fragmentShaderFilePath);
+	bool baked = true;
+	for (const std::string& imageFilePath : imageFilePaths)
+	{
+		TextureImage image;
+		if (!LoadTextureImage(imageFilePath, repeat, true, image))
+		{
+			baked = false;
+			continue;
+		}
 
-	GLuint program = glCreateProgram();
-	glAttachShader(program, vertexShader);
-	glAttachShader(program, fragmentShader);
+		std::cout << GetTextureCachePath(imageFilePath) << ": " << image.width << "x" << image.height << ", " << image.levelSizes.size() << " mip levels, "
+			<< (image.compressedFormat != 0 ? "BC1" : "uncompressed") << ", " << image.data.size() / 1024 << " KiB" << std::endl;
+	}
+	return baked;
+}
 
-	glLinkProgram(program);
+/**
+ * @brief Adds an image to a texture loader that hasn't been started yet. An image that is requested more than once is only loaded once.
+ * @param[in,out] loader Texture loader
+ * @param[in] imageFilePath Path to the image
+ * @param[in] repeat Whether the texture repeats, see DecodeTextureImage
+ * @return Index of the request
+ */
+size_t RequestTextureImage(TextureLoader& loader, const std::string& imageFilePath, bool repeat)
+{
+	for (size_t i = 0; i < loader.requests.size(); i++)
+	{
+		if (loader.requests[i]->imageFilePath == imageFilePath && loader.requests[i]->repeat == repeat)
+		{
+			return i;
+		}
+	}
 
-	glDetachShader(program, vertexShader);
-	glDeleteShader(vertexShader);
-	glDetachShader(program, fragmentShader);
-	glDeleteShader(fragmentShader);
+	loader.requests.emplace_back(new TextureLoadRequest());
+	loader.requests.back()->imageFilePath = imageFilePath;
+	loader.requests.back()->repeat = repeat;
+	return loader.requests.size() - 1;
+}
 
-	// Check shader program link status
-	GLint linkStatus;
-	glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
-	if (linkStatus != GL_TRUE) {
-		char infoLog[512];
-		GLsizei infoLogLen = sizeof(infoLog);
-		glGetProgramInfoLog(program, infoLogLen, &infoLogLen, infoLog);
-		std::cerr << "program link error: " << infoLog << std::endl;
+/**
+ * @brief Starts loading a texture loader's images, with one worker thread per hardware thread up to the number of images.
+ * @param[in,out] loader Texture loader
+ */
+void StartTextureLoader(TextureLoader& loader)
+{
+	size_t workerCount = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u), loader.requests.size());
+	for (size_t i = 0; i < workerCount; i++)
+	{
+		loader.workers.emplace_back([&loader]()
+		{
+			// Each worker takes the next request until there are none left
+			for (size_t index = loader.nextRequest++; index < loader.requests.size(); index = loader.nextRequest++)
+			{
+				TextureLoadRequest& request = *loader.requests[index];
+				request.loaded = LoadTextureImage(request.imageFilePath, request.repeat, loader.compress, request.image);
+				request.done.store(true, std::memory_order_release);
+			}
+		});
 	}
+}
 
-	return program;
+/**
+ * @brief Waits for a texture loader's workers to finish the images they are loading, abandons the rest, and frees them all.
+ * @param[in,out] loader Texture loader
+ */
+void StopTextureLoader(TextureLoader& loader)
+{
+	loader.nextRequest = loader.requests.size();
+	for (std::thread& worker : loader.workers)
+	{
+		worker.join();
+	}
+	loader.workers.clear();
+	loader.requests.clear();
 }
 
 /**
- * @brief Creates a shader based on the provided shader type and the path to the file containing the shader source.
- * @param[in] shaderType Shader type
- * @param[in] shaderFilePath Path to the file containing the shader source
- * @return OpenGL handle to the created shader
+ * @brief Creates a texture array or cube map whose layers or faces are a single texel of one colour.
+ * @param[in] target GL_TEXTURE_2D_ARRAY or GL_TEXTURE_CUBE_MAP
+ * @param[in] layerCount Number of layers in a texture array. Cube maps always have 6 faces.
+ * @param[in] color RGB colour of the placeholder
+ * @return Name of the texture
  */
-GLuint CreateShaderFromFile(const GLuint& shaderType, const std::string& shaderFilePath)
+GLuint CreatePlaceholderTexture(GLenum target, GLsizei layerCount, const GLubyte color[3])
 {
-	std::ifstream shaderFile(shaderFilePath);
-	if (shaderFile.fail())
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(target, texture);
+
+	// One RGBA texel per layer or face, so the rows need no padding
+	GLsizei texelCount = (target == GL_TEXTURE_CUBE_MAP) ? 6 : layerCount;
+	std::vector<GLubyte> texels;
+	for (GLsizei i = 0; i < texelCount; i++)
 	{
-		std::cerr << "Unable to open shader file: " << shaderFilePath << std::endl;
-		return 0;
+		texels.insert(texels.end(), { color[0], color[1], color[2], 255 });
 	}
 
-	std::string shaderSource;
-	std::string temp;
-	while (std::getline(shaderFile, temp))
+	if (target == GL_TEXTURE_CUBE_MAP)
 	{
-		shaderSource += temp + "\n";
+		for (GLenum i = 0; i < 6; i++)
+		{
+			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, texels.data() + i * 4);
+		}
+	}
+	else
+	{
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, 1, 1, layerCount, 0, GL_RGBA, GL_UNSIGNED_BYTE, texels.data());
 	}
-	shaderFile.close();
 
-	return CreateShaderFromSource(shaderType, shaderSource);
+	glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, 0);
+	glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(target, 0);
+
+	return texture;
 }
 
 /**
- * @brief Creates a shader based on the provided shader type and the string containing the shader source.
- * @param[in] shaderType Shader type
- * @param[in] shaderSource Shader source string
- * @return OpenGL handle to the created shader
+ * @brief Replaces the layers of a texture array or the faces of a cube map with mipmapped images, streamed through a pixel buffer object.
+ * Texture arrays repeat and are filtered anisotropically, and cube maps are clamped at the edges.
+ * @param[in] texture Name of the texture
+ * @param[in] target GL_TEXTURE_2D_ARRAY or GL_TEXTURE_CUBE_MAP
+ * @param[in] images Image for each layer, or for the +X, -X, +Y, -Y, +Z and -Z faces. They must all be the same size and format.
+ * @param[in] anisotropy Maximum anisotropic filtering ratio. It is clamped to what the driver supports, and 1 disables it.
+ * @param[in] pixelBuffer Pixel buffer object to stream the images through. It is reallocated to fit them.
+ * @return True if the images were uploaded
  */
-GLuint CreateShaderFromSource(const GLuint& shaderType, const std::string& shaderSource)
+bool UploadTexture(GLuint texture, GLenum target, const std::vector<const TextureImage*>& images, int anisotropy, GLuint pixelBuffer)
 {
-	GLuint shader = glCreateShader(shaderType);
+	const TextureImage& first = *images[0];
+	for (const TextureImage* image : images)
+	{
+		if (image->width != first.width || image->height != first.height || image->format != first.format
+			|| image->compressedFormat != first.compressedFormat || image->levelSizes.size() != first.levelSizes.size())
+		{
+			std::cerr << "Texture images must all be " << first.width << "x" << first.height << " with the same format" << std::endl;
+			return false;
+		}
+	}
 
-	const char* shaderSourceCStr = shaderSource.c_str();
-	GLint shaderSourceLen = static_cast<GLint>(shaderSource.length());
-	glShaderSource(shader, 1, &shaderSourceCStr, &shaderSourceLen);
-	glCompileShader(shader);
+	// Every image's copy of a mip level sits next to the others, so a texture array can upload each level in one call
+	size_t bufferSize = 0;
+	for (size_t size : first.levelSizes)
+	{
+		bufferSize += size * images.size();
+	}
 
-	// Check compilation status
-	GLint compileStatus;
-	glGetShaderiv(shader, GL_COMPILE_STATUS, &compileStatus);
-	if (compileStatus == GL_FALSE)
+	// Orphaning the buffer lets the driver hand back fresh memory instead of waiting for the last upload to finish with it
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelBuffer);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, bufferSize, nullptr, GL_STREAM_DRAW);
+	char* mapped = static_cast<char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bufferSize, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+	if (mapped == nullptr)
 	{
-		char infoLog[512];
-		GLsizei infoLogLen = sizeof(infoLog);
-		glGetShaderInfoLog(shader, infoLogLen, &infoLogLen, infoLog);
-		std::cerr << "shader compilation error: " << infoLog << std::endl;
+		std::cerr << "Unable to map the texture upload buffer" << std::endl;
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return false;
 	}
 
-	return shader;
+	std::vector<size_t> levelOffsets;
+	size_t offset = 0;
+	for (size_t level = 0; level < first.levelSizes.size(); level++)
+	{
+		levelOffsets.push_back(offset);
+		for (const TextureImage* image : images)
+		{
+			std::memcpy(mapped + offset, image->data.data() + image->levelOffsets[level], image->levelSizes[level]);
+			offset += image->levelSizes[level];
+		}
+	}
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+	// With a pixel buffer bound, the data pointers are offsets into it
+	glBindTexture(target, texture);
+	GLsizei imageCount = static_cast<GLsizei>(images.size());
+	for (size_t level = 0; level < first.levelSizes.size(); level++)
+	{
+		GLint mipLevel = static_cast<GLint>(level);
+		GLsizei width = std::max(first.width >> level, 1);
+		GLsizei height = std::max(first.height >> level, 1);
+		GLsizei levelSize = static_cast<GLsizei>(first.levelSizes[level]);
+		GLenum internalFormat = (first.compressedFormat != 0) ? first.compressedFormat : ((first.format == GL_RGBA) ? GL_RGBA8 : GL_RGB8);
+		const char* levelData = reinterpret_cast<const char*>(levelOffsets[level]);
+
+		if (target == GL_TEXTURE_CUBE_MAP)
+		{
+			for (GLsizei i = 0; i < imageCount; i++)
+			{
+				GLenum face = GL_TEXTURE_CUBE_MAP_POSITIVE_X + i;
+				if (first.compressedFormat != 0)
+				{
+					glCompressedTexImage2D(face, mipLevel, internalFormat, width, height, 0, levelSize, levelData + i * levelSize);
+				}
+				else
+				{
+					glTexImage2D(face, mipLevel, internalFormat, width, height, 0, first.format, GL_UNSIGNED_BYTE, levelData + i * levelSize);
+				}
+			}
+		}
+		else if (first.compressedFormat != 0)
+		{
+			glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, mipLevel, internalFormat, width, height, imageCount, 0, levelSize * imageCount, levelData);
+		}
+		else
+		{
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, mipLevel, internalFormat, width, height, imageCount, 0, first.format, GL_UNSIGNED_BYTE, levelData);
+		}
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	GLint wrap = (target == GL_TEXTURE_CUBE_MAP) ? GL_CLAMP_TO_EDGE : GL_REPEAT;
+	glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(first.levelSizes.size()) - 1);
+	glTexParameteri(target, GL_TEXTURE_WRAP_S, wrap);
+	glTexParameteri(target, GL_TEXTURE_WRAP_T, wrap);
+	glTexParameteri(target, GL_TEXTURE_WRAP_R, wrap);
+	glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+
+	// Anisotropic filtering keeps the walls and floor sharp at grazing angles without sampling finer mip levels
+	if (anisotropy > 1)
+	{
+#ifdef GL_EXT_texture_filter_anisotropic
+		if (GLAD_GL_EXT_texture_filter_anisotropic)
+		{
+			GLfloat maxAnisotropy = 1.0f;
+			glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &maxAnisotropy);
+			glTexParameterf(target, GL_TEXTURE_MAX_ANISOTROPY_EXT, std::min(static_cast<GLfloat>(anisotropy), maxAnisotropy));
+		}
+		else
+#endif
+		{
+			std::cerr << "Anisotropic filtering is not supported, only using trilinear filtering" << std::endl;
+		}
+	}
+
+	glBindTexture(target, 0);
+	return true;
 }
 
 /**
- * @brief Function for handling the event when the size of the framebuffer changed.
- * @param[in] window Reference to the window
- * @param[in] width New width
- * @param[in] height New height
+ * @brief Uploads a pending texture if all of its images have been loaded.
+ * @param[in] loader Texture loader the images were requested from
+ * @param[in] pending Pending texture
+ * @param[in] pixelBuffer Pixel buffer object to stream the images through
+ * @return True if the texture is no longer pending. If any of its images failed to load, it keeps its placeholder.
  */
-void FramebufferSizeChangedCallback(GLFWwindow* window, int width, int height)
+bool UpdatePendingTexture(const TextureLoader& loader, const PendingTexture& pending, GLuint pixelBuffer)
 {
-	// Whenever the size of the framebuffer changed (due to window resizing, etc.),
-	// update the dimensions of the region to the new size
-	glViewport(0, 0, width, height);
+	std::vector<const TextureImage*> images;
+	bool loaded = true;
+	for (size_t index : pending.requests)
+	{
+		const TextureLoadRequest& request = *loader.requests[index];
+		if (!request.done.load(std::memory_order_acquire))
+		{
+			return false;
+		}
+		loaded = loaded && request.loaded;
+		images.push_back(&request.image);
+	}
+
+	if (loaded)
+	{
+		UploadTexture(pending.texture, pending.target, images, pending.anisotropy, pixelBuffer);
+	}
+	return true;
+}
+
+/**
+ * @brief Checks whether the shadow map still matches the current light and shadow casters.
+ * @param[in] cache Shadow cache to check
+ * @param[in] lightProjection Current light projection matrix
+ * @param[in] lightView Current light view matrix
+ * @param[in] casterVersion Current shadow caster version
+ * @return True if the shadow map can be reused as is
+ */
+bool IsShadowCacheCurrent(const ShadowCache& cache, const glm::mat4& lightProjection, const glm::mat4& lightView, uint32_t casterVersion)
+{
+	return cache.valid
+		&& cache.casterVersion == casterVersion
+		&& cache.lightProjection == lightProjection
+		&& cache.lightView == lightView;
+}
+
+/**
+ * @brief Records the light and shadow caster version that the shadow map was just rendered with.
+ * @param[out] cache Shadow cache to update
+ * @param[in] lightProjection Light projection matrix used for the depth pass
+ * @param[in] lightView Light view matrix used for the depth pass
+ * @param[in] casterVersion Shadow caster version used for the depth pass
+ */
+void UpdateShadowCache(ShadowCache& cache, const glm::mat4& lightProjection, const glm::mat4& lightView, uint32_t casterVersion)
+{
+	cache.lightProjection = lightProjection;
+	cache.lightView = lightView;
+	cache.casterVersion = casterVersion;
+	cache.valid = true;
 }
 
+/**
+ * @brief Marks the shadow casters as changed, so the shadow map is re-rendered on the next frame.
+ * Call this whenever a shadow-casting object is added, removed or moved.
+ */
+void InvalidateShadowCasters()
+{
+	++shadowCasterVersion;
+}
 
-bool checkCollision(glm::vec3 cameraPosition, std::vector<Hitbox> hitboxes)
+bool checkCollision(glm::vec3 cameraPosition, const Level& level)
 {
 	bool collisionX = false;
 	bool collisionZ = false;
 
-	for (int i = 0; i < hitboxes.size(); i++)
+	for (uint32_t i = 0; i < level.header->wallCount; i++)
 	{
-		float wallWidth = glm::distance(hitboxes[i].topL, hitboxes[i].topR);
+		const LevelWall& wall = level.walls[i];
 
-		std::cout << wallWidth << std::endl;
-		
-		if (hitboxes[i].isXWall())
-		{
-			collisionX = ((cameraPosition.x - 0.25f) + 0.5f >= hitboxes[i].topR.x) && ((float(hitboxes[i].topR.x)) >= (float(cameraPosition.x) - 0.25f));
-			collisionZ = ((cameraPosition.z - 0.25f) + 0.5f >= hitboxes[i].topR.z) && ((float(hitboxes[i].topR.z) + wallWidth) >= (cameraPosition.z - 0.25f));
-		}
-		else if (hitboxes[i].isZWall())
-		{
-			collisionX = ((cameraPosition.x - 0.25f) + 0.5f >= hitboxes[i].topR.x) && ((float(hitboxes[i].topR.x) + wallWidth) >= (cameraPosition.x - 0.25f));
-			collisionZ = ((cameraPosition.z - 0.25f) + 0.5f >= hitboxes[i].topR.z) && ((float(hitboxes[i].topR.z)) >= (float(cameraPosition.z) - 0.25f));
-		}
+		collisionX = ((cameraPosition.x - 0.25f) + 0.5f >= wall.minX) && (wall.maxX >= (cameraPosition.x - 0.25f));
+		collisionZ = ((cameraPosition.z - 0.25f) + 0.5f >= wall.minZ) && (wall.maxZ >= (cameraPosition.z - 0.25f));
 
 		if (collisionX && collisionZ)
 		{
 			std::cout << "HIT" << std::endl;
-			collidedWall = hitboxes[i];
+			collidedWall = wall;
 			return true;
 		}
 	}
@@ -1871,4 +5976,10 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 		sfxEngine->setSoundVolume(0.25f);
 		lightOn = !lightOn;
 	}
+
+	if (key == GLFW_KEY_P && action == GLFW_PRESS)
+	{
+		depthPrePass = !depthPrePass;
+		std::cout << "Depth pre-pass " << (depthPrePass ? "on" : "off") << std::endl;
+	}
 }
\ No newline at end of file